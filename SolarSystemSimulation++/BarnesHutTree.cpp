@@ -0,0 +1,421 @@
+#include "BarnesHutTree.h"
+#include "jge/ThreadPool.h"
+
+#include <math.h>
+
+// 21 bits per axis fill a 63 bit Morton code, the deepest possible level
+static const int MAX_LEVEL = 21;
+
+// Cells with fewer bodies are not subdivided
+static const uint32_t LEAF_SIZE = 16;
+
+// Subtrees below this level are built in parallel (up to 8^2 tasks)
+static const int SPLIT_LEVEL = 2;
+
+// Spreads the lower 21 bits of v so there are two zero bits between each of them
+static uint64_t SpreadBits(uint64_t v)
+{
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffffull;
+	v = (v | v << 16) & 0x1f0000ff0000ffull;
+	v = (v | v << 8) & 0x100f00f00f00f00full;
+	v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+	v = (v | v << 2) & 0x1249249249249249ull;
+	return v;
+}
+
+static uint64_t CellCoordinate(double v, double scale)
+{
+	double c = v * scale;
+	const double maxCell = (double)((1 << MAX_LEVEL) - 1);
+	return (uint64_t)(c < 0.0 ? 0.0 : (c > maxCell ? maxCell : c));
+}
+
+
+BarnesHutTree::BarnesHutTree()
+	: openingAngle(0.5)
+	, minX(0.0)
+	, minY(0.0)
+	, minZ(0.0)
+	, rootSize(1.0)
+{
+}
+
+
+void BarnesHutTree::SetOpeningAngle(double theta)
+{
+	openingAngle = theta > 0.0 ? theta : 0.0;
+}
+
+
+double BarnesHutTree::GetOpeningAngle() const
+{
+	return openingAngle;
+}
+
+
+size_t BarnesHutTree::GetNodeCount() const
+{
+	return nodes.size();
+}
+
+
+void BarnesHutTree::Build(const double* x, const double* y, const double* z, const double* mu, size_t n)
+{
+	nodes.clear();
+	if (n == 0)
+		return;
+
+	// Bounding cube
+	double maxX = x[0], maxY = y[0], maxZ = z[0];
+	minX = x[0]; minY = y[0]; minZ = z[0];
+	for (size_t i = 1; i < n; ++i)
+	{
+		minX = x[i] < minX ? x[i] : minX; maxX = x[i] > maxX ? x[i] : maxX;
+		minY = y[i] < minY ? y[i] : minY; maxY = y[i] > maxY ? y[i] : maxY;
+		minZ = z[i] < minZ ? z[i] : minZ; maxZ = z[i] > maxZ ? z[i] : maxZ;
+	}
+	rootSize = maxX - minX;
+	rootSize = maxY - minY > rootSize ? maxY - minY : rootSize;
+	rootSize = maxZ - minZ > rootSize ? maxZ - minZ : rootSize;
+	rootSize = rootSize > 0.0 ? rootSize * 1.0001 : 1.0;
+
+	// Start from the order of the last build if the bodies are the same
+	if (order.size() != n)
+	{
+		order.resize(n);
+		for (size_t i = 0; i < n; ++i)
+			order[i] = (uint32_t)i;
+	}
+
+	codes.resize(n);
+	const double scale = (double)(1 << MAX_LEVEL) / rootSize;
+	jge::ThreadPool::Shared().ParallelFor(n, 4096, [&](size_t begin, size_t end)
+	{
+		for (size_t k = begin; k < end; ++k)
+		{
+			uint32_t i = order[k];
+			codes[k] = SpreadBits(CellCoordinate(x[i] - minX, scale)) << 2
+				| SpreadBits(CellCoordinate(y[i] - minY, scale)) << 1
+				| SpreadBits(CellCoordinate(z[i] - minZ, scale));
+		}
+	});
+
+	SortByMortonCode();
+
+	// Sorted copy, the traversal walks the bodies in memory order
+	sx.Resize(n); sy.Resize(n); sz.Resize(n); smu.Resize(n);
+	jge::ThreadPool::Shared().ParallelFor(n, 4096, [&](size_t begin, size_t end)
+	{
+		for (size_t k = begin; k < end; ++k)
+		{
+			uint32_t i = order[k];
+			sx[k] = x[i]; sy[k] = y[i]; sz[k] = z[i]; smu[k] = mu[i];
+		}
+	});
+
+	// Top levels, the cells at SPLIT_LEVEL are deferred...
+	Node root = {};
+	root.size = rootSize;
+	root.end = (uint32_t)n;
+	nodes.push_back(root);
+
+	std::vector<Subtree> deferred;
+	BuildNode(nodes, 0, 0, &deferred);
+	const size_t topCount = nodes.size();
+
+	// ... and built in parallel, each into its own array
+	std::vector<std::vector<Node>> subtrees(deferred.size());
+	jge::ThreadPool::Shared().ParallelFor(deferred.size(), 1, [&](size_t begin, size_t end)
+	{
+		for (size_t t = begin; t < end; ++t)
+		{
+			subtrees[t].push_back(nodes[deferred[t].node]);
+			BuildNode(subtrees[t], 0, deferred[t].level, nullptr);
+		}
+	});
+
+	// Append the subtrees. Their root replaces the deferred cell,
+	// all other nodes move by the size of the array so far.
+	for (size_t t = 0; t < subtrees.size(); ++t)
+	{
+		const std::vector<Node>& sub = subtrees[t];
+		const uint32_t offset = (uint32_t)nodes.size() - 1;
+
+		for (size_t i = 0; i < sub.size(); ++i)
+		{
+			Node node = sub[i];
+			if (node.childCount > 0)
+				node.firstChild += offset;
+
+			if (i == 0)
+				nodes[deferred[t].node] = node;
+			else
+				nodes.push_back(node);
+		}
+	}
+
+	// Mass moments of the top levels, children come after their parents
+	for (size_t i = topCount; i-- > 0;)
+	{
+		Node& node = nodes[i];
+		if (node.childCount == 0)
+			continue;
+
+		double m = 0.0, cx = 0.0, cy = 0.0, cz = 0.0;
+		for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+		{
+			const Node& child = nodes[c];
+			m += child.mu;
+			cx += child.cx * child.mu;
+			cy += child.cy * child.mu;
+			cz += child.cz * child.mu;
+		}
+		node.mu = m;
+		if (m > 0.0)
+		{
+			node.cx = cx / m; node.cy = cy / m; node.cz = cz / m;
+		}
+		else
+		{
+			const Node& first = nodes[node.firstChild];
+			node.cx = first.cx; node.cy = first.cy; node.cz = first.cz;
+		}
+	}
+}
+
+
+void BarnesHutTree::SortByMortonCode()
+{
+	const size_t n = codes.size();
+
+	// Insertion sort: linear if the last order still (almost) fits.
+	// Give up once the bodies got shuffled too much.
+	const size_t maxMoves = 8 * n;
+	size_t moves = 0;
+	for (size_t k = 1; k < n && moves < maxMoves; ++k)
+	{
+		uint64_t code = codes[k];
+		uint32_t index = order[k];
+		size_t j = k;
+		for (; j > 0 && codes[j - 1] > code && moves < maxMoves; --j, ++moves)
+		{
+			codes[j] = codes[j - 1];
+			order[j] = order[j - 1];
+		}
+		codes[j] = code;
+		order[j] = index;
+	}
+
+	if (moves < maxMoves)
+		return;
+
+	// LSD radix sort, 8 bits per pass. Passes where all codes share the digit are skipped.
+	scratchCodes.resize(n);
+	scratchOrder.resize(n);
+	for (int shift = 0; shift < 64; shift += 8)
+	{
+		size_t histogram[256] = {};
+		for (size_t k = 0; k < n; ++k)
+			histogram[(codes[k] >> shift) & 0xff]++;
+
+		if (histogram[(codes[0] >> shift) & 0xff] == n)
+			continue;
+
+		size_t sum = 0;
+		for (int d = 0; d < 256; ++d)
+		{
+			size_t c = histogram[d];
+			histogram[d] = sum;
+			sum += c;
+		}
+
+		for (size_t k = 0; k < n; ++k)
+		{
+			size_t dst = histogram[(codes[k] >> shift) & 0xff]++;
+			scratchCodes[dst] = codes[k];
+			scratchOrder[dst] = order[k];
+		}
+		codes.swap(scratchCodes);
+		order.swap(scratchOrder);
+	}
+}
+
+
+void BarnesHutTree::BuildNode(std::vector<Node>& nodes, uint32_t index, int level, std::vector<Subtree>* deferred) const
+{
+	Node node = nodes[index];
+
+	if (node.end - node.begin <= LEAF_SIZE || level >= MAX_LEVEL)
+	{
+		ComputeLeafMoments(node);
+		nodes[index] = node;
+		return;
+	}
+
+	if (deferred && level >= SPLIT_LEVEL)
+	{
+		Subtree s = { index, level };
+		deferred->push_back(s);
+		return;
+	}
+
+	// The bodies of the cell share the code prefix, the next 3 bits select the
+	// octant. Thus the octants are consecutive ranges, find their bounds.
+	const int shift = 3 * (MAX_LEVEL - 1 - level);
+	uint32_t bounds[9];
+	bounds[0] = node.begin;
+	for (uint32_t octant = 0; octant < 8; ++octant)
+	{
+		uint32_t lo = bounds[octant], hi = node.end;
+		while (lo < hi)
+		{
+			uint32_t mid = (lo + hi) / 2;
+			if (((codes[mid] >> shift) & 7) <= octant)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		bounds[octant + 1] = lo;
+	}
+
+	node.firstChild = (uint32_t)nodes.size();
+	node.childCount = 0;
+	for (uint32_t octant = 0; octant < 8; ++octant)
+	{
+		if (bounds[octant] == bounds[octant + 1])
+			continue;
+
+		Node child = {};
+		child.size = node.size * 0.5;
+		child.begin = bounds[octant];
+		child.end = bounds[octant + 1];
+		nodes.push_back(child);
+		node.childCount++;
+	}
+	nodes[index] = node;
+
+	for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+		BuildNode(nodes, c, level + 1, deferred);
+
+	// The top levels are summed up after the subtrees were merged
+	if (deferred)
+		return;
+
+	double m = 0.0, cx = 0.0, cy = 0.0, cz = 0.0;
+	for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+	{
+		const Node& child = nodes[c];
+		m += child.mu;
+		cx += child.cx * child.mu;
+		cy += child.cy * child.mu;
+		cz += child.cz * child.mu;
+	}
+	node.mu = m;
+	if (m > 0.0)
+	{
+		node.cx = cx / m; node.cy = cy / m; node.cz = cz / m;
+	}
+	else
+	{
+		node.cx = nodes[node.firstChild].cx; node.cy = nodes[node.firstChild].cy; node.cz = nodes[node.firstChild].cz;
+	}
+	nodes[index] = node;
+}
+
+
+void BarnesHutTree::ComputeLeafMoments(Node& node) const
+{
+	double m = 0.0, cx = 0.0, cy = 0.0, cz = 0.0;
+	for (uint32_t k = node.begin; k < node.end; ++k)
+	{
+		m += smu[k];
+		cx += sx[k] * smu[k];
+		cy += sy[k] * smu[k];
+		cz += sz[k] * smu[k];
+	}
+
+	node.firstChild = 0;
+	node.childCount = 0;
+	node.mu = m;
+	if (m > 0.0)
+	{
+		node.cx = cx / m; node.cy = cy / m; node.cz = cz / m;
+	}
+	else
+	{
+		node.cx = sx[node.begin]; node.cy = sy[node.begin]; node.cz = sz[node.begin];
+	}
+}
+
+
+void BarnesHutTree::ComputeAccelerations(double softening2, double* ax, double* ay, double* az) const
+{
+	if (nodes.empty())
+		return;
+
+	const double theta2 = openingAngle * openingAngle;
+	const size_t n = order.size();
+
+	// Neighbouring bodies in Morton order walk nearly the same path through the tree
+	jge::ThreadPool::Shared().ParallelFor(n, 256, [&](size_t begin, size_t end)
+	{
+		// Depth <= MAX_LEVEL, at most 8 children pushed per level
+		uint32_t stack[8 * (MAX_LEVEL + 1)];
+
+		for (size_t k = begin; k < end; ++k)
+		{
+			const double x = sx[k], y = sy[k], z = sz[k];
+			double accX = 0.0, accY = 0.0, accZ = 0.0;
+
+			int top = 0;
+			stack[top++] = 0;
+			while (top > 0)
+			{
+				const Node& node = nodes[stack[--top]];
+				if (node.mu == 0.0)
+					continue;
+
+				double dx = node.cx - x;
+				double dy = node.cy - y;
+				double dz = node.cz - z;
+				double d2 = dx * dx + dy * dy + dz * dz;
+
+				if (node.childCount == 0)
+				{
+					// Leaf: sum up its bodies, our own contribution is 0 (dx = 0)
+					for (uint32_t j = node.begin; j < node.end; ++j)
+					{
+						double bx = sx[j] - x;
+						double by = sy[j] - y;
+						double bz = sz[j] - z;
+						double r2 = bx * bx + by * by + bz * bz + softening2;
+						double s = smu[j] / (r2 * sqrt(r2));
+						accX += bx * s;
+						accY += by * s;
+						accZ += bz * s;
+					}
+				}
+				else if (node.size * node.size < theta2 * d2)
+				{
+					// Far enough away: center of mass
+					double r2 = d2 + softening2;
+					double s = node.mu / (r2 * sqrt(r2));
+					accX += dx * s;
+					accY += dy * s;
+					accZ += dz * s;
+				}
+				else
+				{
+					for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+						stack[top++] = c;
+				}
+			}
+
+			uint32_t i = order[k];
+			ax[i] = accX;
+			ay[i] = accY;
+			az[i] = accZ;
+		}
+	});
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include "jge/AlignedArray.h"
+
+/**
+* Barnes-Hut octree for approximated gravity in O(n log n).
+* The bodies are sorted along a Morton (Z-order) curve, every cell of the tree
+* then covers a contiguous range of the sorted bodies. The permutation of the
+* last build is kept: bodies move little between two steps, so the next sort
+* starts from an almost sorted array and is close to linear.
+*/
+class BarnesHutTree
+{
+public:
+	BarnesHutTree();
+
+	/**
+	* Sets the opening angle theta. A cell of edge length s at distance d is
+	* approximated by its center of mass if s / d < theta. 0 = exact.
+	*/
+	void SetOpeningAngle(double theta);
+	double GetOpeningAngle() const;
+
+	// Sorts the bodies and (re)builds the tree. <mu> is G * mass.
+	void Build(const double* x, const double* y, const double* z, const double* mu, size_t n);
+
+	// Accelerations of all bodies passed to the last Build(), in their original order
+	void ComputeAccelerations(double softening2, double* ax, double* ay, double* az) const;
+
+	size_t GetNodeCount() const;
+
+private:
+	struct Node
+	{
+		double cx, cy, cz;		// center of mass
+		double mu;				// total G * mass
+		double size;			// edge length of the cell
+		uint32_t firstChild;	// children are stored consecutively, 0 for a leaf
+		uint32_t childCount;
+		uint32_t begin;			// range of sorted bodies
+		uint32_t end;
+	};
+
+	struct Subtree
+	{
+		uint32_t node;
+		int level;
+	};
+
+	void SortByMortonCode();
+	void BuildNode(std::vector<Node>& nodes, uint32_t index, int level, std::vector<Subtree>* deferred) const;
+	void ComputeLeafMoments(Node& node) const;
+
+	double openingAngle;
+
+	// Bounding cube of the last build
+	double minX, minY, minZ;
+	double rootSize;
+
+	// Morton codes & body indices in sorted order, kept for the next build
+	std::vector<uint64_t> codes;
+	std::vector<uint32_t> order;
+	std::vector<uint64_t> scratchCodes;
+	std::vector<uint32_t> scratchOrder;
+
+	// Sorted copy of the bodies
+	jge::AlignedArray<double> sx, sy, sz, smu;
+
+	std::vector<Node> nodes;
+};
@@ -0,0 +1,396 @@
+#include "BodyCatalog.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glm/detail/func_trigonometric.hpp>
+
+static_assert(sizeof(PlanetInfo) == 10 * sizeof(float), "PlanetInfo is stored as is");
+
+static const char MAGIC[4] = { 'S', 'S', 'B', 'C' };
+
+// Bytes per body of every column, NAMES is sized by the header
+static const size_t ELEMENT_SIZES[BodyCatalog::COLUMN_COUNT] = {
+	sizeof(float),				// SIZE
+	sizeof(double),				// SEMI_MAJOR_AXIS
+	sizeof(double),				// SEMI_MINOR_AXIS
+	sizeof(double),				// ECCENTRICITY
+	sizeof(double),				// MEAN_ANOMALY_PHASE
+	sizeof(double),				// INV_ROUND_TRIP_TIME
+	sizeof(double),				// INV_SELF_ROTATION_TIME
+	sizeof(float),				// TILT_COS
+	sizeof(float),				// TILT_SIN
+	sizeof(double),				// PERIAPSIS_X
+	sizeof(double),				// PERIAPSIS_Y
+	sizeof(double),				// PERIAPSIS_Z
+	sizeof(double),				// PERPENDICULAR_X
+	sizeof(double),				// PERPENDICULAR_Y
+	sizeof(double),				// PERPENDICULAR_Z
+	sizeof(int32_t),			// PARENT
+	sizeof(PlanetInfo),			// INFO
+	sizeof(double),				// MASS_RATIO
+	sizeof(int32_t),			// EPHEMERIS_ID
+	sizeof(double),				// MEAN_DISTANCE_KM
+	sizeof(uint32_t),			// NAME_OFFSET
+	0,							// NAMES
+};
+
+static const int CSV_FIELDS = 15;
+
+static uint64_t Align(uint64_t offset)
+{
+	return (offset + 7) & ~(uint64_t)7;
+}
+
+// Appends [data + begin, data + end) to <column>
+template <typename T, typename U>
+static void AppendColumn(std::vector<T>& column, const U* data, size_t begin, size_t end)
+{
+	column.insert(column.end(), data + begin, data + end);
+}
+
+// Splits <line> at the commas in place and trims the fields. Returns the field count.
+static int SplitCsv(char* line, char** fields, int maxFields)
+{
+	int count = 0;
+	char* p = line;
+	while (count < maxFields)
+	{
+		while (*p == ' ' || *p == '\t')
+			++p;
+		fields[count++] = p;
+
+		char* end = p;
+		while (*end && *end != ',' && *end != '\r' && *end != '\n')
+			++end;
+		const bool last = *end != ',';
+
+		char* trim = end;
+		while (trim > p && (trim[-1] == ' ' || trim[-1] == '\t'))
+			--trim;
+		*trim = '\0';
+
+		if (last)
+			break;
+		p = end + 1;
+	}
+	return count;
+}
+
+
+BodyCatalog::BodyCatalog()
+	: count(0)
+	, nameBytes(0)
+{
+	memset(columns, 0, sizeof(columns));
+}
+
+bool BodyCatalog::Open(const char* path)
+{
+	Close();
+
+	if (!file.Open(path))
+	{
+		printf("Can't open body catalog %s\r\n", path);
+		return false;
+	}
+
+	const unsigned char* data = file.GetData();
+	const uint64_t fileSize = file.GetSize();
+
+	Header header;
+	if (fileSize < sizeof(header))
+	{
+		printf("%s is too small to be a body catalog\r\n", path);
+		Close();
+		return false;
+	}
+	memcpy(&header, data, sizeof(header));
+
+	// Byte swapped files fail the version check
+	if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION)
+	{
+		printf("%s is no body catalog of version %u or has the wrong byte order\r\n", path, VERSION);
+		Close();
+		return false;
+	}
+
+	// Only the layout is checked, the columns themselves are used as they are
+	bool valid = header.count > 0 && header.count <= fileSize && header.nameBytes > 0 && header.nameBytes <= fileSize;
+	for (int c = 0; c < COLUMN_COUNT && valid; ++c)
+	{
+		const uint64_t bytes = c == NAMES ? header.nameBytes : header.count * ELEMENT_SIZES[c];
+		valid = header.columns[c] % 8 == 0 && header.columns[c] <= fileSize && bytes <= fileSize - header.columns[c];
+	}
+	if (!valid || data[header.columns[NAMES] + header.nameBytes - 1] != '\0')
+	{
+		printf("%s is truncated or damaged\r\n", path);
+		Close();
+		return false;
+	}
+
+	for (int c = 0; c < COLUMN_COUNT; ++c)
+		columns[c] = data + header.columns[c];
+	count = (size_t)header.count;
+	nameBytes = header.nameBytes;
+
+	printf("Loaded %d bodies from %s\r\n", (int)count, path);
+	return true;
+}
+
+void BodyCatalog::Close()
+{
+	file.Close();
+	memset(columns, 0, sizeof(columns));
+	count = 0;
+	nameBytes = 0;
+}
+
+bool BodyCatalog::IsOpen() const
+{
+	return count > 0;
+}
+
+size_t BodyCatalog::Count() const
+{
+	return count;
+}
+
+const char* BodyCatalog::GetName(size_t body) const
+{
+	// The names end with a zero, any offset inside them yields a valid string
+	uint32_t offset = GetColumn<uint32_t>(NAME_OFFSET)[body];
+	if (offset >= nameBytes)
+		return "";
+	return GetColumn<char>(NAMES) + offset;
+}
+
+const PlanetInfo& BodyCatalog::GetInfo(size_t body) const
+{
+	return GetColumn<PlanetInfo>(INFO)[body];
+}
+
+int BodyCatalog::GetParent(size_t body) const
+{
+	return GetColumn<int32_t>(PARENT)[body];
+}
+
+double BodyCatalog::GetMassRatio(size_t body) const
+{
+	return GetColumn<double>(MASS_RATIO)[body];
+}
+
+int BodyCatalog::GetEphemerisId(size_t body) const
+{
+	return GetColumn<int32_t>(EPHEMERIS_ID)[body];
+}
+
+double BodyCatalog::GetMeanDistanceKm(size_t body) const
+{
+	return GetColumn<double>(MEAN_DISTANCE_KM)[body];
+}
+
+int BodyCatalog::Find(const char* name) const
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (strcmp(GetName(i), name) == 0)
+			return (int)i;
+	}
+	return -1;
+}
+
+void BodyCatalog::LoadElements(OrbitalElements& elements, size_t begin, size_t end) const
+{
+	if (end > count)
+		end = count;
+	if (begin >= end)
+		return;
+
+	AppendColumn(elements.size, GetColumn<float>(SIZE), begin, end);
+	AppendColumn(elements.semiMajorAxis, GetColumn<double>(SEMI_MAJOR_AXIS), begin, end);
+	AppendColumn(elements.semiMinorAxis, GetColumn<double>(SEMI_MINOR_AXIS), begin, end);
+	AppendColumn(elements.eccentricity, GetColumn<double>(ECCENTRICITY), begin, end);
+	AppendColumn(elements.meanAnomalyPhase, GetColumn<double>(MEAN_ANOMALY_PHASE), begin, end);
+	AppendColumn(elements.invRoundTripTime, GetColumn<double>(INV_ROUND_TRIP_TIME), begin, end);
+	AppendColumn(elements.invSelfRotationTime, GetColumn<double>(INV_SELF_ROTATION_TIME), begin, end);
+	AppendColumn(elements.tiltCos, GetColumn<float>(TILT_COS), begin, end);
+	AppendColumn(elements.tiltSin, GetColumn<float>(TILT_SIN), begin, end);
+	AppendColumn(elements.periapsisX, GetColumn<double>(PERIAPSIS_X), begin, end);
+	AppendColumn(elements.periapsisY, GetColumn<double>(PERIAPSIS_Y), begin, end);
+	AppendColumn(elements.periapsisZ, GetColumn<double>(PERIAPSIS_Z), begin, end);
+	AppendColumn(elements.perpendicularX, GetColumn<double>(PERPENDICULAR_X), begin, end);
+	AppendColumn(elements.perpendicularY, GetColumn<double>(PERPENDICULAR_Y), begin, end);
+	AppendColumn(elements.perpendicularZ, GetColumn<double>(PERPENDICULAR_Z), begin, end);
+
+	// Rebase the parents, this also drops parents that don't precede their children
+	const int32_t* parents = GetColumn<int32_t>(PARENT);
+	const int first = (int)elements.parents.size();
+	elements.parents.reserve(elements.parents.size() + end - begin);
+	for (size_t i = begin; i < end; ++i)
+	{
+		int parent = parents[i];
+		bool inside = parent >= (int)begin && parent < (int)i;
+		elements.parents.push_back(inside ? first + parent - (int)begin : -1);
+	}
+}
+
+bool BodyCatalog::Convert(const char* csvPath, const char* catalogPath)
+{
+	FILE* csv = fopen(csvPath, "r");
+	if (!csv)
+	{
+		printf("Can't open %s\r\n", csvPath);
+		return false;
+	}
+
+	OrbitalElements elements;
+	std::vector<PlanetInfo> infos;
+	std::vector<double> massRatios;
+	std::vector<int32_t> ephemerisIds;
+	std::vector<double> meanDistances;
+	std::vector<uint32_t> nameOffsets;
+	std::string names;
+	std::unordered_map<std::string, int> indices;
+
+	char line[1024];
+	int lineNumber = 0;
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), csv))
+	{
+		++lineNumber;
+
+		// Comments, the header line and empty lines
+		char* fields[CSV_FIELDS];
+		if (line[0] == '#' || strncmp(line, "name,", 5) == 0 || line[strspn(line, " \t\r\n")] == '\0')
+			continue;
+
+		if (SplitCsv(line, fields, CSV_FIELDS) != CSV_FIELDS || fields[0][0] == '\0')
+		{
+			printf("%s(%d): expected %d fields and a name\r\n", csvPath, lineNumber, CSV_FIELDS);
+			ok = false;
+			break;
+		}
+
+		int parent = -1;
+		if (fields[1][0] != '\0')
+		{
+			auto found = indices.find(fields[1]);
+			if (found == indices.end())
+			{
+				printf("%s(%d): parent %s has to be listed before %s\r\n", csvPath, lineNumber, fields[1], fields[0]);
+				ok = false;
+				break;
+			}
+			parent = found->second;
+		}
+
+		double v[CSV_FIELDS];
+		for (int f = 2; f < CSV_FIELDS; ++f)
+			v[f] = strtod(fields[f], nullptr);
+
+		PlanetInfo info(
+			(float)v[2],
+			(float)v[3],
+			(float)v[4],
+			(float)v[5],
+			glm::radians((float)v[6]),
+			glm::radians((float)v[7]),
+			(float)v[8],
+			glm::radians((float)v[9]),
+			glm::radians((float)v[10]),
+			glm::radians((float)v[11]));
+
+		const int index = elements.Add(info, parent);
+		if (!indices.emplace(fields[0], index).second)
+			printf("%s(%d): %s is listed twice, children refer to the first one\r\n", csvPath, lineNumber, fields[0]);
+
+		infos.push_back(info);
+		massRatios.push_back(v[12]);
+		ephemerisIds.push_back(fields[13][0] != '\0' ? (int32_t)v[13] : -1);
+		meanDistances.push_back(v[14]);
+		nameOffsets.push_back((uint32_t)names.size());
+		names.append(fields[0]);
+		names.push_back('\0');
+	}
+	fclose(csv);
+
+	if (!ok)
+		return false;
+	if (infos.empty())
+	{
+		printf("%s contains no bodies\r\n", csvPath);
+		return false;
+	}
+
+	const void* data[COLUMN_COUNT] = {
+		elements.size.data(),
+		elements.semiMajorAxis.data(),
+		elements.semiMinorAxis.data(),
+		elements.eccentricity.data(),
+		elements.meanAnomalyPhase.data(),
+		elements.invRoundTripTime.data(),
+		elements.invSelfRotationTime.data(),
+		elements.tiltCos.data(),
+		elements.tiltSin.data(),
+		elements.periapsisX.data(),
+		elements.periapsisY.data(),
+		elements.periapsisZ.data(),
+		elements.perpendicularX.data(),
+		elements.perpendicularY.data(),
+		elements.perpendicularZ.data(),
+		elements.parents.data(),
+		infos.data(),
+		massRatios.data(),
+		ephemerisIds.data(),
+		meanDistances.data(),
+		nameOffsets.data(),
+		names.data(),
+	};
+
+	Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.count = infos.size();
+	header.nameBytes = names.size();
+
+	uint64_t bytes[COLUMN_COUNT];
+	uint64_t offset = Align(sizeof(header));
+	for (int c = 0; c < COLUMN_COUNT; ++c)
+	{
+		bytes[c] = c == NAMES ? header.nameBytes : header.count * ELEMENT_SIZES[c];
+		header.columns[c] = offset;
+		offset = Align(offset + bytes[c]);
+	}
+
+	FILE* out = fopen(catalogPath, "wb");
+	if (!out)
+	{
+		printf("Can't open %s for writing\r\n", catalogPath);
+		return false;
+	}
+
+	const char padding[8] = {};
+	fwrite(&header, sizeof(header), 1, out);
+	fwrite(padding, 1, (size_t)(Align(sizeof(header)) - sizeof(header)), out);
+	for (int c = 0; c < COLUMN_COUNT; ++c)
+	{
+		fwrite(data[c], 1, (size_t)bytes[c], out);
+		fwrite(padding, 1, (size_t)(Align(bytes[c]) - bytes[c]), out);
+	}
+
+	ok = ferror(out) == 0;
+	fclose(out);
+	if (!ok)
+	{
+		printf("Writing %s failed\r\n", catalogPath);
+		return false;
+	}
+
+	printf("Converted %d bodies from %s to %s\r\n", (int)header.count, csvPath, catalogPath);
+	return true;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "jge/MappedFile.h"
+#include "OrbitalElements.h"
+#include "PlanetInfo.h"
+
+/**
+* Binary catalog of all simulated bodies, memory mapped on Open().
+* Next to the plain body properties it stores the precomputed columns of
+* OrbitalElements, so loading is one bulk copy per column instead of
+* parsing and converting every body. That keeps catalogs with hundreds of
+* thousands of bodies (e.g. the minor planet list) well below a second.
+*
+* The file is in native byte order: a header with the byte offset of each
+* column, then the columns, each 8 byte aligned. Convert() builds it from
+* a CSV table, see catalog\bodies.csv for the columns.
+*/
+class BodyCatalog
+{
+public:
+	BodyCatalog();
+
+	// Maps the file and checks its header, prints the reason on failure
+	bool Open(const char* path);
+	void Close();
+	bool IsOpen() const;
+
+	size_t Count() const;
+	const char* GetName(size_t body) const;
+	const PlanetInfo& GetInfo(size_t body) const;
+	int GetParent(size_t body) const;				// -1 for none, parents precede their children
+	double GetMassRatio(size_t body) const;			// relative to the sun
+	int GetEphemerisId(size_t body) const;			// JplEphemeris::Body, -1 if not covered
+	double GetMeanDistanceKm(size_t body) const;	// real mean distance to the parent
+
+	// Index of the body called <name> or -1. Linear search.
+	int Find(const char* name) const;
+
+	// Appends the bodies [begin, end) to <elements>. Parents are made relative
+	// to <begin>, bodies whose parent lies before <begin> orbit the origin.
+	void LoadElements(OrbitalElements& elements, size_t begin, size_t end) const;
+
+	// Reads the CSV table <csvPath> and writes it as catalog to <catalogPath>
+	static bool Convert(const char* csvPath, const char* catalogPath);
+
+	enum Column
+	{
+		SIZE = 0,
+		SEMI_MAJOR_AXIS,
+		SEMI_MINOR_AXIS,
+		ECCENTRICITY,
+		MEAN_ANOMALY_PHASE,
+		INV_ROUND_TRIP_TIME,
+		INV_SELF_ROTATION_TIME,
+		TILT_COS,
+		TILT_SIN,
+		PERIAPSIS_X,
+		PERIAPSIS_Y,
+		PERIAPSIS_Z,
+		PERPENDICULAR_X,
+		PERPENDICULAR_Y,
+		PERPENDICULAR_Z,
+		PARENT,
+		INFO,						// PlanetInfo as stored in the CSV
+		MASS_RATIO,
+		EPHEMERIS_ID,
+		MEAN_DISTANCE_KM,
+		NAME_OFFSET,				// into NAMES
+		NAMES,						// zero terminated names back to back
+		COLUMN_COUNT
+	};
+
+	struct Header
+	{
+		char magic[4];				// "SSBC"
+		uint32_t version;
+		uint64_t count;
+		uint64_t nameBytes;
+		uint64_t columns[COLUMN_COUNT];
+	};
+
+	static const uint32_t VERSION = 1;
+
+private:
+	BodyCatalog(const BodyCatalog&) = delete;
+	BodyCatalog& operator=(const BodyCatalog&) = delete;
+
+	template <typename T>
+	const T* GetColumn(Column column) const
+	{
+		return (const T*)columns[column];
+	}
+
+	jge::MappedFile file;
+	size_t count;
+	uint64_t nameBytes;
+	const unsigned char* columns[COLUMN_COUNT];
+};
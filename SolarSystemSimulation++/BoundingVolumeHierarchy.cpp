@@ -0,0 +1,436 @@
+#include "BoundingVolumeHierarchy.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+
+using namespace glm;
+
+static const uint32_t LEAF_SIZE = 4;		// never split below
+static const uint32_t MAX_LEAF_SIZE = 16;	// always split above
+static const int BIN_COUNT = 16;
+static const int STACK_SIZE = 64;			// deeper trees traverse with a heap allocated stack
+
+static float HalfArea(const vec3& lower, const vec3& upper)
+{
+	vec3 e = upper - lower;
+	return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+// Distance along the ray to the box, FLT_MAX if it misses or the box lies beyond <maxT>
+static float RayBox(const vec3& origin, const vec3& invDirection, const vec3& lower, const vec3& upper, float maxT)
+{
+	vec3 t0 = (lower - origin) * invDirection;
+	vec3 t1 = (upper - origin) * invDirection;
+	vec3 tMin = min(t0, t1);
+	vec3 tMax = max(t0, t1);
+	float enter = max(max(tMin.x, tMin.y), max(tMin.z, 0.0f));
+	float exit = min(min(tMax.x, tMax.y), min(tMax.z, maxT));
+	return enter <= exit ? enter : FLT_MAX;
+}
+
+static float PointBoxDistance(const vec3& p, const vec3& lower, const vec3& upper)
+{
+	vec3 d = max(max(lower - p, p - upper), vec3(0.0f));
+	return length(d);
+}
+
+
+BoundingVolumeHierarchy::BoundingVolumeHierarchy()
+	: rebuildThreshold(1.5f)
+	, builtArea(0.0f)
+	, rebuildCount(0)
+	, maxDepth(0)
+{
+}
+
+void BoundingVolumeHierarchy::SetRebuildThreshold(float factor)
+{
+	rebuildThreshold = factor;
+}
+
+size_t BoundingVolumeHierarchy::GetCount() const
+{
+	return centers.size();
+}
+
+size_t BoundingVolumeHierarchy::GetNodeCount() const
+{
+	return nodes.size();
+}
+
+size_t BoundingVolumeHierarchy::GetRebuildCount() const
+{
+	return rebuildCount;
+}
+
+void BoundingVolumeHierarchy::Build(const vec3* c, const float* r, size_t count)
+{
+	centers.assign(c, c + count);
+	radii.assign(r, r + count);
+
+	order.resize(count);
+	for (size_t i = 0; i < count; ++i)
+		order[i] = (uint32_t)i;
+
+	nodes.clear();
+	maxDepth = 0;
+	if (count == 0)
+	{
+		builtArea = 0.0f;
+		return;
+	}
+
+	// Boxes of the spheres, the build works on them
+	boxLower.resize(count);
+	boxUpper.resize(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		float radius = glm::max(radii[i], 0.0f);
+		boxLower[i] = centers[i] - vec3(radius);
+		boxUpper[i] = centers[i] + vec3(radius);
+	}
+
+	nodes.reserve(2 * count / LEAF_SIZE + 1);
+	nodes.push_back(Node());
+	BuildNode(0, 0, (uint32_t)count, 0);
+	builtArea = RefitBoxes();
+}
+
+void BoundingVolumeHierarchy::BuildNode(uint32_t node, uint32_t begin, uint32_t end, uint32_t depth)
+{
+	const uint32_t count = end - begin;
+	maxDepth = glm::max(maxDepth, depth);
+
+	vec3 lower(FLT_MAX), upper(-FLT_MAX);
+	vec3 centerLower(FLT_MAX), centerUpper(-FLT_MAX);
+	for (uint32_t i = begin; i < end; ++i)
+	{
+		uint32_t s = order[i];
+		lower = min(lower, boxLower[s]);
+		upper = max(upper, boxUpper[s]);
+		centerLower = min(centerLower, centers[s]);
+		centerUpper = max(centerUpper, centers[s]);
+	}
+	nodes[node].lower = lower;
+	nodes[node].upper = upper;
+	nodes[node].first = begin;
+	nodes[node].count = count;
+
+	if (count <= LEAF_SIZE)
+		return;
+
+	// Split along the axis the centers spread the most
+	vec3 extent = centerUpper - centerLower;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	if (extent[axis] <= 0.0f)
+		return;
+
+	// Binned surface area heuristic
+	struct Bin
+	{
+		vec3 lower, upper;
+		uint32_t count;
+	};
+	Bin bins[BIN_COUNT];
+	for (int b = 0; b < BIN_COUNT; ++b)
+	{
+		bins[b].lower = vec3(FLT_MAX);
+		bins[b].upper = vec3(-FLT_MAX);
+		bins[b].count = 0;
+	}
+
+	const float scale = BIN_COUNT / extent[axis] * 0.9999f;
+	auto binOf = [&](uint32_t s)
+	{
+		return (int)((centers[s][axis] - centerLower[axis]) * scale);
+	};
+	for (uint32_t i = begin; i < end; ++i)
+	{
+		uint32_t s = order[i];
+		Bin& bin = bins[binOf(s)];
+		bin.lower = min(bin.lower, boxLower[s]);
+		bin.upper = max(bin.upper, boxUpper[s]);
+		++bin.count;
+	}
+
+	// Cost of the splits behind every bin, the right sides summed from the back
+	float rightCost[BIN_COUNT];
+	vec3 l(FLT_MAX), u(-FLT_MAX);
+	uint32_t n = 0;
+	for (int b = BIN_COUNT - 1; b > 0; --b)
+	{
+		l = min(l, bins[b].lower);
+		u = max(u, bins[b].upper);
+		n += bins[b].count;
+		rightCost[b] = n > 0 ? HalfArea(l, u) * n : 0.0f;
+	}
+
+	int bestSplit = -1;
+	float bestCost = FLT_MAX;
+	l = vec3(FLT_MAX);
+	u = vec3(-FLT_MAX);
+	n = 0;
+	for (int b = 1; b < BIN_COUNT; ++b)
+	{
+		l = min(l, bins[b - 1].lower);
+		u = max(u, bins[b - 1].upper);
+		n += bins[b - 1].count;
+		if (n == 0 || n == count)
+			continue;
+
+		float cost = HalfArea(l, u) * n + rightCost[b];
+		if (cost < bestCost)
+		{
+			bestCost = cost;
+			bestSplit = b;
+		}
+	}
+
+	// Small nodes stay leaves if no split beats testing all spheres
+	const float leafCost = HalfArea(lower, upper) * count;
+	if (count <= MAX_LEAF_SIZE && (bestSplit < 0 || bestCost >= leafCost))
+		return;
+
+	uint32_t middle;
+	if (bestSplit >= 0)
+	{
+		uint32_t* split = std::partition(&order[begin], &order[begin] + count, [&](uint32_t s) { return binOf(s) < bestSplit; });
+		middle = (uint32_t)(split - order.data());
+	}
+	else
+	{
+		// All centers in one bin, split at the median instead
+		middle = begin + count / 2;
+		std::nth_element(&order[begin], &order[middle], &order[begin] + count,
+			[&](uint32_t a, uint32_t b) { return centers[a][axis] < centers[b][axis]; });
+	}
+
+	// Children are stored next to each other, always behind their parent
+	uint32_t first = (uint32_t)nodes.size();
+	nodes[node].first = first;
+	nodes[node].count = 0;
+	nodes.push_back(Node());
+	nodes.push_back(Node());
+	BuildNode(first, begin, middle, depth + 1);
+	BuildNode(first + 1, middle, end, depth + 1);
+}
+
+uint32_t* BoundingVolumeHierarchy::GetStack(uint32_t* local, std::vector<uint32_t>& heap, int& size) const
+{
+	// Every level keeps at most the sibling of the node taken, plus both children of the deepest
+	size = (int)maxDepth + 2;
+	if (size <= STACK_SIZE)
+		return local;
+
+	heap.resize(size);
+	return heap.data();
+}
+
+float BoundingVolumeHierarchy::RefitBoxes()
+{
+	// Children come after their parents, so walking backwards refits them first
+	float area = 0.0f;
+	for (size_t i = nodes.size(); i-- > 0;)
+	{
+		Node& node = nodes[i];
+		vec3 lower(FLT_MAX), upper(-FLT_MAX);
+		if (node.count > 0)
+		{
+			for (uint32_t k = node.first; k < node.first + node.count; ++k)
+			{
+				uint32_t s = order[k];
+				float radius = glm::max(radii[s], 0.0f);
+				lower = min(lower, centers[s] - vec3(radius));
+				upper = max(upper, centers[s] + vec3(radius));
+			}
+		}
+		else
+		{
+			const Node& left = nodes[node.first];
+			const Node& right = nodes[node.first + 1];
+			lower = min(left.lower, right.lower);
+			upper = max(left.upper, right.upper);
+		}
+		node.lower = lower;
+		node.upper = upper;
+		area += HalfArea(lower, upper);
+	}
+	return area;
+}
+
+bool BoundingVolumeHierarchy::Refit(const vec3* c, const float* r)
+{
+	const size_t count = centers.size();
+	std::copy(c, c + count, centers.begin());
+	std::copy(r, r + count, radii.begin());
+
+	float area = RefitBoxes();
+	if (area <= builtArea * rebuildThreshold)
+		return false;
+
+	// Copies of the own arrays, Build() assigns them again
+	std::vector<vec3> c2(centers);
+	std::vector<float> r2(radii);
+	Build(c2.data(), r2.data(), count);
+	++rebuildCount;
+	return true;
+}
+
+int BoundingVolumeHierarchy::Raycast(const vec3& origin, const vec3& direction, float& distance) const
+{
+	if (nodes.empty())
+		return -1;
+
+	const vec3 d = normalize(direction);
+	const vec3 invDirection = vec3(1.0f) / d;
+
+	int hit = -1;
+	float best = FLT_MAX;
+	uint32_t localStack[STACK_SIZE];
+	std::vector<uint32_t> heapStack;
+	int stackSize;
+	uint32_t* stack = GetStack(localStack, heapStack, stackSize);
+	int top = 0;
+	if (RayBox(origin, invDirection, nodes[0].lower, nodes[0].upper, best) < FLT_MAX)
+		stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const Node& node = nodes[stack[--top]];
+		if (node.count > 0)
+		{
+			for (uint32_t k = node.first; k < node.first + node.count; ++k)
+			{
+				uint32_t s = order[k];
+				float radius = radii[s];
+				if (radius <= 0.0f)
+					continue;
+
+				// Only hits in front of the origin, a sphere around it is ignored. The
+				// discriminant comes from the closest approach, b * b - |oc|^2 loses
+				// all precision for small spheres far away.
+				vec3 oc = origin - centers[s];
+				float b = dot(oc, d);
+				vec3 closest = oc - d * b;
+				float disc = radius * radius - dot(closest, closest);
+				if (disc < 0.0f)
+					continue;
+				float t = -b - sqrtf(disc);
+				if (t > 0.0f && t < best)
+				{
+					best = t;
+					hit = (int)s;
+				}
+			}
+			continue;
+		}
+
+		// Nearer child on top of the stack
+		float tLeft = RayBox(origin, invDirection, nodes[node.first].lower, nodes[node.first].upper, best);
+		float tRight = RayBox(origin, invDirection, nodes[node.first + 1].lower, nodes[node.first + 1].upper, best);
+		uint32_t nearChild = node.first, farChild = node.first + 1;
+		if (tRight < tLeft)
+		{
+			std::swap(tLeft, tRight);
+			std::swap(nearChild, farChild);
+		}
+		assert(top + 2 <= stackSize);
+		if (tRight < FLT_MAX)
+			stack[top++] = farChild;
+		if (tLeft < FLT_MAX)
+			stack[top++] = nearChild;
+	}
+
+	distance = best;
+	return hit;
+}
+
+int BoundingVolumeHierarchy::Nearest(const vec3& point, float maxDistance, float& distance) const
+{
+	if (nodes.empty())
+		return -1;
+
+	int found = -1;
+	float best = maxDistance;
+	uint32_t localStack[STACK_SIZE];
+	std::vector<uint32_t> heapStack;
+	int stackSize;
+	uint32_t* stack = GetStack(localStack, heapStack, stackSize);
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const Node& node = nodes[stack[--top]];
+		if (PointBoxDistance(point, node.lower, node.upper) > best)
+			continue;
+
+		if (node.count > 0)
+		{
+			for (uint32_t k = node.first; k < node.first + node.count; ++k)
+			{
+				uint32_t s = order[k];
+				if (radii[s] <= 0.0f)
+					continue;
+
+				float d = glm::max(length(point - centers[s]) - radii[s], 0.0f);
+				if (d <= best)
+				{
+					best = d;
+					found = (int)s;
+				}
+			}
+			continue;
+		}
+
+		float dLeft = PointBoxDistance(point, nodes[node.first].lower, nodes[node.first].upper);
+		float dRight = PointBoxDistance(point, nodes[node.first + 1].lower, nodes[node.first + 1].upper);
+		uint32_t nearChild = node.first, farChild = node.first + 1;
+		if (dRight < dLeft)
+			std::swap(nearChild, farChild);
+		assert(top + 2 <= stackSize);
+		stack[top++] = farChild;
+		stack[top++] = nearChild;
+	}
+
+	distance = best;
+	return found;
+}
+
+void BoundingVolumeHierarchy::Range(const vec3& center, float radius, std::vector<int>& out) const
+{
+	if (nodes.empty())
+		return;
+
+	uint32_t localStack[STACK_SIZE];
+	std::vector<uint32_t> heapStack;
+	int stackSize;
+	uint32_t* stack = GetStack(localStack, heapStack, stackSize);
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const Node& node = nodes[stack[--top]];
+		if (PointBoxDistance(center, node.lower, node.upper) > radius)
+			continue;
+
+		if (node.count > 0)
+		{
+			for (uint32_t k = node.first; k < node.first + node.count; ++k)
+			{
+				uint32_t s = order[k];
+				if (radii[s] > 0.0f && length(center - centers[s]) <= radius + radii[s])
+					out.push_back((int)s);
+			}
+		}
+		else
+		{
+			assert(top + 2 <= stackSize);
+			stack[top++] = node.first;
+			stack[top++] = node.first + 1;
+		}
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include <glm\glm.hpp>
+
+/**
+* Bounding volume hierarchy over spheres (bodies, asteroids) for picking,
+* nearest and range queries in O(log n).
+*
+* Build() sorts the spheres into a binary tree of axis aligned boxes with the
+* surface area heuristic. As the spheres move, Refit() only recomputes the
+* boxes bottom up in O(n) and keeps the topology. That gets worse the further
+* the spheres drift from where they were at the build, so Refit() rebuilds
+* the tree once its summed box area grew past the rebuild threshold.
+*/
+class BoundingVolumeHierarchy
+{
+public:
+	BoundingVolumeHierarchy();
+
+	// Builds the tree over <count> spheres. Spheres with a radius <= 0 stay in
+	// the tree but are never found, e.g. hidden ones.
+	void Build(const glm::vec3* centers, const float* radii, size_t count);
+
+	// Moves the spheres of the last Build(), same count and order.
+	// Returns true if the tree had to be rebuilt.
+	bool Refit(const glm::vec3* centers, const float* radii);
+
+	// Rebuild once the summed box area exceeds the one after the build by this factor (1.5)
+	void SetRebuildThreshold(float factor);
+
+	// Index of the first sphere hit by the ray, -1 if none. <distance> is the distance to the hit.
+	int Raycast(const glm::vec3& origin, const glm::vec3& direction, float& distance) const;
+
+	// Index of the sphere whose surface is closest to <point>, -1 if none is within <maxDistance>
+	int Nearest(const glm::vec3& point, float maxDistance, float& distance) const;
+
+	// Appends the indices of all spheres intersecting the sphere (<center>, <radius>) to <out>
+	void Range(const glm::vec3& center, float radius, std::vector<int>& out) const;
+
+	size_t GetCount() const;
+	size_t GetNodeCount() const;
+	size_t GetRebuildCount() const;
+
+private:
+	struct Node
+	{
+		glm::vec3 lower;
+		uint32_t first;			// first child (children are stored next to each other) or first sphere
+		glm::vec3 upper;
+		uint32_t count;			// spheres in a leaf, 0 for an inner node
+	};
+
+	void BuildNode(uint32_t node, uint32_t begin, uint32_t end, uint32_t depth);
+	float RefitBoxes();
+
+	// The traversal stack, <local> if the tree is shallow enough, <heap> otherwise.
+	// <size> is the most entries a traversal can push.
+	uint32_t* GetStack(uint32_t* local, std::vector<uint32_t>& heap, int& size) const;
+
+	float rebuildThreshold;
+	float builtArea;			// summed box area after the last build
+	size_t rebuildCount;
+	uint32_t maxDepth;			// of a leaf, the root is 0
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> order;	// sphere indices, every leaf covers a range of it
+
+	// Spheres in original order
+	std::vector<glm::vec3> centers;
+	std::vector<float> radii;
+
+	// Build scratch: boxes of the spheres
+	std::vector<glm::vec3> boxLower;
+	std::vector<glm::vec3> boxUpper;
+};
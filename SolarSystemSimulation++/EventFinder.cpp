@@ -0,0 +1,255 @@
+#include "EventFinder.h"
+#include "PlanetMovementSystem.h"
+#include "jge/ThreadPool.h"
+#include "jge/Util.h"
+
+#include <algorithm>
+#include <math.h>
+
+using namespace glm;
+
+static const size_t CHUNK_SAMPLES = 4096;
+static const double TIME_TOLERANCE = 1e-6;		// days, about 0.1 seconds
+static const int MAX_CONTACT_STEPS = 1024;
+
+static double Separation(const dvec3& a, const dvec3& b)
+{
+	// Better conditioned than acos() for small angles
+	return atan2(length(cross(a, b)), dot(a, b));
+}
+
+static double ApparentRadius(double radius, double distance)
+{
+	return radius < distance ? asin(radius / distance) : 1.5707963267948966;
+}
+
+
+EventFinder::EventFinder(const OrbitalElements& elements)
+	: elements(elements)
+	, scanStep(0.0)
+{
+}
+
+void EventFinder::SetScanStep(double days)
+{
+	scanStep = days;
+}
+
+void EventFinder::FindConjunctions(int observer, int a, int b, double maxSeparation, double begin, double end, std::vector<AstronomicalEvent>& events) const
+{
+	Search search = { false, observer, a, b, maxSeparation };
+	Scan(search, begin, end, events);
+}
+
+void EventFinder::FindEclipses(int observer, int target, int occluder, double begin, double end, std::vector<AstronomicalEvent>& events) const
+{
+	Search search = { true, observer, target, occluder, 0.0 };
+	Scan(search, begin, end, events);
+}
+
+double EventFinder::Evaluate(const Search& search, const dvec3& observer, const dvec3& target, const dvec3& other) const
+{
+	const dvec3 toTarget = target - observer;
+	const dvec3 toOther = other - observer;
+	const double separation = Separation(toTarget, toOther);
+	if (!search.eclipse)
+		return separation - search.maxSeparation;
+
+	return separation
+		- ApparentRadius(elements.size[search.target], length(toTarget))
+		- ApparentRadius(elements.size[search.other], length(toOther));
+}
+
+double EventFinder::Evaluate(const Search& search, double time) const
+{
+	return Evaluate(search,
+		PlanetMovementSystem::QueryPosition(time, elements, search.observer),
+		PlanetMovementSystem::QueryPosition(time, elements, search.target),
+		PlanetMovementSystem::QueryPosition(time, elements, search.other));
+}
+
+void EventFinder::Scan(const Search& search, double begin, double end, std::vector<AstronomicalEvent>& events) const
+{
+	if (!(end > begin))
+		return;
+
+	const int bodies[3] = { search.observer, search.target, search.other };
+	double step = scanStep;
+	if (step <= 0.0)
+	{
+		// The bodies and their parents orbits set the pace, bodies at the origin (the sun) don't move
+		double shortest = end - begin;
+		for (int body : bodies)
+		{
+			for (int i = body; i >= 0; i = elements.parents[i])
+			{
+				if (elements.semiMajorAxis[i] > 0.0 && elements.invRoundTripTime[i] > 0.0)
+					shortest = glm::min(shortest, 1.0 / elements.invRoundTripTime[i]);
+			}
+		}
+		step = shortest / 32.0;
+	}
+
+	// The bulk query writes the selected bodies in index order
+	std::vector<unsigned char> mask(elements.Count(), 0);
+	for (int body : bodies)
+		mask[body] = 1;
+	int slots[3];
+	for (int s = 0; s < 3; ++s)
+		slots[s] = (int)std::count(mask.begin(), mask.begin() + bodies[s], 1);
+	const size_t selectedCount = std::count(mask.begin(), mask.end(), 1);
+
+	const size_t sampleCount = (size_t)ceil((end - begin) / step) + 1;
+	const size_t chunkCount = (sampleCount + CHUNK_SAMPLES - 1) / CHUNK_SAMPLES;
+	std::vector<std::vector<AstronomicalEvent>> found(chunkCount);
+
+	// A ParallelFor() holds the pool until it returns, so only a few chunks are
+	// handed out per call to let the simulation thread in between.
+	jge::ThreadPool& pool = jge::ThreadPool::Shared();
+	const size_t batch = 2 * (pool.GetThreadCount() + 1);
+	for (size_t first = 0; first < chunkCount; first += batch)
+	{
+		const size_t last = glm::min(first + batch, chunkCount);
+		pool.ParallelFor(last - first, 1, [&](size_t chunkBegin, size_t chunkEnd)
+		{
+			std::vector<double> times, x, y, z, f;
+			for (size_t chunk = first + chunkBegin; chunk < first + chunkEnd; ++chunk)
+			{
+				// The samples of the chunk and a neighbour on both sides
+				const size_t k0 = chunk * CHUNK_SAMPLES;
+				const size_t k1 = glm::min(k0 + CHUNK_SAMPLES, sampleCount);
+				const size_t lo = k0 > 0 ? k0 - 1 : 0;
+				const size_t hi = glm::min(k1 + 1, sampleCount);
+				const size_t n = hi - lo;
+
+				times.resize(n);
+				for (size_t i = 0; i < n; ++i)
+					times[i] = glm::min(begin + (lo + i) * step, end);
+
+				x.resize(n * selectedCount);
+				y.resize(n * selectedCount);
+				z.resize(n * selectedCount);
+				PlanetMovementSystem::QueryPositions(times.data(), n, elements, mask.data(), x.data(), y.data(), z.data());
+
+				f.resize(n);
+				for (size_t i = 0; i < n; ++i)
+				{
+					dvec3 p[3];
+					for (int s = 0; s < 3; ++s)
+					{
+						const size_t k = slots[s] * n + i;
+						p[s] = dvec3(x[k], y[k], z[k]);
+					}
+					f[i] = Evaluate(search, p[0], p[1], p[2]);
+				}
+
+				// Local minima that might dip below zero between the samples, the
+				// dip is about as deep as the neighbours are higher
+				for (size_t k = glm::max(k0, (size_t)1); k < k1 && k + 1 < sampleCount; ++k)
+				{
+					const size_t i = k - lo;
+					if (f[i] > f[i - 1] || f[i] >= f[i + 1])
+						continue;
+
+					const double margin = glm::max(f[i - 1] - f[i], f[i + 1] - f[i]);
+					AstronomicalEvent event;
+					if (f[i] - margin < 0.0 && Refine(search, times[i - 1], times[i + 1], step, event))
+						found[chunk].push_back(event);
+				}
+			}
+		});
+	}
+
+	// The chunks are in time order, so the new events are sorted already
+	const size_t previousCount = events.size();
+	for (const std::vector<AstronomicalEvent>& chunkEvents : found)
+		events.insert(events.end(), chunkEvents.begin(), chunkEvents.end());
+	std::inplace_merge(events.begin(), events.begin() + previousCount, events.end(),
+		[](const AstronomicalEvent& a, const AstronomicalEvent& b) { return a.time < b.time; });
+}
+
+bool EventFinder::Refine(const Search& search, double lower, double upper, double step, AstronomicalEvent& event) const
+{
+	// Golden section search for the minimum between the samples
+	const double ratio = 0.6180339887498949;
+	double a = lower, b = upper;
+	double c = b - ratio * (b - a);
+	double d = a + ratio * (b - a);
+	double fc = Evaluate(search, c);
+	double fd = Evaluate(search, d);
+	while (b - a > TIME_TOLERANCE)
+	{
+		if (fc < fd)
+		{
+			b = d;
+			d = c;
+			fd = fc;
+			c = b - ratio * (b - a);
+			fc = Evaluate(search, c);
+		}
+		else
+		{
+			a = c;
+			c = d;
+			fc = fd;
+			d = a + ratio * (b - a);
+			fd = Evaluate(search, d);
+		}
+	}
+
+	const double time = 0.5 * (a + b);
+	const dvec3 observer = PlanetMovementSystem::QueryPosition(time, elements, search.observer);
+	const dvec3 target = PlanetMovementSystem::QueryPosition(time, elements, search.target);
+	const dvec3 other = PlanetMovementSystem::QueryPosition(time, elements, search.other);
+	if (Evaluate(search, observer, target, other) >= 0.0)
+		return false;
+
+	event.type = EVENT_CONJUNCTION;
+	event.time = event.begin = event.end = time;
+	event.separation = Separation(target - observer, other - observer);
+	event.observer = search.observer;
+	event.target = search.target;
+	event.other = search.other;
+	if (!search.eclipse)
+		return true;
+
+	// Only an occluder in front of the target eclipses it
+	const double targetDistance = length(target - observer);
+	if (length(other - observer) >= targetDistance)
+		return false;
+
+	// Step out of the eclipse, then bisect the contact
+	auto contact = [&](double direction)
+	{
+		double inside = time;
+		double outside = time + direction;
+		for (int i = 0; i < MAX_CONTACT_STEPS && Evaluate(search, outside) < 0.0; ++i)
+		{
+			inside = outside;
+			outside += direction;
+		}
+		while (fabs(outside - inside) > TIME_TOLERANCE)
+		{
+			const double middle = 0.5 * (inside + outside);
+			(Evaluate(search, middle) < 0.0 ? inside : outside) = middle;
+		}
+		return 0.5 * (inside + outside);
+	};
+	event.begin = contact(-step);
+	event.end = contact(step);
+
+	// Central if the line of sight to the targets center passes the occluder
+	vec3 rayPos(observer);
+	vec3 rayDir(normalize(target - observer));
+	vec3 spherePos(other);
+	float d1, d2;
+	const bool central = jge::Util::RaySphereIntersection(rayPos, rayDir, spherePos, elements.size[search.other], d1, d2) > 0
+		&& d1 > 0.0f && d1 < targetDistance;
+
+	if (!central)
+		event.type = EVENT_ECLIPSE_PARTIAL;
+	else if (ApparentRadius(elements.size[search.other], length(other - observer)) >= ApparentRadius(elements.size[search.target], targetDistance))
+		event.type = EVENT_ECLIPSE_TOTAL;
+	else event.type = EVENT_ECLIPSE_ANNULAR;
+	return true;
+}
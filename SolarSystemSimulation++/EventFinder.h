@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "OrbitalElements.h"
+
+enum EventType
+{
+	EVENT_CONJUNCTION,			// two bodies closest together in the observers sky
+	EVENT_ECLIPSE_PARTIAL,		// the occluder covers a part of the target
+	EVENT_ECLIPSE_ANNULAR,		// the occluder is centered on the target but too small to cover it
+	EVENT_ECLIPSE_TOTAL			// the occluder covers all of the target
+};
+
+struct AstronomicalEvent
+{
+	EventType type;
+	double time;				// greatest eclipse or closest conjunction in days since J2000
+	double begin;				// first and last contact of an eclipse, <time> for conjunctions
+	double end;
+	double separation;			// angle between the bodies centers at <time> in radians
+	int observer;
+	int target;					// the eclipsed body or the first body of a conjunction
+	int other;					// the occluder or the second body of a conjunction
+};
+
+/**
+* Searches the orbits of OrbitalElements for conjunctions and eclipses as seen
+* from the center of an observing body. Bodies are spheres with their size as
+* radius, like the renderer draws them.
+*
+* The time range is sampled with the bulk position query, in chunks spread
+* over the shared thread pool. Local minima of the angular separation that
+* may fall below the threshold are refined by a golden section search, the
+* contacts of an eclipse by bisection. The sampling step has to be small
+* against the fastest relative motion, by default it is a 32nd of the
+* shortest orbit involved.
+*/
+class EventFinder
+{
+public:
+	explicit EventFinder(const OrbitalElements& elements);
+
+	// Days between two samples, 0 picks the step from the orbits
+	void SetScanStep(double days);
+
+	// Adds the times <a> and <b> come closer than <maxSeparation> (radians)
+	// as seen from <observer> within [begin, end] to <events>.
+	void FindConjunctions(int observer, int a, int b, double maxSeparation, double begin, double end, std::vector<AstronomicalEvent>& events) const;
+
+	// Adds the times <occluder> covers <target> as seen from <observer> within [begin, end]
+	// to <events>. E.g. the moon covering the sun seen from the earth is a solar eclipse,
+	// the earth covering the sun seen from the moon a lunar eclipse.
+	void FindEclipses(int observer, int target, int occluder, double begin, double end, std::vector<AstronomicalEvent>& events) const;
+
+	// Both searches keep <events> sorted by time, so several can share one list.
+
+private:
+	struct Search
+	{
+		bool eclipse;
+		int observer;
+		int target;
+		int other;
+		double maxSeparation;
+	};
+
+	void Scan(const Search& search, double begin, double end, std::vector<AstronomicalEvent>& events) const;
+	bool Refine(const Search& search, double lower, double upper, double step, AstronomicalEvent& event) const;
+
+	// Negative while the event lasts: the separation minus the threshold, or
+	// minus the sum of the apparent radii for eclipses
+	double Evaluate(const Search& search, const glm::dvec3& observer, const glm::dvec3& target, const glm::dvec3& other) const;
+	double Evaluate(const Search& search, double time) const;
+
+	const OrbitalElements& elements;
+	double scanStep;
+};
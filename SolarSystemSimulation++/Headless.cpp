@@ -0,0 +1,257 @@
+#include "Headless.h"
+#include "Simulation.h"
+#include "PlanetMovementSystem.h"
+#include "jge/ThreadPool.h"
+#include "jge/Measurement.h"
+
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace jge;
+using namespace glm;
+
+static int BenchmarkQuery(int count, double days);
+static int BenchmarkEvents(double years);
+
+
+/**
+ * Simulation without window and OpenGL context. Steps Update() as fast as
+ * possible and optionally writes the body positions to a CSV file.
+ * Options:
+ *   --days <n>        Simulated time span in days (3650)
+ *   --step <n>        Days per Update() (0.1)
+ *   --dump <file>     Output file (states.csv)
+ *   --dump-every <n>  Write the states every n steps, 0 = never (0)
+ *   --asteroids <n>   Number of belt asteroids (0)
+ *   --nbody           Planets follow the gravity simulation
+ *   --belt <n>        Light bodies in the gravity simulation (0)
+ *   --ephemeris <f>   Positions from a JPL DE ephemeris file
+ *   --record <f>      Records the body positions of all steps
+ *   --play <f>        Positions from a recording instead of the simulation
+ *   --catalog <f>     Body catalog to simulate (catalog/bodies.bin)
+ *   --query <n>       Instead of stepping, compare the bulk position query at
+ *                     n times within --days against the per body calls
+ *   --events <n>      Instead of stepping, search n years for eclipses and conjunctions
+ */
+int RunHeadless(int argc, char** argv)
+{
+	double days = 3650.0;
+	double step = 0.1;
+	const char* dumpFile = "states.csv";
+	int dumpEvery = 0;
+	int asteroidCount = 0;
+	const char* ephemerisFile = nullptr;
+	const char* recordFile = nullptr;
+	const char* playFile = nullptr;
+	const char* catalogFile = CATALOG_FILE;
+	int queryCount = 0;
+	double eventYears = 0.0;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		bool hasValue = i + 1 < argc;
+		if (strcmp(argv[i], "--headless") == 0)
+			continue;
+		else if (strcmp(argv[i], "--nbody") == 0)
+			nbodyEnabled = true;
+		else if (strcmp(argv[i], "--days") == 0 && hasValue)
+			days = atof(argv[++i]);
+		else if (strcmp(argv[i], "--step") == 0 && hasValue)
+			step = atof(argv[++i]);
+		else if (strcmp(argv[i], "--dump") == 0 && hasValue)
+			dumpFile = argv[++i];
+		else if (strcmp(argv[i], "--dump-every") == 0 && hasValue)
+			dumpEvery = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--asteroids") == 0 && hasValue)
+			asteroidCount = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--belt") == 0 && hasValue)
+			nbodyBeltBodies = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--ephemeris") == 0 && hasValue)
+			ephemerisFile = argv[++i];
+		else if (strcmp(argv[i], "--record") == 0 && hasValue)
+			recordFile = argv[++i];
+		else if (strcmp(argv[i], "--play") == 0 && hasValue)
+			playFile = argv[++i];
+		else if (strcmp(argv[i], "--catalog") == 0 && hasValue)
+			catalogFile = argv[++i];
+		else if (strcmp(argv[i], "--query") == 0 && hasValue)
+			queryCount = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--events") == 0 && hasValue)
+			eventYears = atof(argv[++i]);
+		else
+		{
+			fprintf(stderr, "Unknown or incomplete option '%s'\r\n", argv[i]);
+			return -1;
+		}
+	}
+
+	if (step <= 0.0 || days < 0.0)
+	{
+		fprintf(stderr, "--step has to be positive and --days not negative\r\n");
+		return -1;
+	}
+
+	FILE* dump = nullptr;
+	if (dumpEvery > 0)
+	{
+		dump = fopen(dumpFile, "w");
+		if (!dump)
+		{
+			fprintf(stderr, "Can't open %s for writing\r\n", dumpFile);
+			return -1;
+		}
+		fprintf(dump, "time,body,x,y,z\n");
+	}
+
+	try
+	{
+		InitSimulation(catalogFile, asteroidCount);
+	}
+	catch (const std::runtime_error& ex)
+	{
+		fprintf(stderr, "%s\r\n", ex.what());
+		return -1;
+	}
+	if (ephemerisFile)
+	{
+		InitEphemeris(ephemerisFile);
+		if (!ephemerisEnabled)
+			return -1;
+	}
+	if (playFile && !InitPlayback(playFile))
+		return -1;
+	if (recordFile && !recorder.Open(recordFile, bEnd))
+		return -1;
+	if (nbodyEnabled)
+		ResetNBody(0.0);
+	if (queryCount > 0)
+		return BenchmarkQuery(queryCount, days);
+	if (eventYears > 0.0)
+		return BenchmarkEvents(eventYears);
+
+	const long long steps = (long long)(days / step);
+	const size_t bodiesPerStep = orbitalElements.Count() + asteroidElements.Count() + (nbodyEnabled ? nbodyBeltBodies : 0);
+	printf("Headless: %lld steps of %.3f days, %d bodies\r\n", steps, step, (int)bodiesPerStep);
+
+	// Only the steps are timed, writing the states is not part of the simulation
+	SimulationState state;
+	double stepTime = 0.0;
+	for (long long i = 1; i <= steps; ++i)
+	{
+		Stopwatch sw;
+		sw.Start();
+		Update(i * step, state);
+		sw.Stop();
+		stepTime += sw.GetElapsedTime();
+
+		if (dump && i % dumpEvery == 0)
+		{
+			for (int b = bSun; b < bEnd; ++b)
+			{
+				vec3 pos = transforms.GetWorldPosition(b);
+				fprintf(dump, "%.4f,%s,%.6f,%.6f,%.6f\n", i * step, catalog.GetName(b), pos.x, pos.y, pos.z);
+			}
+		}
+	}
+
+	if (dump)
+		fclose(dump);
+	if (recorder.IsOpen())
+	{
+		recorder.Close();
+		printf("Recorded %d frames, %.1f bytes per frame\r\n", (int)recorder.GetFrameCount(),
+			recorder.GetFrameCount() > 0 ? (double)recorder.GetSize() / recorder.GetFrameCount() : 0.0);
+	}
+
+	double stepsPerSecond = stepTime > 0.0 ? steps / stepTime : 0.0;
+	printf("Simulated %.1f days in %.3f s\r\n", steps * step, stepTime);
+	printf("%-20s %.1f\r\n", "steps/s:", stepsPerSecond);
+	printf("%-20s %.3e\r\n", "bodies x steps/s:", stepsPerSecond * bodiesPerStep);
+	return 0;
+}
+
+
+/**
+ * Times PlanetMovementSystem::QueryPositions() for all bodies at <count> times
+ * within [0, days] against calling OrbitAroundSun() / OrbitAroundParent() per body
+ * and time, and reports the largest difference between both. The speedup depends
+ * on the threads of the pool, so they are reported too.
+ */
+static int BenchmarkQuery(int count, double days)
+{
+	const size_t bodyCount = orbitalElements.Count();
+	std::vector<double> times(count);
+	for (int i = 0; i < count; ++i)
+		times[i] = days * i / count;
+
+	std::vector<double> x(count * bodyCount), y(count * bodyCount), z(count * bodyCount);
+	Stopwatch sw;
+	sw.Start();
+	PlanetMovementSystem::QueryPositions(times.data(), count, orbitalElements, nullptr, x.data(), y.data(), z.data());
+	sw.Stop();
+	double bulkTime = sw.GetElapsedTime();
+
+	std::vector<vec3> positions(count * bodyCount);
+	sw.Start();
+	for (int t = 0; t < count; ++t)
+	{
+		vec3* p = &positions[t * bodyCount];
+		for (int i = bSun; i < bEnd; ++i)
+		{
+			const int parent = catalog.GetParent(i);
+			mat4 m = parent <= bSun
+				? PlanetMovementSystem::OrbitAroundSun(times[t], catalog.GetInfo(i))
+				: PlanetMovementSystem::OrbitAroundParent(times[t], catalog.GetInfo(i), p[parent]);
+			p[i] = vec3(m[3]);
+		}
+	}
+	sw.Stop();
+	double perCallTime = sw.GetElapsedTime();
+
+	double maxError = 0.0;
+	for (int t = 0; t < count; ++t)
+	{
+		for (int i = bSun; i < bEnd; ++i)
+		{
+			size_t k = i * count + t;
+			vec3 bulk((float)x[k], (float)y[k], (float)z[k]);
+			maxError = glm::max(maxError, (double)glm::length(positions[t * bodyCount + i] - bulk));
+		}
+	}
+
+	printf("%d times x %d bodies\r\n", count, (int)bodyCount);
+	printf("%-20s %d (%u cores)\r\n", "threads:", (int)ThreadPool::Shared().GetThreadCount(), std::thread::hardware_concurrency());
+	printf("%-20s %.3f s\r\n", "bulk query:", bulkTime);
+	printf("%-20s %.3f s (x%.1f)\r\n", "per call:", perCallTime, bulkTime > 0.0 ? perCallTime / bulkTime : 0.0);
+	printf("%-20s %.2e\r\n", "max difference:", maxError);
+	return 0;
+}
+
+
+/**
+ * Runs all event searches over <years> from J2000 and prints the first events of each.
+ */
+static int BenchmarkEvents(double years)
+{
+	const char* search = eventSearchList;
+	for (int i = 0; *search; ++i, search += strlen(search) + 1)
+	{
+		Stopwatch sw;
+		sw.Start();
+		std::vector<AstronomicalEvent> found = FindEvents(i, 0.0, years * 365.25);
+		sw.Stop();
+
+		printf("%s: %d in %.1f years (%.3f s)\r\n", search, (int)found.size(), years, sw.GetElapsedTime());
+		for (size_t k = 0; k < found.size() && k < 5; ++k)
+		{
+			char line[128];
+			FormatEvent(found[k], line, sizeof(line));
+			printf("  %s\r\n", line);
+		}
+	}
+	return 0;
+}
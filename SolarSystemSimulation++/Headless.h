@@ -0,0 +1,8 @@
+#pragma once
+
+/**
+* Simulation without window and OpenGL context, see RunHeadless() for the
+* options. The windowed executable runs it with --headless, the headless build
+* (CMakeLists.txt) always.
+*/
+int RunHeadless(int argc, char** argv);
@@ -0,0 +1,9 @@
+#include "Headless.h"
+
+/**
+ * Entry point of the headless build, it needs neither OpenGL nor GLFW.
+ */
+int main(int argc, char** argv)
+{
+	return RunHeadless(argc, argv);
+}
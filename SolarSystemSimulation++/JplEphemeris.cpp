@@ -0,0 +1,263 @@
+#include "JplEphemeris.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+using namespace glm;
+
+const double JplEphemeris::J2000 = 2451545.0;
+
+// Byte offsets inside the first header record
+static const size_t HEADER_DATES = 2652;			// start, end, record span
+static const size_t HEADER_CONSTANT_COUNT = 2676;
+static const size_t HEADER_AU = 2680;
+static const size_t HEADER_EMRAT = 2688;
+static const size_t HEADER_POINTERS = 2696;			// 12 x (offset, coefficients, sub intervals)
+static const size_t HEADER_VERSION = 2840;
+static const size_t HEADER_LIBRATION = 2844;
+static const size_t HEADER_EXTRA_NAMES = 2856;		// names of constants beyond 400
+static const size_t CONSTANT_NAME_LENGTH = 6;
+
+// Sum of c[k] * T_k(x) with Clenshaw's recurrence
+static double Chebyshev(const double* c, int n, double x)
+{
+	double b1 = 0.0, b2 = 0.0;
+	const double x2 = 2.0 * x;
+	for (int k = n - 1; k >= 1; --k)
+	{
+		double b0 = x2 * b1 - b2 + c[k];
+		b2 = b1;
+		b1 = b0;
+	}
+	return x * b1 - b2 + c[0];
+}
+
+JplEphemeris::JplEphemeris()
+	: version(0)
+	, startDate(0.0)
+	, endDate(0.0)
+	, recordSpan(0.0)
+	, recordSize(0)
+	, recordCount(0)
+	, au(0.0)
+	, earthMoonRatio(0.0)
+{
+	memset(layout, 0, sizeof(layout));
+	memset(cache, 0, sizeof(cache));
+}
+
+bool JplEphemeris::Open(const char* path)
+{
+	Close();
+
+	if (!file.Open(path))
+	{
+		printf("Can't open ephemeris %s\r\n", path);
+		return false;
+	}
+
+	const unsigned char* data = file.GetData();
+	if (file.GetSize() < HEADER_EXTRA_NAMES)
+	{
+		printf("%s is too small to be a JPL ephemeris\r\n", path);
+		Close();
+		return false;
+	}
+
+	// The header is a fortran record, fields may be unaligned
+	double dates[3];
+	int constantCount;
+	int pointers[12][3];
+	int libration[3];
+	memcpy(dates, data + HEADER_DATES, sizeof(dates));
+	memcpy(&constantCount, data + HEADER_CONSTANT_COUNT, sizeof(constantCount));
+	memcpy(&au, data + HEADER_AU, sizeof(au));
+	memcpy(&earthMoonRatio, data + HEADER_EMRAT, sizeof(earthMoonRatio));
+	memcpy(pointers, data + HEADER_POINTERS, sizeof(pointers));
+	memcpy(&version, data + HEADER_VERSION, sizeof(version));
+	memcpy(libration, data + HEADER_LIBRATION, sizeof(libration));
+
+	// Byte swapped files end up here too
+	if (!(dates[0] < dates[1]) || !(dates[2] > 0.0) || version <= 0 || version > 9999 || constantCount < 0 || constantCount > 10000)
+	{
+		printf("%s is no JPL ephemeris or has the wrong byte order\r\n", path);
+		Close();
+		return false;
+	}
+
+	// Records have no size field, it is the end of the last coefficient block
+	size_t coefficients = 2;
+	auto extend = [&coefficients](const int* pointer, int components)
+	{
+		if (pointer[0] > 0 && pointer[1] > 0 && pointer[2] > 0)
+		{
+			size_t end = (size_t)(pointer[0] - 1) + (size_t)components * pointer[1] * pointer[2];
+			if (end > coefficients)
+				coefficients = end;
+		}
+	};
+	for (int i = 0; i < BODY_COUNT; ++i)
+		extend(pointers[i], 3);
+	extend(pointers[11], 2);			// nutations
+	extend(libration, 3);
+
+	// Newer files store the lunar mantle and TT-TDB pointers behind the extra names
+	if (constantCount > 400)
+	{
+		size_t extra = HEADER_EXTRA_NAMES + (constantCount - 400) * CONSTANT_NAME_LENGTH;
+		int morePointers[2][3];
+		if (file.GetSize() >= extra + sizeof(morePointers))
+		{
+			memcpy(morePointers, data + extra, sizeof(morePointers));
+			extend(morePointers[0], 3);
+			extend(morePointers[1], 1);
+		}
+	}
+
+	startDate = dates[0];
+	endDate = dates[1];
+	recordSpan = dates[2];
+	recordSize = coefficients;
+	recordCount = (size_t)((endDate - startDate) / recordSpan + 0.5);
+
+	// Two header records, then the data records
+	const size_t recordBytes = recordSize * sizeof(double);
+	if (recordCount == 0 || file.GetSize() < (recordCount + 2) * recordBytes)
+	{
+		printf("%s is truncated\r\n", path);
+		Close();
+		return false;
+	}
+
+	const double* first = (const double*)(data + 2 * recordBytes);
+	if (fabs(first[0] - startDate) > 0.5 || fabs(first[1] - startDate - recordSpan) > 0.5)
+	{
+		printf("%s has an unknown record layout\r\n", path);
+		Close();
+		return false;
+	}
+
+	for (int i = 0; i < BODY_COUNT; ++i)
+	{
+		layout[i].offset = pointers[i][0] - 1;
+		layout[i].coefficients = pointers[i][1];
+		layout[i].subIntervals = pointers[i][2];
+	}
+
+	printf("Loaded DE%d, JD %.1f - %.1f\r\n", version, startDate, endDate);
+	return true;
+}
+
+void JplEphemeris::Close()
+{
+	file.Close();
+	memset(cache, 0, sizeof(cache));
+	recordCount = 0;
+}
+
+bool JplEphemeris::IsOpen() const
+{
+	return recordCount > 0;
+}
+
+int JplEphemeris::GetVersion() const
+{
+	return version;
+}
+
+double JplEphemeris::GetStartDate() const
+{
+	return startDate;
+}
+
+double JplEphemeris::GetEndDate() const
+{
+	return endDate;
+}
+
+double JplEphemeris::GetAU() const
+{
+	return au;
+}
+
+const double* JplEphemeris::FindRecord(double julianDate) const
+{
+	size_t index = 0;
+	if (julianDate > startDate)
+		index = (size_t)((julianDate - startDate) / recordSpan);
+	if (index >= recordCount)
+		index = recordCount - 1;
+
+	const double* records = (const double*)file.GetData() + 2 * recordSize;
+	return records + index * recordSize;
+}
+
+dvec3 JplEphemeris::Evaluate(int body, const double* record, double julianDate) const
+{
+	const Layout& l = layout[body];
+	if (l.coefficients == 0)
+		return dvec3(0.0);
+
+	// Locate the sub interval and map the date to [-1, 1]
+	const double span = (record[1] - record[0]) / l.subIntervals;
+	double t = (julianDate - record[0]) / span;
+	int sub = (int)t;
+	if (sub < 0)
+		sub = 0;
+	if (sub >= l.subIntervals)
+		sub = l.subIntervals - 1;
+	const double x = 2.0 * (t - sub) - 1.0;
+
+	const double* c = record + l.offset + sub * 3 * l.coefficients;
+	return dvec3(
+		Chebyshev(c, l.coefficients, x),
+		Chebyshev(c + l.coefficients, l.coefficients, x),
+		Chebyshev(c + 2 * l.coefficients, l.coefficients, x));
+}
+
+dvec3 JplEphemeris::Position(int body, double julianDate)
+{
+	if (!IsOpen())
+		return dvec3(0.0);
+
+	if (julianDate < startDate)
+		julianDate = startDate;
+	if (julianDate > endDate)
+		julianDate = endDate;
+
+	if (body == EARTH)
+		return Position(EARTH_MOON_BARYCENTER, julianDate) - Position(MOON, julianDate) / (1.0 + earthMoonRatio);
+
+	Cache& c = cache[body];
+	if (c.record == nullptr || julianDate < c.start || julianDate > c.end)
+	{
+		c.record = FindRecord(julianDate);
+		c.start = c.record[0];
+		c.end = c.record[1];
+	}
+	return Evaluate(body, c.record, julianDate);
+}
+
+dvec3 JplEphemeris::PositionUncached(int body, double julianDate) const
+{
+	if (!IsOpen())
+		return dvec3(0.0);
+
+	if (julianDate < startDate)
+		julianDate = startDate;
+	if (julianDate > endDate)
+		julianDate = endDate;
+
+	if (body == EARTH)
+		return PositionUncached(EARTH_MOON_BARYCENTER, julianDate) - PositionUncached(MOON, julianDate) / (1.0 + earthMoonRatio);
+
+	return Evaluate(body, FindRecord(julianDate), julianDate);
+}
+
+dvec3 JplEphemeris::HeliocentricPosition(int body, double julianDate)
+{
+	if (body == MOON)
+		return Position(MOON, julianDate);
+	return Position(body, julianDate) - Position(SUN, julianDate);
+}
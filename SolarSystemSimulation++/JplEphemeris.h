@@ -0,0 +1,96 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include "jge/MappedFile.h"
+
+/**
+* Reader for the binary JPL development ephemerides (DE405 - DE440 and
+* later, native byte order). The file is memory mapped, so opening it is
+* instant and a lookup only touches the pages of the record it needs.
+* Positions are evaluated from the Chebyshev coefficients of the record
+* containing the queried date.
+*
+* Units are km and Julian days (TDB). Positions are relative to the solar
+* system barycenter in the ICRF (earth equator of J2000), except for the
+* moon which is relative to the earth.
+*/
+class JplEphemeris
+{
+public:
+	// Order of the bodies in the file
+	enum Body
+	{
+		MERCURY = 0,
+		VENUS,
+		EARTH_MOON_BARYCENTER,
+		MARS,
+		JUPITER,
+		SATURN,
+		URANUS,
+		NEPTUNE,
+		PLUTO,
+		MOON,						// geocentric
+		SUN,
+		BODY_COUNT,
+		EARTH = BODY_COUNT,			// derived from the barycenter and the moon
+	};
+
+	JplEphemeris();
+
+	// Maps the file and checks its header, prints the reason on failure
+	bool Open(const char* path);
+	void Close();
+	bool IsOpen() const;
+
+	// Version (e.g. 440) and covered date range in Julian days
+	int GetVersion() const;
+	double GetStartDate() const;
+	double GetEndDate() const;
+	double GetAU() const;
+
+	// Position of <body> in km at <julianDate>, which is clamped to the covered range.
+	// Uses a per body cache of the last record, so it is not thread safe.
+	glm::dvec3 Position(int body, double julianDate);
+
+	// Same as Position() without the cache, can be called concurrently.
+	glm::dvec3 PositionUncached(int body, double julianDate) const;
+
+	// Position relative to the sun, for the moon relative to the earth
+	glm::dvec3 HeliocentricPosition(int body, double julianDate);
+
+	// Julian day of J2000 (2000-01-01 12:00 TDB)
+	static const double J2000;
+
+private:
+	// Coefficient layout of a body inside a record
+	struct Layout
+	{
+		int offset;				// 0 based, in doubles from the record start
+		int coefficients;		// per component and sub interval
+		int subIntervals;
+	};
+
+	// Last record used for a body
+	struct Cache
+	{
+		const double* record;
+		double start;
+		double end;
+	};
+
+	const double* FindRecord(double julianDate) const;
+	glm::dvec3 Evaluate(int body, const double* record, double julianDate) const;
+
+	jge::MappedFile file;
+	Layout layout[BODY_COUNT];
+	Cache cache[BODY_COUNT];
+
+	int version;
+	double startDate;
+	double endDate;
+	double recordSpan;			// days
+	size_t recordSize;			// doubles
+	size_t recordCount;
+	double au;					// km
+	double earthMoonRatio;
+};
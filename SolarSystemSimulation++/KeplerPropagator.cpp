@@ -0,0 +1,374 @@
+#include "KeplerPropagator.h"
+
+#include <math.h>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#define KEPLER_USE_SSE2
+#endif
+
+using namespace glm;
+
+static const double PI = 3.141592653589793;
+
+
+// Polynomial sine and cosine for |x| <= pi/4 (fdlibm's kernels), accurate to
+// 1 ulp there and still to 1e-14 for |x| <= 1.
+static inline void SinCosKernel(double x, double& s, double& c)
+{
+	double x2 = x * x;
+	s = x + x * x2 * (-1.66666666666666324348e-01 + x2 * (8.33333333332248946124e-03 + x2 * (-1.98412698298579493134e-04
+		+ x2 * (2.75573137070700676789e-06 + x2 * (-2.50507602534068634195e-08 + x2 * 1.58969099521155010221e-10)))));
+	c = 1.0 - 0.5 * x2 + x2 * x2 * (4.16666666666666019037e-02 + x2 * (-1.38888888888741095749e-03 + x2 * (2.48015872894767294178e-05
+		+ x2 * (-2.75573143513906633035e-07 + x2 * (2.08757232129817482790e-09 + x2 * -1.13596475577881948265e-11)))));
+}
+
+
+// Sine and cosine of any angle, reduced to [-pi/4, pi/4] (Cody-Waite) and the quadrant
+static inline void SinCos(double x, double& s, double& c)
+{
+	const double TWO_OVER_PI = 0.63661977236758134308;
+	const double PIO2_HI = 1.57079632673412561417;
+	const double PIO2_LO = 6.07710050650619224932e-11;
+
+	double k = floor(x * TWO_OVER_PI + 0.5);
+	double r = (x - k * PIO2_HI) - k * PIO2_LO;
+	int quadrant = (int)k & 3;
+
+	double sr, cr;
+	SinCosKernel(r, sr, cr);
+
+	// x = k * pi/2 + r
+	double sq = (quadrant & 1) ? cr : sr;
+	double cq = (quadrant & 1) ? sr : cr;
+	s = (quadrant & 2) ? -sq : sq;
+	c = ((quadrant + 1) & 2) ? -cq : cq;
+}
+
+
+// Steps of the time series variant of SolveKeplerSinCos(). E is kept as offset
+// D to M, so f = D - e * sin(E) stays exact for large M.
+
+// Rotates sin(E) and cos(E) by an angle given as its sine and cosine
+static inline void Rotate(double sd, double cd, double& s, double& c)
+{
+	double sn = s * cd + c * sd;
+	c = c * cd - s * sd;
+	s = sn;
+}
+
+
+// Halley step for E = M + D, added to D and returned in d
+static inline void HalleyStep(double e, double s, double c, double& D, double& d)
+{
+	double es = e * s;
+	double f = D - es;
+	double df = 1.0 - e * c;
+	d = -f * df / (df * df - 0.5 * f * es);
+	D += d;
+}
+
+
+// Sine and cosine of the last step, which is below 2e-5 after Iterations() steps.
+// The dropped terms are below 1e-21 there.
+static inline void SinCosLastStep(double x, double& s, double& c)
+{
+	double x2 = x * x;
+	s = x - x * x2 * (1.0 / 6.0);
+	c = 1.0 - 0.5 * x2;
+}
+
+
+#ifdef KEPLER_USE_SSE2
+// SinCosKernel() for two angles
+static inline void SinCosKernel(__m128d x, __m128d& s, __m128d& c)
+{
+	const __m128d x2 = _mm_mul_pd(x, x);
+	__m128d ps = _mm_set1_pd(1.58969099521155010221e-10);
+	ps = _mm_add_pd(_mm_mul_pd(ps, x2), _mm_set1_pd(-2.50507602534068634195e-08));
+	ps = _mm_add_pd(_mm_mul_pd(ps, x2), _mm_set1_pd(2.75573137070700676789e-06));
+	ps = _mm_add_pd(_mm_mul_pd(ps, x2), _mm_set1_pd(-1.98412698298579493134e-04));
+	ps = _mm_add_pd(_mm_mul_pd(ps, x2), _mm_set1_pd(8.33333333332248946124e-03));
+	ps = _mm_add_pd(_mm_mul_pd(ps, x2), _mm_set1_pd(-1.66666666666666324348e-01));
+	__m128d pc = _mm_set1_pd(-1.13596475577881948265e-11);
+	pc = _mm_add_pd(_mm_mul_pd(pc, x2), _mm_set1_pd(2.08757232129817482790e-09));
+	pc = _mm_add_pd(_mm_mul_pd(pc, x2), _mm_set1_pd(-2.75573143513906633035e-07));
+	pc = _mm_add_pd(_mm_mul_pd(pc, x2), _mm_set1_pd(2.48015872894767294178e-05));
+	pc = _mm_add_pd(_mm_mul_pd(pc, x2), _mm_set1_pd(-1.38888888888741095749e-03));
+	pc = _mm_add_pd(_mm_mul_pd(pc, x2), _mm_set1_pd(4.16666666666666019037e-02));
+	s = _mm_add_pd(x, _mm_mul_pd(_mm_mul_pd(x, x2), ps));
+	c = _mm_add_pd(_mm_sub_pd(_mm_set1_pd(1.0), _mm_mul_pd(_mm_set1_pd(0.5), x2)), _mm_mul_pd(_mm_mul_pd(x2, x2), pc));
+}
+
+
+// SinCos() for two angles. Adding 1.5 * 2^52 rounds x * 2/pi to the integer k,
+// which then sits in the low bits of the mantissa and gives the quadrant.
+static inline void SinCos(__m128d x, __m128d& s, __m128d& c)
+{
+	const __m128d ROUND = _mm_set1_pd(6755399441055744.0);
+	const __m128d SIGN = _mm_set1_pd(-0.0);
+
+	__m128d kr = _mm_add_pd(_mm_mul_pd(x, _mm_set1_pd(0.63661977236758134308)), ROUND);
+	__m128d k = _mm_sub_pd(kr, ROUND);
+	__m128d r = _mm_sub_pd(_mm_sub_pd(x, _mm_mul_pd(k, _mm_set1_pd(1.57079632673412561417))), _mm_mul_pd(k, _mm_set1_pd(6.07710050650619224932e-11)));
+
+	__m128d sr, cr;
+	SinCosKernel(r, sr, cr);
+
+	// Quadrant bit 0 swaps sine and cosine, bit 1 negates the sine and bit 1 of quadrant + 1 the cosine
+	__m128i quadrant = _mm_castpd_si128(kr);
+	__m128d swap = _mm_castsi128_pd(_mm_shuffle_epi32(_mm_srai_epi32(_mm_slli_epi64(quadrant, 63), 31), _MM_SHUFFLE(3, 3, 1, 1)));
+	__m128d sinSign = _mm_and_pd(_mm_castsi128_pd(_mm_slli_epi64(quadrant, 62)), SIGN);
+	__m128d cosSign = _mm_and_pd(_mm_castsi128_pd(_mm_slli_epi64(_mm_add_epi64(quadrant, _mm_set_epi32(0, 1, 0, 1)), 62)), SIGN);
+
+	s = _mm_xor_pd(_mm_or_pd(_mm_and_pd(swap, cr), _mm_andnot_pd(swap, sr)), sinSign);
+	c = _mm_xor_pd(_mm_or_pd(_mm_and_pd(swap, sr), _mm_andnot_pd(swap, cr)), cosSign);
+}
+
+
+// Rotate(), HalleyStep() and SinCosLastStep() for two mean anomalies
+static inline void Rotate(__m128d sd, __m128d cd, __m128d& s, __m128d& c)
+{
+	__m128d sn = _mm_add_pd(_mm_mul_pd(s, cd), _mm_mul_pd(c, sd));
+	c = _mm_sub_pd(_mm_mul_pd(c, cd), _mm_mul_pd(s, sd));
+	s = sn;
+}
+
+
+static inline void HalleyStep(__m128d e, __m128d s, __m128d c, __m128d& D, __m128d& d)
+{
+	__m128d es = _mm_mul_pd(e, s);
+	__m128d f = _mm_sub_pd(D, es);
+	__m128d df = _mm_sub_pd(_mm_set1_pd(1.0), _mm_mul_pd(e, c));
+	d = _mm_div_pd(_mm_mul_pd(f, df), _mm_sub_pd(_mm_mul_pd(_mm_set1_pd(0.5), _mm_mul_pd(f, es)), _mm_mul_pd(df, df)));
+	D = _mm_add_pd(D, d);
+}
+
+
+static inline void SinCosLastStep(__m128d x, __m128d& s, __m128d& c)
+{
+	__m128d x2 = _mm_mul_pd(x, x);
+	s = _mm_sub_pd(x, _mm_mul_pd(_mm_mul_pd(x, x2), _mm_set1_pd(1.0 / 6.0)));
+	c = _mm_sub_pd(_mm_set1_pd(1.0), _mm_mul_pd(_mm_set1_pd(0.5), x2));
+}
+#endif
+
+
+void KeplerPropagator::SolveKepler(const double* meanAnomaly, const double* eccentricity, double* eccentricAnomaly, size_t n)
+{
+	// Starter by Danby (1987): E0 = M + 0.85 * e * sign(sin(M))
+	for (size_t i = 0; i < n; ++i)
+		eccentricAnomaly[i] = meanAnomaly[i] + copysign(0.85 * eccentricity[i], PI - meanAnomaly[i]);
+
+	// Halley iterations, one loop per iteration to let the compiler vectorize
+	for (int it = 0; it < ITERATIONS; ++it)
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			double E = eccentricAnomaly[i];
+			double e = eccentricity[i];
+			double es = e * sin(E);
+			double ec = e * cos(E);
+			double f = E - es - meanAnomaly[i];
+			double df = 1.0 - ec;
+			eccentricAnomaly[i] = E - f / (df - 0.5 * f * es / df);
+		}
+	}
+}
+
+
+void KeplerPropagator::SolveKeplerSinCos(const double* meanAnomaly, const double* eccentricity, double* cosAnomaly, double* sinAnomaly, size_t n)
+{
+	// sin(E) and cos(E) are written to the output right away and updated in place
+	double* s = sinAnomaly;
+	double* c = cosAnomaly;
+	const double* M = meanAnomaly;
+	const double* e = eccentricity;
+
+	const size_t BLOCK = 64;
+	double E[BLOCK], d[BLOCK];
+
+	for (size_t base = 0; base < n; base += BLOCK, s += BLOCK, c += BLOCK, M += BLOCK, e += BLOCK)
+	{
+		const size_t count = n - base < BLOCK ? n - base : BLOCK;
+
+		// The only full sine & cosine. Every following step changes E by a small
+		// d, so sin(E) and cos(E) are rotated along using the kernel polynomials.
+		// Same starter as SolveKepler(), sin(M) decides the side.
+		for (size_t i = 0; i < count; ++i)
+		{
+			SinCos(M[i], s[i], c[i]);
+			E[i] = M[i];
+			d[i] = s[i] < 0.0 ? -0.85 * e[i] : 0.85 * e[i];
+		}
+
+		// Halley iterations, one loop per iteration to let the compiler vectorize
+		for (int it = 0; it <= ITERATIONS; ++it)
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				double sd, cd;
+				SinCosKernel(d[i], sd, cd);
+				double sn = s[i] * cd + c[i] * sd;
+				double cn = c[i] * cd - s[i] * sd;
+				E[i] += d[i];
+				s[i] = sn;
+				c[i] = cn;
+
+				// f / (f' - f * f'' / 2f') with a single division
+				double es = e[i] * sn;
+				double f = E[i] - es - M[i];
+				double df = 1.0 - e[i] * cn;
+				d[i] = -f * df / (df * df - 0.5 * f * es);
+			}
+		}
+	}
+}
+
+
+void KeplerPropagator::SolveKeplerSinCos(const double* meanAnomaly, double eccentricity, double* cosAnomaly, double* sinAnomaly, size_t n)
+{
+	// Same scheme as above, two mean anomalies at once with SSE2. The starter
+	// step has the same length for all, its sine & cosine are computed once.
+	const int iterations = Iterations(eccentricity);
+	const double starter = 0.85 * eccentricity;
+	const double starterSin = sin(starter);
+	const double starterCos = cos(starter);
+
+	const size_t BLOCK = 64;
+	double D[BLOCK], d[BLOCK];
+
+	for (size_t base = 0; base < n; base += BLOCK)
+	{
+		const size_t count = n - base < BLOCK ? n - base : BLOCK;
+		const double* M = meanAnomaly + base;
+		double* s = sinAnomaly + base;
+		double* c = cosAnomaly + base;
+
+		// Independent iterations in each loop, they overlap in the pipeline.
+		// The only full sine & cosine, the starter and the first step.
+		size_t i = 0;
+#ifdef KEPLER_USE_SSE2
+		const __m128d e = _mm_set1_pd(eccentricity);
+		for (; i + 2 <= count; i += 2)
+		{
+			__m128d sn, cn, Dn, dn;
+			SinCos(_mm_loadu_pd(M + i), sn, cn);
+			__m128d side = _mm_and_pd(_mm_cmplt_pd(sn, _mm_setzero_pd()), _mm_set1_pd(-0.0));
+			Dn = _mm_xor_pd(_mm_set1_pd(starter), side);
+			Rotate(_mm_xor_pd(_mm_set1_pd(starterSin), side), _mm_set1_pd(starterCos), sn, cn);
+			HalleyStep(e, sn, cn, Dn, dn);
+			_mm_storeu_pd(s + i, sn);
+			_mm_storeu_pd(c + i, cn);
+			_mm_storeu_pd(D + i, Dn);
+			_mm_storeu_pd(d + i, dn);
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			SinCos(M[i], s[i], c[i]);
+			const bool negative = s[i] < 0.0;
+			D[i] = negative ? -starter : starter;
+			Rotate(negative ? -starterSin : starterSin, starterCos, s[i], c[i]);
+			HalleyStep(eccentricity, s[i], c[i], D[i], d[i]);
+		}
+
+		for (int it = 1; it < iterations; ++it)
+		{
+			i = 0;
+#ifdef KEPLER_USE_SSE2
+			for (; i + 2 <= count; i += 2)
+			{
+				__m128d sn = _mm_loadu_pd(s + i), cn = _mm_loadu_pd(c + i);
+				__m128d Dn = _mm_loadu_pd(D + i), dn = _mm_loadu_pd(d + i);
+				__m128d sd, cd;
+				SinCosKernel(dn, sd, cd);
+				Rotate(sd, cd, sn, cn);
+				HalleyStep(e, sn, cn, Dn, dn);
+				_mm_storeu_pd(s + i, sn);
+				_mm_storeu_pd(c + i, cn);
+				_mm_storeu_pd(D + i, Dn);
+				_mm_storeu_pd(d + i, dn);
+			}
+#endif
+			for (; i < count; ++i)
+			{
+				double sd, cd;
+				SinCosKernel(d[i], sd, cd);
+				Rotate(sd, cd, s[i], c[i]);
+				HalleyStep(eccentricity, s[i], c[i], D[i], d[i]);
+			}
+		}
+
+		i = 0;
+#ifdef KEPLER_USE_SSE2
+		for (; i + 2 <= count; i += 2)
+		{
+			__m128d sn = _mm_loadu_pd(s + i), cn = _mm_loadu_pd(c + i);
+			__m128d sd, cd;
+			SinCosLastStep(_mm_loadu_pd(d + i), sd, cd);
+			Rotate(sd, cd, sn, cn);
+			_mm_storeu_pd(s + i, sn);
+			_mm_storeu_pd(c + i, cn);
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			double sd, cd;
+			SinCosLastStep(d[i], sd, cd);
+			Rotate(sd, cd, s[i], c[i]);
+		}
+	}
+}
+
+
+int KeplerPropagator::Iterations(double eccentricity)
+{
+	// Largest error of E over a full orbit after 2 iterations: 9e-16 for e = 0.1,
+	// after 3 iterations: 2.6e-15 for e = 0.8
+	if (eccentricity <= 0.1)
+		return 2;
+	if (eccentricity <= 0.8)
+		return 3;
+	return ITERATIONS;
+}
+
+
+double KeplerPropagator::SolveKepler(double meanAnomaly, double eccentricity)
+{
+	double E;
+	SolveKepler(&meanAnomaly, &eccentricity, &E, 1);
+	return E;
+}
+
+
+double KeplerPropagator::OrbitPhase(double time, const PlanetInfo& info)
+{
+	// calculate with double precision!
+	double phase = time / (double)info.roundTripTime + info.meanAnomaly / (2.0 * PI);
+	return phase - floor(phase);
+}
+
+
+dvec3 KeplerPropagator::Position(double time, const PlanetInfo& info)
+{
+	double e = info.eccentricity;
+	double a = info.distanceToParent;
+	double E = SolveKepler(2.0 * PI * OrbitPhase(time, info), e);
+
+	dvec3 p, q;
+	PerifocalBasis(info, p, q);
+	return p * (a * (cos(E) - e)) + q * (a * sqrt(1.0 - e * e) * sin(E));
+}
+
+
+void KeplerPropagator::PerifocalBasis(const PlanetInfo& info, dvec3& p, dvec3& q)
+{
+	// rotY(node) * rotX(inclination) * rotY(periapsis) applied to (1,0,0) and (0,0,-1)
+	double cn = cos((double)info.ascendingNode), sn = sin((double)info.ascendingNode);
+	double ci = cos((double)info.orbitInclination), si = sin((double)info.orbitInclination);
+	double cw = cos((double)info.argumentOfPeriapsis), sw = sin((double)info.argumentOfPeriapsis);
+
+	p = dvec3(cn * cw - sn * ci * sw, si * sw, -sn * cw - cn * ci * sw);
+	q = dvec3(-cn * sw - sn * ci * cw, si * cw, sn * sw - cn * ci * cw);
+}
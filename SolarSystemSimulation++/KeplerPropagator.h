@@ -0,0 +1,47 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include "PlanetInfo.h"
+
+/**
+* Keplerian (two body) orbits from orbital elements, no stepping required.
+* The scene's frame is the ecliptic with y pointing north: x = X, y = Z, z = -Y.
+*/
+class KeplerPropagator
+{
+public:
+	// Fixed number of Halley iterations, exact to double precision for e <= 0.95
+	static const int ITERATIONS = 4;
+
+	/**
+	* Solves Kepler's equation M = E - e * sin(E) for <n> bodies at once.
+	* Every body gets the same number of iterations so the loops have no branches.
+	* @param meanAnomaly      Mean anomalies in [0, 2pi)
+	* @param eccentricity     Eccentricities in [0, 1)
+	* @param eccentricAnomaly Output
+	*/
+	static void SolveKepler(const double* meanAnomaly, const double* eccentricity, double* eccentricAnomaly, size_t n);
+	static double SolveKepler(double meanAnomaly, double eccentricity);
+
+	// Like SolveKepler(), but returns cos(E) and sin(E) which is what positions
+	// need. Uses a polynomial sine & cosine instead of the library calls, so the
+	// loops vectorize. The mean anomalies may be any angle.
+	static void SolveKeplerSinCos(const double* meanAnomaly, const double* eccentricity, double* cosAnomaly, double* sinAnomaly, size_t n);
+
+	// SolveKeplerSinCos() for one orbit at many times. A fixed eccentricity
+	// allows fewer iterations for round orbits, see Iterations().
+	static void SolveKeplerSinCos(const double* meanAnomaly, double eccentricity, double* cosAnomaly, double* sinAnomaly, size_t n);
+
+	// Halley iterations the starter of SolveKeplerSinCos() needs to be exact to
+	// double precision, ITERATIONS at most
+	static int Iterations(double eccentricity);
+
+	// Mean anomaly as fraction of a full orbit in [0, 1)
+	static double OrbitPhase(double time, const PlanetInfo& info);
+
+	// Position relative to the parent at <time> in days
+	static glm::dvec3 Position(double time, const PlanetInfo& info);
+
+	// Unit vectors to the periapsis (p) and 90 degree ahead of it (q) in the orbital plane
+	static void PerifocalBasis(const PlanetInfo& info, glm::dvec3& p, glm::dvec3& q);
+};
@@ -0,0 +1,370 @@
+#include "NBodySystem.h"
+#include "jge/ThreadPool.h"
+
+#include <math.h>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#define NBODY_USE_SSE2
+#endif
+
+using namespace glm;
+
+// Bodies receiving forces per task and bodies exerting forces per inner block.
+// A source block (4 arrays * 512 * 8 bytes) stays in the L1 cache while a tile is processed.
+static const size_t TARGET_TILE = 64;
+static const size_t SOURCE_BLOCK = 512;
+
+static size_t PaddedCount(size_t n)
+{
+	return (n + 3) & ~(size_t)3;
+}
+
+
+NBodySystem::NBodySystem()
+	: bodyCount(0)
+	, integrator(INTEGRATOR_YOSHIDA4)
+	, forceMethod(FORCE_DIRECT)
+	, timeStep(0.25)
+	, softening2(0.01 * 0.01)
+	, time(0.0)
+	, targetTime(0.0)
+	, accelerationsValid(false)
+{
+}
+
+
+int NBodySystem::AddBody(double m, const dvec3& pos, const dvec3& vel)
+{
+	size_t i = bodyCount++;
+	size_t padded = PaddedCount(bodyCount);
+
+	// Padding bodies have mu = 0 and exert no force
+	jge::AlignedArray<double>* arrays[] = { &px, &py, &pz, &vx, &vy, &vz, &ax, &ay, &az, &mu };
+	for (jge::AlignedArray<double>* a : arrays)
+		a->Resize(padded);
+
+	px[i] = pos.x; py[i] = pos.y; pz[i] = pos.z;
+	vx[i] = vel.x; vy[i] = vel.y; vz[i] = vel.z;
+	mu[i] = m;
+
+	accelerationsValid = false;
+	return (int)i;
+}
+
+
+void NBodySystem::Clear()
+{
+	jge::AlignedArray<double>* arrays[] = { &px, &py, &pz, &vx, &vy, &vz, &ax, &ay, &az, &mu };
+	for (jge::AlignedArray<double>* a : arrays)
+		a->Clear();
+
+	bodyCount = 0;
+	accelerationsValid = false;
+}
+
+
+void NBodySystem::SetTime(double t)
+{
+	time = t;
+	targetTime = t;
+}
+
+
+double NBodySystem::GetTime() const
+{
+	return time;
+}
+
+
+int NBodySystem::Advance(double target, int maxSteps)
+{
+	targetTime = target;
+
+	double h = target >= time ? timeStep : -timeStep;
+	int steps = 0;
+	while (fabs(target - time) >= timeStep && steps < maxSteps)
+	{
+		Step(h);
+		time += h;
+		++steps;
+	}
+
+	return steps;
+}
+
+
+void NBodySystem::Step(double dt)
+{
+	if (integrator == INTEGRATOR_YOSHIDA4)
+	{
+		// Yoshida (1990): a symmetric composition of three 2nd order steps
+		const double cbrt2 = 1.2599210498948732;
+		const double w1 = 1.0 / (2.0 - cbrt2);
+		const double w0 = -cbrt2 * w1;
+
+		LeapfrogStep(w1 * dt);
+		LeapfrogStep(w0 * dt);
+		LeapfrogStep(w1 * dt);
+	}
+	else
+	{
+		LeapfrogStep(dt);
+	}
+}
+
+
+void NBodySystem::LeapfrogStep(double dt)
+{
+	if (!accelerationsValid)
+		ComputeAccelerations();
+
+	const size_t n = bodyCount;
+	const double half = 0.5 * dt;
+
+	// kick
+	for (size_t i = 0; i < n; ++i)
+	{
+		vx[i] += half * ax[i];
+		vy[i] += half * ay[i];
+		vz[i] += half * az[i];
+	}
+
+	// drift
+	for (size_t i = 0; i < n; ++i)
+	{
+		px[i] += dt * vx[i];
+		py[i] += dt * vy[i];
+		pz[i] += dt * vz[i];
+	}
+
+	ComputeAccelerations();
+
+	// kick
+	for (size_t i = 0; i < n; ++i)
+	{
+		vx[i] += half * ax[i];
+		vy[i] += half * ay[i];
+		vz[i] += half * az[i];
+	}
+}
+
+
+void NBodySystem::ComputeAccelerations()
+{
+	if (forceMethod == FORCE_BARNES_HUT)
+	{
+		tree.Build(px.Data(), py.Data(), pz.Data(), mu.Data(), bodyCount);
+		tree.ComputeAccelerations(softening2, ax.Data(), ay.Data(), az.Data());
+	}
+	else
+	{
+		ComputeDirectAccelerations();
+	}
+
+	accelerationsValid = true;
+}
+
+
+void NBodySystem::ComputeDirectAccelerations()
+{
+	jge::ThreadPool::Shared().ParallelFor(bodyCount, TARGET_TILE, [this](size_t begin, size_t end)
+	{
+		ComputeAccelerationTile(begin, end);
+	});
+}
+
+
+void NBodySystem::ComputeAccelerationTile(size_t begin, size_t end)
+{
+	// Direct summation. The softening keeps r^2 > 0, so a body's own
+	// contribution (dx = 0) vanishes without a branch.
+	const size_t padded = PaddedCount(bodyCount);
+	const double* x = px.Data();
+	const double* y = py.Data();
+	const double* z = pz.Data();
+	const double* m = mu.Data();
+
+	double accX[TARGET_TILE], accY[TARGET_TILE], accZ[TARGET_TILE];
+	for (size_t k = 0; k < end - begin; ++k)
+		accX[k] = accY[k] = accZ[k] = 0.0;
+
+	for (size_t block = 0; block < padded; block += SOURCE_BLOCK)
+	{
+		const size_t blockEnd = block + SOURCE_BLOCK < padded ? block + SOURCE_BLOCK : padded;
+
+		for (size_t i = begin; i < end; ++i)
+		{
+#ifdef NBODY_USE_SSE2
+			const __m128d xi = _mm_set1_pd(x[i]);
+			const __m128d yi = _mm_set1_pd(y[i]);
+			const __m128d zi = _mm_set1_pd(z[i]);
+			const __m128d eps = _mm_set1_pd(softening2);
+			__m128d sumX = _mm_setzero_pd();
+			__m128d sumY = _mm_setzero_pd();
+			__m128d sumZ = _mm_setzero_pd();
+
+			for (size_t j = block; j < blockEnd; j += 2)
+			{
+				__m128d dx = _mm_sub_pd(_mm_load_pd(x + j), xi);
+				__m128d dy = _mm_sub_pd(_mm_load_pd(y + j), yi);
+				__m128d dz = _mm_sub_pd(_mm_load_pd(z + j), zi);
+				__m128d r2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_add_pd(_mm_mul_pd(dz, dz), eps));
+				__m128d s = _mm_div_pd(_mm_load_pd(m + j), _mm_mul_pd(r2, _mm_sqrt_pd(r2)));
+				sumX = _mm_add_pd(sumX, _mm_mul_pd(dx, s));
+				sumY = _mm_add_pd(sumY, _mm_mul_pd(dy, s));
+				sumZ = _mm_add_pd(sumZ, _mm_mul_pd(dz, s));
+			}
+
+			double lanes[2];
+			_mm_storeu_pd(lanes, sumX); accX[i - begin] += lanes[0] + lanes[1];
+			_mm_storeu_pd(lanes, sumY); accY[i - begin] += lanes[0] + lanes[1];
+			_mm_storeu_pd(lanes, sumZ); accZ[i - begin] += lanes[0] + lanes[1];
+#else
+			double sumX = 0.0, sumY = 0.0, sumZ = 0.0;
+			for (size_t j = block; j < blockEnd; ++j)
+			{
+				double dx = x[j] - x[i];
+				double dy = y[j] - y[i];
+				double dz = z[j] - z[i];
+				double r2 = dx * dx + dy * dy + dz * dz + softening2;
+				double s = m[j] / (r2 * sqrt(r2));
+				sumX += dx * s;
+				sumY += dy * s;
+				sumZ += dz * s;
+			}
+			accX[i - begin] += sumX;
+			accY[i - begin] += sumY;
+			accZ[i - begin] += sumZ;
+#endif
+		}
+	}
+
+	for (size_t i = begin; i < end; ++i)
+	{
+		ax[i] = accX[i - begin];
+		ay[i] = accY[i - begin];
+		az[i] = accZ[i - begin];
+	}
+}
+
+
+void NBodySystem::SetIntegrator(NBodyIntegrator i)
+{
+	integrator = i;
+}
+
+
+NBodyIntegrator NBodySystem::GetIntegrator() const
+{
+	return integrator;
+}
+
+
+void NBodySystem::SetTimeStep(double days)
+{
+	timeStep = days > 1e-6 ? days : 1e-6;
+}
+
+
+double NBodySystem::GetTimeStep() const
+{
+	return timeStep;
+}
+
+
+void NBodySystem::SetSoftening(double length)
+{
+	// Must not become 0, see ComputeAccelerationTile()
+	softening2 = length > 1e-9 ? length * length : 1e-18;
+	accelerationsValid = false;
+}
+
+
+void NBodySystem::SetForceMethod(NBodyForceMethod method)
+{
+	forceMethod = method;
+	accelerationsValid = false;
+}
+
+
+NBodyForceMethod NBodySystem::GetForceMethod() const
+{
+	return forceMethod;
+}
+
+
+void NBodySystem::SetOpeningAngle(double theta)
+{
+	tree.SetOpeningAngle(theta);
+	accelerationsValid = false;
+}
+
+
+double NBodySystem::GetOpeningAngle() const
+{
+	return tree.GetOpeningAngle();
+}
+
+
+size_t NBodySystem::Count() const
+{
+	return bodyCount;
+}
+
+
+dvec3 NBodySystem::GetPosition(size_t i) const
+{
+	return dvec3(px[i], py[i], pz[i]);
+}
+
+
+dvec3 NBodySystem::GetVelocity(size_t i) const
+{
+	return dvec3(vx[i], vy[i], vz[i]);
+}
+
+
+double NBodySystem::GetEnergy() const
+{
+	double kinetic = 0.0;
+	double potential = 0.0;
+
+	// Scaled by G, mu stands in for the mass
+	for (size_t i = 0; i < bodyCount; ++i)
+	{
+		kinetic += 0.5 * mu[i] * (vx[i] * vx[i] + vy[i] * vy[i] + vz[i] * vz[i]);
+		for (size_t j = i + 1; j < bodyCount; ++j)
+		{
+			double dx = px[j] - px[i];
+			double dy = py[j] - py[i];
+			double dz = pz[j] - pz[i];
+			potential -= mu[i] * mu[j] / sqrt(dx * dx + dy * dy + dz * dz + softening2);
+		}
+	}
+
+	return kinetic + potential;
+}
+
+
+void NBodySystem::WriteTranslations(mat4* matrices, size_t count, int origin) const
+{
+	// Time between the last step and the requested time. If Advance() ran
+	// out of steps we are lagging behind, don't extrapolate that far.
+	double rest = targetTime - time;
+	if (fabs(rest) > timeStep)
+		rest = rest > 0.0 ? timeStep : -timeStep;
+
+	dvec3 originPos(0.0);
+	if (origin >= 0)
+		originPos = dvec3(px[origin] + vx[origin] * rest, py[origin] + vy[origin] * rest, pz[origin] + vz[origin] * rest);
+
+	for (size_t i = 0; i < count && i < bodyCount; ++i)
+	{
+		matrices[i][3] = vec4(
+			(float)(px[i] + vx[i] * rest - originPos.x),
+			(float)(py[i] + vy[i] * rest - originPos.y),
+			(float)(pz[i] + vz[i] * rest - originPos.z),
+			1.0f);
+	}
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include "jge/AlignedArray.h"
+#include "BarnesHutTree.h"
+
+enum NBodyIntegrator
+{
+	INTEGRATOR_LEAPFROG = 0,	// 2nd order kick-drift-kick (velocity verlet)
+	INTEGRATOR_YOSHIDA4 = 1,	// 4th order, three leapfrog steps with Yoshida's weights
+};
+
+enum NBodyForceMethod
+{
+	FORCE_DIRECT = 0,			// exact pairwise sum, O(n^2)
+	FORCE_BARNES_HUT = 1,		// octree approximation, O(n log n)
+};
+
+/**
+* Gravitational N-body simulation with symplectic integrators.
+* Units are OpenGL units and days, so the gravitational parameter mu = G * mass
+* is given in units^3 / day^2. Bodies are stored as structure of arrays which
+* are padded with massless bodies to a multiple of 4 for the SIMD force kernel.
+*/
+class NBodySystem
+{
+public:
+	NBodySystem();
+
+	/**
+	* Adds a body and returns its index.
+	* @param mu  Gravitational parameter G * mass
+	* @param pos Position in units
+	* @param vel Velocity in units / day
+	*/
+	int AddBody(double mu, const glm::dvec3& pos, const glm::dvec3& vel);
+	void Clear();
+
+	// Sets the simulation time the current state belongs to
+	void SetTime(double time);
+	double GetTime() const;
+
+	// Integrates with fixed steps towards <targetTime> (forward or backward).
+	// At most <maxSteps> steps are taken, returns the number of steps done.
+	int Advance(double targetTime, int maxSteps = 4096);
+
+	// A single step of <dt> days with the selected integrator
+	void Step(double dt);
+
+	void SetIntegrator(NBodyIntegrator integrator);
+	NBodyIntegrator GetIntegrator() const;
+	void SetTimeStep(double days);
+	double GetTimeStep() const;
+	void SetSoftening(double length);
+
+	// Exact or approximated gravity, can be switched any time
+	void SetForceMethod(NBodyForceMethod method);
+	NBodyForceMethod GetForceMethod() const;
+	void SetOpeningAngle(double theta);
+	double GetOpeningAngle() const;
+
+	size_t Count() const;
+	glm::dvec3 GetPosition(size_t i) const;
+	glm::dvec3 GetVelocity(size_t i) const;
+
+	// Total energy (kinetic + potential), to watch the integrators drift
+	double GetEnergy() const;
+
+	// Overwrites the translation of <count> model matrices with the positions of the
+	// first <count> bodies relative to body <origin> (-1 for the barycenter).
+	// The time left over by Advance() is drifted linearly.
+	void WriteTranslations(glm::mat4* matrices, size_t count, int origin = -1) const;
+
+private:
+	void LeapfrogStep(double dt);
+	void ComputeAccelerations();
+	void ComputeDirectAccelerations();
+	void ComputeAccelerationTile(size_t begin, size_t end);
+
+	// Positions, velocities, accelerations & mu, padded to a multiple of 4
+	jge::AlignedArray<double> px, py, pz;
+	jge::AlignedArray<double> vx, vy, vz;
+	jge::AlignedArray<double> ax, ay, az;
+	jge::AlignedArray<double> mu;
+	size_t bodyCount;
+
+	NBodyIntegrator integrator;
+	NBodyForceMethod forceMethod;
+	BarnesHutTree tree;
+	double timeStep;
+	double softening2;
+	double time;
+	double targetTime;
+	bool accelerationsValid;
+};
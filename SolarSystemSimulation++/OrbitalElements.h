@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include <math.h>
+#include "PlanetInfo.h"
+#include "KeplerPropagator.h"
+
+/**
+* Structure-of-arrays representation of the orbits of many bodies.
+* Consumed by PlanetMovementSystem::OrbitBatch(). Everything that is
+* constant over time (reciprocals, sine & cosine of fixed angles) is
+* precalculated once in Add() so the per frame work stays minimal.
+*/
+struct OrbitalElements
+{
+	/**
+	* Appends a body.
+	* @param info   Orbit and body properties
+	* @param parent Index of the body to orbit or -1 to orbit the origin.
+	*               Parents have to be added before their children.
+	*/
+	int Add(const PlanetInfo& info, int parent = -1)
+	{
+		float tilt = info.equatorInclination + info.orbitInclination;
+		double e = info.eccentricity;
+		glm::dvec3 p, q;
+		KeplerPropagator::PerifocalBasis(info, p, q);
+
+		size.push_back(info.planetSize);
+		semiMajorAxis.push_back(info.distanceToParent);
+		semiMinorAxis.push_back(info.distanceToParent * sqrt(1.0 - e * e));
+		eccentricity.push_back(e);
+		meanAnomalyPhase.push_back(info.meanAnomaly / 6.283185307179586);
+		invRoundTripTime.push_back(info.roundTripTime > 0.0f ? 1.0 / info.roundTripTime : 0.0);
+		invSelfRotationTime.push_back(info.selfRotationTime > 0.0f ? 1.0 / info.selfRotationTime : 0.0);
+		tiltCos.push_back(cosf(tilt));
+		tiltSin.push_back(sinf(tilt));
+		periapsisX.push_back(p.x); periapsisY.push_back(p.y); periapsisZ.push_back(p.z);
+		perpendicularX.push_back(q.x); perpendicularY.push_back(q.y); perpendicularZ.push_back(q.z);
+		parents.push_back(parent);
+
+		return (int)Count() - 1;
+	}
+
+	size_t Count() const
+	{
+		return size.size();
+	}
+
+	std::vector<float> size;
+	std::vector<double> semiMajorAxis;
+	std::vector<double> semiMinorAxis;
+	std::vector<double> eccentricity;
+	std::vector<double> meanAnomalyPhase;		// mean anomaly at time 0 / 2pi
+	std::vector<double> invRoundTripTime;		// 1 / days, 0 for a resting body
+	std::vector<double> invSelfRotationTime;	// 1 / days, 0 for no spin
+	std::vector<float> tiltCos;					// equator + orbit inclination
+	std::vector<float> tiltSin;
+	std::vector<double> periapsisX;				// orbital plane, see KeplerPropagator::PerifocalBasis()
+	std::vector<double> periapsisY;
+	std::vector<double> periapsisZ;
+	std::vector<double> perpendicularX;
+	std::vector<double> perpendicularY;
+	std::vector<double> perpendicularZ;
+	std::vector<int> parents;
+};
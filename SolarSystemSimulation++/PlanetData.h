@@ -5,6 +5,8 @@
 
 #define SF 1.0
 
+// Bodies the renderer has models and textures for. They are the first
+// entries of the body catalog (catalog\bodies.csv), in this order.
 enum Bodies
 {
     bSun = 0,
@@ -22,113 +24,14 @@ enum Bodies
     bEnd = 12
 };
 
-const char* const bodyNames[] = {
-    "Sun",
-    "Mercury",
-    "Venus",
-    "Earth",
-    "Mars",
-    "Jupiter",
-    "Saturn",
-    "Uranus",
-    "Neptune",
-    "Moon",
-    "Io",
-    "Europa",
-    "NA"
-};
-
-
-PlanetInfo sunInfo(
-	6.0f * SF,
-	1.0f,
-	0.0f * SF,
-	25.38f,
-	glm::radians(7.25f));
-
-PlanetInfo mercuryInfo(
-	2.0f * SF,
-	88.0f,
-	14.0f * SF,
-	58.646225f,
-	glm::radians(0.0f),
-	glm::radians(7.00487f));
-
-PlanetInfo venusInfo(
-	1.4f * SF,
-	225.0f,
-	20.0f * SF,
-	243.0187f,
-	glm::radians(177.3f),
-	glm::radians(3.39471f));
-
-PlanetInfo earthInfo(
-	1.5f * SF,
-	365.0f,
-	28.0f * SF,
-	1.0f,
-	glm::radians(23.45f));
+// Gravitational parameter G * M of the sun in units^3 / day^2 for the N-body mode.
+// Chosen so that the earth keeps its 365 day orbit at 28 units (Kepler's 3rd law).
+const double sunGravParameter = 4.0 * 3.14159265358979 * 3.14159265358979 * (28.0 * SF) * (28.0 * SF) * (28.0 * SF) / (365.0 * 365.0);
 
-PlanetInfo marsInfo(
-	1.20f * SF,
-	687.0f,
-	38.0f * SF,
-	1.02595675f,
-	glm::radians(25.19f),
-	glm::radians(1.85061f));
+// Obliquity of the ecliptic at J2000, rotates the ephemeris' equatorial frame into the scene
+const double eclipticObliquity = 0.40909280422232897;
 
-PlanetInfo jupiterInfo(
-	4.0f * SF,
-	4329.0f,
-	56.0f * SF,
-	0.41354f,
-	glm::radians(3.12f),
-	glm::radians(1.30530f));
-
-PlanetInfo saturnInfo(
-	3.5f * SF,
-	10751.0f,
-	73.0f * SF,
-	0.44401f,
-	glm::radians(26.73f),
-	glm::radians(2.48446f));
-
-PlanetInfo uranusInfo(
-	2.2f * SF,
-	30664.0f,
-	96.0f * SF,
-	0.71833f,
-	glm::radians(97.86f),
-	glm::radians(0.76986f));
-
-PlanetInfo neptuneInfo(
-	1.5f * SF,
-	60148.0f,
-	112.0f * SF,
-	0.67125f,
-	glm::radians(29.58f),
-	glm::radians(1.76917f));
-
-// Moon data
-PlanetInfo ioInfo(0.36f * SF, 14.0f, 4.8f * SF);
-PlanetInfo europaInfo(0.31f * SF, 28.0f, 5.8f * SF);
-PlanetInfo moonInfo(0.3f * SF, 27.0f, 2.0f * SF);
 
 // Misusing the planet info structure to hold the ring data
 // size and inclincation angle
-PlanetInfo saturnRing(3.2f, 0.0f, 0.0f, 0.0f, glm::radians(26.73f));
-
-PlanetInfo planetInfo[] = {
-    sunInfo,
-    mercuryInfo,
-    venusInfo,
-    earthInfo,
-    marsInfo,
-    jupiterInfo,
-    saturnInfo,
-    uranusInfo,
-    neptuneInfo,
-    moonInfo,
-    ioInfo,
-    europaInfo
-};
\ No newline at end of file
+const PlanetInfo saturnRing(3.2f, 0.0f, 0.0f, 0.0f, glm::radians(26.73f));
@@ -9,14 +9,23 @@ struct PlanetInfo
     * @param sr     Earth Days for one self-revolution
     * @param eqIncl Equator inclination in rad
     * @param orbInc Orbit inclination in rad
+    * @param ecc    Eccentricity, <dist> is the semi-major axis then
+    * @param argPer Argument of periapsis in rad
+    * @param ascNod Longitude of the ascending node in rad
+    * @param meanAn Mean anomaly at time 0 in rad
     */
-	PlanetInfo(float size, float rtt, float dist, float sr = 0.0f, float eqIncl = 0.0f, float orbInc = 0.0f)
+	PlanetInfo(float size, float rtt, float dist, float sr = 0.0f, float eqIncl = 0.0f, float orbInc = 0.0f,
+		float ecc = 0.0f, float argPer = 0.0f, float ascNod = 0.0f, float meanAn = 0.0f)
 		: planetSize(size)
 		, roundTripTime(rtt)
 		, distanceToParent(dist)
 		, selfRotationTime(sr)
 		, equatorInclination(eqIncl)
 		, orbitInclination(orbInc)
+		, eccentricity(ecc)
+		, argumentOfPeriapsis(argPer)
+		, ascendingNode(ascNod)
+		, meanAnomaly(meanAn)
 	{
 	}
 
@@ -26,4 +35,8 @@ struct PlanetInfo
 	float selfRotationTime;
 	float equatorInclination;
 	float orbitInclination;
+	float eccentricity;
+	float argumentOfPeriapsis;
+	float ascendingNode;
+	float meanAnomaly;
 };
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include "PlanetMovementSystem.h"
+#include "KeplerPropagator.h"
+#include "jge/ThreadPool.h"
 #include <glm/gtx/transform.hpp>
 
 using namespace glm;
@@ -6,11 +8,11 @@ using namespace glm;
 glm::mat4 PlanetMovementSystem::OrbitAroundSun(double time,const PlanetInfo& child)
 {
 	// calculate with double precision!
-	float angle = (float)(360.0 * fmod(time, (double)child.roundTripTime) / (double)child.roundTripTime);
+	float angle = (float)(360.0 * KeplerPropagator::OrbitPhase(time, child));
 	float spinAngle = (float)(360.0 * fmod(time, (double)child.selfRotationTime) / (double)child.selfRotationTime);
 
 	mat4 orbit			= glm::rotate(glm::radians(angle), vec3(0, 1, 0));							// orbit around sun
-	mat4 translate		= glm::translate(vec3(child.distanceToParent, 0, 0));						// translate away from sun
+	mat4 translate		= glm::translate(vec3(KeplerPropagator::Position(time, child)));			// position on the ellipse
 	mat4 inclinate		= glm::rotate(child.equatorInclination, vec3(0, 0, 1));						// equator inclination
 	mat4 spin			= glm::rotate(glm::radians(spinAngle), vec3(0, 1, 0));						// spin (self rotation)
 	mat4 scale			= glm::scale(vec3(child.planetSize, child.planetSize, child.planetSize));	// scale the object
@@ -19,16 +21,9 @@ glm::mat4 PlanetMovementSystem::OrbitAroundSun(double time,const PlanetInfo& chi
 	// Beware: Matrix multiplication order is important, read RTL!
 	// First we scale the object at the origin (0,0,0)
 	// Then we spin it (still at the origin) -> self rotation / spin
-	// Now we translate it away and rotate it afterwards -> orbit around sun
-	mat4 planetMatrix = orbitInclinate * orbit * translate * spin * scale;
-	
-	// Here we store the translation matrix to and from the origin
-	mat4 toOrigin = glm::translate(-vec3(planetMatrix[3]));
-	mat4 toLocation = glm::translate(vec3(planetMatrix[3]));
-
-	// We translate the object back to the origin and apply the inclination matrix
-	// As a last step we bring it back to the previous position
-	planetMatrix = toLocation * inclinate * toOrigin * planetMatrix;
+	// Then we rotate it with the orbit and incline the equator
+	// As a last step we move it to its position on the ellipse
+	mat4 planetMatrix = translate * inclinate * orbitInclinate * orbit * spin * scale;
 
 	return planetMatrix;
 }
@@ -36,23 +31,35 @@ glm::mat4 PlanetMovementSystem::OrbitAroundSun(double time,const PlanetInfo& chi
 
 glm::mat4 PlanetMovementSystem::OrbitAroundParent(double time, const PlanetInfo& child, const vec3& parentPos)
 {
-	float childAngle = (float)(360.0 * fmod(time, (double)child.roundTripTime) / (double)child.roundTripTime);
+	float childAngle = (float)(360.0 * KeplerPropagator::OrbitPhase(time, child));
 
-	mat4 toParentPos = glm::translate(parentPos);
+	mat4 toChildPos = glm::translate(parentPos + vec3(KeplerPropagator::Position(time, child)));
 	mat4 childRotate = glm::rotate(glm::radians(childAngle), vec3(0, 1, 0));
-	mat4 childTranslate = glm::translate(vec3(child.distanceToParent, 0, 0));
 	mat4 childScale = glm::scale(vec3(child.planetSize, child.planetSize, child.planetSize));
+	mat4 inclinate = glm::rotate(child.equatorInclination, vec3(0, 0, 1));
 
 	// Like in OrbitAroundSun()
-	mat4 childMatrix = toParentPos * childRotate * childTranslate * childScale;
+	return toChildPos * inclinate * childRotate * childScale;
+}
 
-	// Here we store the translation matrix to and from the origin
-	mat4 toOrigin = glm::translate(-vec3(childMatrix[3]));
-	mat4 toLocation = glm::translate(vec3(childMatrix[3]));
-	mat4 inclinate = glm::rotate(child.equatorInclination, vec3(0, 0, 1));
 
-	childMatrix = toLocation * inclinate * toOrigin * childMatrix;
-	return childMatrix;
+glm::mat4 PlanetMovementSystem::OrbitPath(const PlanetInfo& child)
+{
+	// Unit circle (x/z plane) -> ellipse with the sun in one of its foci -> orbital plane
+	dvec3 p, q;
+	KeplerPropagator::PerifocalBasis(child, p, q);
+
+	double a = child.distanceToParent;
+	double e = child.eccentricity;
+	double b = a * sqrt(1.0 - e * e);
+
+	// circle (1,0,0) -> periapsis direction, (0,0,-1) -> q
+	mat4 path;
+	path[0] = vec4(vec3(p * a), 0.0f);
+	path[1] = vec4(0.0f);
+	path[2] = vec4(vec3(-q * b), 0.0f);
+	path[3] = vec4(vec3(p * (-a * e)), 1.0f);
+	return path;
 }
 
 
@@ -72,4 +79,236 @@ glm::mat4 PlanetMovementSystem::SimulateRing(double time, const PlanetInfo& ring
 	// inclinate the ring
 	ringMatrix = toLocation * inclinate * toOrigin * ringMatrix;
 	return ringMatrix;
-}
\ No newline at end of file
+}
+
+
+// Number of bodies processed per chunk in ComputeLocalOrbits(). The scratch
+// arrays live on the stack, so the batch needs no allocations and is reentrant.
+static const size_t ORBIT_CHUNK = 64;
+
+void PlanetMovementSystem::OrbitBatch(double time, const OrbitalElements& elements, glm::mat4* out)
+{
+	ComputeLocalOrbits(time, elements, out);
+	ResolveParents(elements, out);
+}
+
+
+void PlanetMovementSystem::ComputeLocalOrbits(double time, const OrbitalElements& elements, glm::mat4* out)
+{
+	ComputeLocalOrbits(time, elements, out, 0, elements.Count());
+}
+
+
+void PlanetMovementSystem::ComputeLocalOrbits(double time, const OrbitalElements& elements, glm::mat4* out, size_t begin, size_t end)
+{
+	const double TWO_PI = 6.283185307179586;
+
+	const float* size = elements.size.data();
+	const double* a = elements.semiMajorAxis.data();
+	const double* b = elements.semiMinorAxis.data();
+	const double* e = elements.eccentricity.data();
+	const double* phase0 = elements.meanAnomalyPhase.data();
+	const double* invRtt = elements.invRoundTripTime.data();
+	const double* invSr = elements.invSelfRotationTime.data();
+	const float* tiltCos = elements.tiltCos.data();
+	const float* tiltSin = elements.tiltSin.data();
+	const double* px = elements.periapsisX.data();
+	const double* py = elements.periapsisY.data();
+	const double* pz = elements.periapsisZ.data();
+	const double* qx = elements.perpendicularX.data();
+	const double* qy = elements.perpendicularY.data();
+	const double* qz = elements.perpendicularZ.data();
+
+	double meanAnomaly[ORBIT_CHUNK], anomaly[ORBIT_CHUNK];
+	double anomalyCos[ORBIT_CHUNK], anomalySin[ORBIT_CHUNK];
+	float bodyAngle[ORBIT_CHUNK];
+	float bodyCos[ORBIT_CHUNK], bodySin[ORBIT_CHUNK];
+
+	for (size_t base = begin; base < end; base += ORBIT_CHUNK)
+	{
+		const size_t n = end - base < ORBIT_CHUNK ? end - base : ORBIT_CHUNK;
+
+		// Angles in double precision, time is large compared to the periods.
+		// A reciprocal of 0 yields angle 0, no branch for non spinning bodies.
+		for (size_t k = 0; k < n; ++k)
+		{
+			double orbitPhase = time * invRtt[base + k] + phase0[base + k];
+			double spinPhase = time * invSr[base + k];
+			orbitPhase -= floor(orbitPhase);
+			spinPhase -= floor(spinPhase);
+			meanAnomaly[k] = TWO_PI * orbitPhase;
+			bodyAngle[k] = (float)(TWO_PI * (orbitPhase + spinPhase));
+		}
+
+		// Mean -> eccentric anomaly
+		KeplerPropagator::SolveKepler(meanAnomaly, e + base, anomaly, n);
+
+		for (size_t k = 0; k < n; ++k)
+		{
+			anomalyCos[k] = cos(anomaly[k]);
+			anomalySin[k] = sin(anomaly[k]);
+			bodyCos[k] = cosf(bodyAngle[k]);
+			bodySin[k] = sinf(bodyAngle[k]);
+		}
+
+		// Closed form of the matrix chain in OrbitAroundSun():
+		// translate(pos) * rotZ(equator + orbit incl.) * rotY(orbit + spin) * scale(size)
+		// with pos = a * (cos(E) - e) * p + b * sin(E) * q
+		for (size_t k = 0; k < n; ++k)
+		{
+			const size_t i = base + k;
+			const float s = size[i];
+			const float ct = tiltCos[i], st = tiltSin[i];
+			const float cb = bodyCos[k], sb = bodySin[k];
+			const double u = a[i] * (anomalyCos[k] - e[i]);
+			const double v = b[i] * anomalySin[k];
+
+			mat4& m = out[i];
+			m[0] = vec4(ct * cb * s, st * cb * s, -sb * s, 0.0f);
+			m[1] = vec4(-st * s, ct * s, 0.0f, 0.0f);
+			m[2] = vec4(ct * sb * s, st * sb * s, cb * s, 0.0f);
+			m[3] = vec4((float)(u * px[i] + v * qx[i]), (float)(u * py[i] + v * qy[i]), (float)(u * pz[i] + v * qz[i]), 1.0f);
+		}
+	}
+}
+
+
+void PlanetMovementSystem::ResolveParents(const OrbitalElements& elements, glm::mat4* out)
+{
+	// Parents precede their children, one pass is enough
+	const int* parents = elements.parents.data();
+	for (size_t i = 0; i < elements.Count(); ++i)
+	{
+		if (parents[i] >= 0)
+			out[i][3] += vec4(vec3(out[parents[i]][3]), 0.0f);
+	}
+}
+
+
+// Adds the position of body <i> relative to its parent at <n> times to x, y, z.
+// The SoA counterpart of ComputeLocalOrbits(), vectorized over time instead of bodies.
+static void AccumulateOrbit(const OrbitalElements& elements, size_t i, const double* times, size_t n, double* x, double* y, double* z)
+{
+	const double TWO_PI = 6.283185307179586;
+	const double invRtt = elements.invRoundTripTime[i];
+	const double phase0 = elements.meanAnomalyPhase[i];
+	const double a = elements.semiMajorAxis[i];
+	const double b = elements.semiMinorAxis[i];
+	const double e = elements.eccentricity[i];
+	const double px = elements.periapsisX[i], py = elements.periapsisY[i], pz = elements.periapsisZ[i];
+	const double qx = elements.perpendicularX[i], qy = elements.perpendicularY[i], qz = elements.perpendicularZ[i];
+
+	// The solver reduces the angles itself
+	double meanAnomaly[ORBIT_CHUNK];
+	double anomalyCos[ORBIT_CHUNK], anomalySin[ORBIT_CHUNK];
+	for (size_t k = 0; k < n; ++k)
+		meanAnomaly[k] = TWO_PI * (times[k] * invRtt + phase0);
+
+	KeplerPropagator::SolveKeplerSinCos(meanAnomaly, e, anomalyCos, anomalySin, n);
+
+	for (size_t k = 0; k < n; ++k)
+	{
+		const double u = a * (anomalyCos[k] - e);
+		const double v = b * anomalySin[k];
+		x[k] += u * px + v * qx;
+		y[k] += u * py + v * qy;
+		z[k] += u * pz + v * qz;
+	}
+}
+
+
+void PlanetMovementSystem::QueryPositions(const double* times, size_t timeCount, const OrbitalElements& elements,
+	const unsigned char* bodyMask, double* outX, double* outY, double* outZ)
+{
+	const size_t count = elements.Count();
+	const int* parents = elements.parents.data();
+
+	// Every orbit is computed once per chunk of times. The selected bodies are
+	// computed in their output slots, their unselected parents in scratch rows.
+	// Parents precede their children, so they are done first.
+	std::vector<int> rows(count, -1);
+	size_t selectedCount = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (bodyMask == nullptr || bodyMask[i])
+			rows[i] = (int)selectedCount++;
+	}
+
+	std::vector<size_t> needed;
+	size_t scratchCount = 0;
+	for (size_t i = count; i-- > 0;)
+	{
+		if (rows[i] >= 0 && parents[i] >= 0 && rows[parents[i]] < 0)
+			rows[parents[i]] = (int)(selectedCount + scratchCount++);
+	}
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (rows[i] >= 0)
+			needed.push_back(i);
+	}
+
+	jge::ThreadPool::Shared().ParallelFor(timeCount, 16 * ORBIT_CHUNK, [&](size_t begin, size_t end)
+	{
+		std::vector<double> scratch(scratchCount * 3 * ORBIT_CHUNK);
+
+		for (size_t base = begin; base < end; base += ORBIT_CHUNK)
+		{
+			const size_t n = end - base < ORBIT_CHUNK ? end - base : ORBIT_CHUNK;
+
+			// Row r of the positions at times [base, base + n)
+			auto row = [&](int r, double*& x, double*& y, double*& z)
+			{
+				if (r < (int)selectedCount)
+				{
+					x = outX + r * timeCount + base;
+					y = outY + r * timeCount + base;
+					z = outZ + r * timeCount + base;
+				}
+				else
+				{
+					x = &scratch[(r - selectedCount) * 3 * ORBIT_CHUNK];
+					y = x + ORBIT_CHUNK;
+					z = y + ORBIT_CHUNK;
+				}
+			};
+
+			for (size_t body : needed)
+			{
+				double *x, *y, *z;
+				row(rows[body], x, y, z);
+
+				if (parents[body] >= 0)
+				{
+					double *parentX, *parentY, *parentZ;
+					row(rows[parents[body]], parentX, parentY, parentZ);
+					for (size_t k = 0; k < n; ++k)
+					{
+						x[k] = parentX[k];
+						y[k] = parentY[k];
+						z[k] = parentZ[k];
+					}
+				}
+				else
+				{
+					for (size_t k = 0; k < n; ++k)
+						x[k] = y[k] = z[k] = 0.0;
+				}
+
+				// Bodies at the origin (the sun) add nothing
+				if (elements.semiMajorAxis[body] > 0.0)
+					AccumulateOrbit(elements, body, times + base, n, x, y, z);
+			}
+		}
+	});
+}
+
+glm::dvec3 PlanetMovementSystem::QueryPosition(double time, const OrbitalElements& elements, size_t body)
+{
+	double x = 0.0, y = 0.0, z = 0.0;
+	for (int i = (int)body; i >= 0; i = elements.parents[i])
+	{
+		if (elements.semiMajorAxis[i] > 0.0)
+			AccumulateOrbit(elements, i, &time, 1, &x, &y, &z);
+	}
+	return glm::dvec3(x, y, z);
+}
@@ -1,7 +1,8 @@
 #pragma once
 
-#include <glm\glm.hpp>
+#include <glm/glm.hpp>
 #include "PlanetInfo.h"
+#include "OrbitalElements.h"
 
 class PlanetMovementSystem
 {
@@ -9,5 +10,31 @@ public:
 	static glm::mat4 OrbitAroundSun(double time, const PlanetInfo& child);
 	static glm::mat4 OrbitAroundParent(double time, const PlanetInfo& child, const glm::vec3& parentPos);
 	static glm::mat4 SimulateRing(double time, const PlanetInfo& ring, const glm::vec3& parentPos);
-};
 
+	// Transforms the unit circle mesh into the orbit's ellipse
+	static glm::mat4 OrbitPath(const PlanetInfo& child);
+
+	// Batched variant of OrbitAroundSun() and OrbitAroundParent(). Writes the
+	// model matrices of all bodies in <elements> to <out> (elements.Count() entries).
+	static void OrbitBatch(double time, const OrbitalElements& elements, glm::mat4* out);
+
+	// The two steps of OrbitBatch(): Model matrices relative to the parent and
+	// moving the children to their parents position.
+	static void ComputeLocalOrbits(double time, const OrbitalElements& elements, glm::mat4* out);
+
+	// ComputeLocalOrbits() for the bodies [begin, end) only. Disjoint ranges can
+	// be computed concurrently.
+	static void ComputeLocalOrbits(double time, const OrbitalElements& elements, glm::mat4* out, size_t begin, size_t end);
+	static void ResolveParents(const OrbitalElements& elements, glm::mat4* out);
+
+	// Positions of many bodies at many times, e.g. for plots or lookup tables.
+	// <bodyMask> has one entry per body in <elements>, nonzero selects the body
+	// (nullptr selects all). The selected bodies get consecutive slots in index
+	// order, the position of slot s at times[t] is written to out*[s * timeCount + t].
+	// Positions include the parents offsets. Runs in parallel on the shared thread pool.
+	static void QueryPositions(const double* times, size_t timeCount, const OrbitalElements& elements,
+		const unsigned char* bodyMask, double* outX, double* outY, double* outZ);
+
+	// QueryPositions() for one body at one time, without the thread pool
+	static glm::dvec3 QueryPosition(double time, const OrbitalElements& elements, size_t body);
+};
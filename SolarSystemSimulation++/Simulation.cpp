@@ -0,0 +1,369 @@
+#include "Simulation.h"
+#include "PlanetMovementSystem.h"
+#include "KeplerPropagator.h"
+#include "jge/ThreadPool.h"
+#include "jge/Measurement.h"
+
+#include <random>
+#include <stdexcept>
+#include <stdio.h>
+#include <math.h>
+
+using namespace jge;
+using namespace glm;
+
+// All bodies with their properties, mapped from the catalog file
+const char* CATALOG_FILE = "catalog/bodies.bin";
+BodyCatalog catalog;
+
+OrbitalElements orbitalElements;
+glm::mat4 bodyMatrices[bEnd];
+
+TransformHierarchy transforms;
+int ringNode;
+int orbitNodes[8];
+double transformsTime = NAN;		// NAN forces the next Update() to recompute
+
+NBodySystem nbody;
+bool nbodyEnabled = false;
+int nbodyBeltBodies = 0;
+
+JplEphemeris ephemeris;
+bool ephemerisEnabled = false;
+
+SimulationRecorder recorder;
+SimulationPlayer player;
+bool playbackEnabled = false;
+
+OrbitalElements asteroidElements;
+std::vector<glm::vec4> asteroidColors;
+bool asteroidsEnabled = true;
+
+const char* eventSearchList = "Solar eclipses\0Lunar eclipses\0Planet conjunctions\0";
+
+
+/**
+ * Loads the body catalog and sets up the orbits of all simulated bodies. Needs
+ * no OpenGL context, called once on start in both windowed and headless mode.
+ */
+void InitSimulation(const char* catalogPath, int asteroidCount)
+{
+	Stopwatch sw;
+	sw.Start();
+
+	if (!catalog.Open(catalogPath))
+		throw std::runtime_error("Failed to load the body catalog, see the console for details.");
+	if (catalog.Count() < bEnd)
+		throw std::runtime_error("The body catalog has to start with the sun, the planets and their moons.");
+
+	// Orbits of all bodies in one structure for the batched update
+	catalog.LoadElements(orbitalElements, bSun, bEnd);
+
+	// Moons and the ring only follow their parents position, not its rotation
+	for (int i = bSun; i < bEnd; ++i)
+		transforms.Add(orbitalElements.parents[i], mat4(1.0f), TransformInheritance::TRANSLATION);
+	ringNode = transforms.Add(bSaturn, PlanetMovementSystem::SimulateRing(0.0, saturnRing, vec3(0.0f)), TransformInheritance::TRANSLATION);
+
+	// The orbit lines never move, they are computed once by the first Update()
+	for (int i = 0; i < 8; ++i)
+		orbitNodes[i] = transforms.Add(TransformHierarchy::NO_PARENT, PlanetMovementSystem::OrbitPath(catalog.GetInfo(bMercury + i)));
+
+	// Minor bodies in the catalog take the place of the random belt
+	if (catalog.Count() > bEnd)
+		LoadMinorBodies();
+	else CreateAsteroidBelt(asteroidCount);
+
+	sw.Stop();
+	printf("Loaded %d bodies in %3.3f seconds.\r\n", (int)(orbitalElements.Count() + asteroidElements.Count()), sw.GetElapsedTime());
+}
+
+
+/**
+ * Tries to map the JPL ephemeris, the movement falls back to the kepler orbits
+ * if the file is missing.
+ */
+void InitEphemeris(const char* path)
+{
+	ephemerisEnabled = ephemeris.Open(path);
+}
+
+
+/**
+ * Opens a recording for playback. It has to contain the positions of all
+ * bodies of the Bodies enum.
+ */
+bool InitPlayback(const char* path)
+{
+	if (!player.Open(path))
+		return false;
+
+	if (player.GetBodyCount() != bEnd)
+	{
+		printf("%s has %d bodies instead of %d\r\n", path, player.GetBodyCount(), (int)bEnd);
+		player.Close();
+		return false;
+	}
+	playbackEnabled = true;
+	return true;
+}
+
+
+/**
+ * Advances the simulation to <time> (in days) and writes the results to <state>.
+ * Touches no rendering objects, it runs on the simulation thread or in headless mode.
+ * Returns false if nothing changed since the last call (e.g. while paused),
+ * <state> is left alone then.
+ */
+bool Update(double time, SimulationState& state)
+{
+	// While paused nothing is marked dirty, the last state stays valid
+	if (time == transformsTime)
+		return false;
+
+	// Update the planets & moons position, all bodies in one pass
+	PlanetMovementSystem::ComputeLocalOrbits(time, orbitalElements, bodyMatrices);
+
+	// In N-body mode the planets positions come from the gravity simulation,
+	// the moons stay on their circles around them.
+	state.nbodyStepTime = 0.0;
+	state.nbodyCount = 0;
+	if (nbodyEnabled && !playbackEnabled)
+	{
+		Stopwatch sw;
+		sw.Start();
+		nbody.Advance(time);
+		nbody.WriteTranslations(bodyMatrices, bNeptune + 1, bSun);
+		sw.Stop();
+		state.nbodyStepTime = sw.GetElapsedTime();
+		state.nbodyCount = (int)nbody.Count();
+	}
+
+	// The ephemeris replaces the positions of all bodies it covers
+	if (ephemerisEnabled && !playbackEnabled)
+		ApplyEphemeris(time);
+
+	// A replay replaces all positions, only the rotations come from the orbits.
+	// Otherwise the positions are recorded, if a recording is running.
+	vec3 positions[bEnd];
+	if (playbackEnabled)
+	{
+		player.Sample(time, positions);
+		for (int i = bSun; i < bEnd; ++i)
+			bodyMatrices[i][3] = vec4(positions[i], 1.0f);
+	}
+	else if (recorder.IsOpen())
+	{
+		for (int i = bSun; i < bEnd; ++i)
+			positions[i] = vec3(bodyMatrices[i][3]);
+		recorder.AddFrame(time, positions);
+	}
+	state.recordedFrames = recorder.GetFrameCount();
+	state.recordedBytes = recorder.GetSize();
+
+	// Moons, the ring and anything else attached follow their parents
+	for (int i = bSun; i < bEnd; ++i)
+		transforms.SetLocal(i, bodyMatrices[i]);
+	transforms.Update();
+	transformsTime = time;
+
+	state.time = time;
+	state.nodes.resize(transforms.Count());
+	for (size_t i = 0; i < transforms.Count(); ++i)
+		state.nodes[i] = transforms.GetWorld((int)i);
+
+	// The asteroids are independent of each other, split them across the worker threads
+	state.asteroidsValid = asteroidsEnabled;
+	state.asteroidUpdateTime = 0.0;
+	if (asteroidsEnabled)
+	{
+		Stopwatch sw;
+		sw.Start();
+		state.asteroids.resize(asteroidElements.Count());
+		mat4* instances = state.asteroids.data();
+		ThreadPool::Shared().ParallelFor(asteroidElements.Count(), 4096, [&](size_t begin, size_t end)
+		{
+			PlanetMovementSystem::ComputeLocalOrbits(time, asteroidElements, instances, begin, end);
+		});
+		sw.Stop();
+		state.asteroidUpdateTime = sw.GetElapsedTime();
+	}
+	return true;
+}
+
+
+/**
+ * Overwrites the translations in <bodyMatrices> with the positions from the
+ * JPL ephemeris, relative to the parent like ComputeLocalOrbits(). Simulation
+ * time 0 is J2000. Each body's distance is scaled to its scene distance.
+ */
+void ApplyEphemeris(double time)
+{
+	const double julianDate = JplEphemeris::J2000 + time;
+	const double c = cos(eclipticObliquity);
+	const double s = sin(eclipticObliquity);
+
+	for (int i = bMercury; i < bEnd; ++i)
+	{
+		const int id = catalog.GetEphemerisId(i);
+		if (id < 0 || catalog.GetMeanDistanceKm(i) <= 0.0)
+			continue;
+
+		dvec3 p = ephemeris.HeliocentricPosition(id, julianDate);
+		p = p * (orbitalElements.semiMajorAxis[i] / catalog.GetMeanDistanceKm(i));
+
+		// Equatorial -> ecliptic, then the scene axes (x, north, -y)
+		double y = c * p.y + s * p.z;
+		double z = -s * p.y + c * p.z;
+		bodyMatrices[i][3] = vec4((float)p.x, (float)z, (float)-y, 1.0f);
+	}
+}
+
+
+/**
+ * Creates <count> asteroids on random kepler orbits between mars and jupiter.
+ * Periods follow kepler's third law relative to earth, so the inner belt
+ * overtakes the outer one.
+ */
+void CreateAsteroidBelt(int count)
+{
+	const float TWO_PI = 6.2831853f;
+
+	// Same seed, same belt
+	std::mt19937 rng(1801);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	asteroidElements = OrbitalElements();
+	asteroidColors.resize(count);
+	vec4* colors = asteroidColors.data();
+	for (int i = 0; i < count; ++i)
+	{
+		float dist = (42.0f + 10.0f * unit(rng)) * SF;
+		float rtt = 365.0f * powf(dist / (28.0f * SF), 1.5f);
+		float size = (0.05f + 0.15f * unit(rng) * unit(rng)) * SF;
+
+		PlanetInfo info(
+			size,
+			rtt,
+			dist,
+			0.2f + 2.0f * unit(rng),		// tumbling
+			TWO_PI * unit(rng),
+			0.15f * unit(rng) * unit(rng),	// mostly flat
+			0.2f * unit(rng) * unit(rng),
+			TWO_PI * unit(rng),
+			TWO_PI * unit(rng),
+			TWO_PI * unit(rng));
+		asteroidElements.Add(info);
+
+		// Grey to brownish rock
+		float grey = 0.35f + 0.3f * unit(rng);
+		float tint = 0.1f * unit(rng);
+		colors[i] = vec4(grey + tint, grey, grey - tint, 1.0f);
+	}
+	asteroidsEnabled = count > 0;
+}
+
+
+/**
+ * Uses the catalog bodies behind the planets and moons as asteroids. They
+ * orbit the sun, the asteroid update doesn't resolve other parents.
+ */
+void LoadMinorBodies()
+{
+	asteroidElements = OrbitalElements();
+	catalog.LoadElements(asteroidElements, bEnd, catalog.Count());
+
+	// The catalog has no colors, vary the rock a bit like the random belt
+	std::mt19937 rng(1801);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	const int count = (int)asteroidElements.Count();
+	asteroidColors.resize(count);
+	vec4* colors = asteroidColors.data();
+	for (int i = 0; i < count; ++i)
+	{
+		float grey = 0.35f + 0.3f * unit(rng);
+		colors[i] = vec4(grey, grey, grey, 1.0f);
+	}
+	asteroidsEnabled = count > 0;
+}
+
+
+
+/**
+ * (Re)starts the N-body simulation from the circular orbits at <time>.
+ * The planets get the velocity of a circular orbit around the sun, the sun
+ * gets the opposite momentum so the barycenter stays at rest.
+ * <nbodyBeltBodies> light bodies between mars and jupiter are added behind the planets.
+ */
+void ResetNBody(double time)
+{
+	PlanetMovementSystem::ComputeLocalOrbits(time, orbitalElements, bodyMatrices);
+
+	dvec3 positions[bEnd];
+	dvec3 velocities[bEnd];
+	dvec3 momentum(0.0);
+	for (int i = bMercury; i <= bNeptune; ++i)
+	{
+		dvec3 p, q;
+		KeplerPropagator::PerifocalBasis(catalog.GetInfo(i), p, q);
+		dvec3 normal = cross(p, q);
+		positions[i] = dvec3(vec3(bodyMatrices[i][3]));
+		velocities[i] = normalize(cross(normal, positions[i])) * sqrt(sunGravParameter / length(positions[i]));
+		momentum += velocities[i] * catalog.GetMassRatio(i);
+	}
+
+	nbody.Clear();
+	nbody.SetTime(time);
+	nbody.AddBody(sunGravParameter, dvec3(0.0), -momentum);
+	for (int i = bMercury; i <= bNeptune; ++i)
+		nbody.AddBody(sunGravParameter * catalog.GetMassRatio(i), positions[i], velocities[i]);
+
+	// Same seed, same belt
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	for (int i = 0; i < nbodyBeltBodies; ++i)
+	{
+		double r = 42.0 * SF + 10.0 * SF * unit(rng);
+		double a = 6.283185307179586 * unit(rng);
+		double h = 0.5 * (unit(rng) - 0.5);
+		double v = sqrt(sunGravParameter / r);
+		nbody.AddBody(sunGravParameter * 1e-12, dvec3(r * cos(a), h, -r * sin(a)), dvec3(-v * sin(a), 0.0, -v * cos(a)));
+	}
+}
+
+
+/**
+ * Searches the orbits of the bodies in [begin, end] days for events, <search>
+ * is an entry of <eventSearchList>. Thread safe, the orbits don't change.
+ */
+std::vector<AstronomicalEvent> FindEvents(int search, double begin, double end)
+{
+	EventFinder finder(orbitalElements);
+	std::vector<AstronomicalEvent> found;
+	if (search == 0)
+		finder.FindEclipses(bEarth, bSun, bMoon, begin, end, found);
+	else if (search == 1)
+		finder.FindEclipses(bMoon, bSun, bEarth, begin, end, found);
+	else
+	{
+		// Every pair of the sun and the planets in the sky of the earth
+		const int sky[] = { bSun, bMercury, bVenus, bMars, bJupiter, bSaturn, bUranus, bNeptune };
+		const int count = sizeof(sky) / sizeof(sky[0]);
+		for (int i = 0; i < count; ++i)
+		{
+			for (int j = i + 1; j < count; ++j)
+				finder.FindConjunctions(bEarth, sky[i], sky[j], glm::radians(1.0), begin, end, found);
+		}
+	}
+	return found;
+}
+
+void FormatEvent(const AstronomicalEvent& event, char* buffer, size_t size)
+{
+	static const char* typeNames[] = { "Conjunction", "Partial eclipse", "Annular eclipse", "Total eclipse" };
+	if (event.type == EVENT_CONJUNCTION)
+		snprintf(buffer, size, "%9.1f days  %-16s %s, %s (%.2f deg)", event.time, typeNames[event.type],
+			catalog.GetName(event.target), catalog.GetName(event.other), glm::degrees(event.separation));
+	else snprintf(buffer, size, "%9.1f days  %-16s %s by %s (%.1f h)", event.time, typeNames[event.type],
+		catalog.GetName(event.target), catalog.GetName(event.other), (event.end - event.begin) * 24.0);
+}
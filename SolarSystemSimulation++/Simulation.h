@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+#include "PlanetData.h"
+#include "OrbitalElements.h"
+#include "BodyCatalog.h"
+#include "NBodySystem.h"
+#include "JplEphemeris.h"
+#include "SimulationRecording.h"
+#include "EventFinder.h"
+#include "jge/TransformHierarchy.h"
+
+/**
+* The simulated bodies, shared by the windowed and the headless mode. Nothing
+* in here needs an OpenGL context or a window, the headless build (see
+* CMakeLists.txt) links it without either.
+*/
+
+// Everything the renderer needs from one simulation step
+struct SimulationState
+{
+	double time = 0.0;				// simulation time in days
+	double wallTime = 0.0;			// glfwGetTime() of the step
+	std::vector<glm::mat4> nodes;		// world matrices of <transforms>
+	std::vector<glm::mat4> asteroids;
+	bool asteroidsValid = false;
+	size_t recordedFrames = 0;
+	uint64_t recordedBytes = 0;
+	int nbodyCount = 0;
+	double nbodyStepTime = 0.0;
+	double asteroidUpdateTime = 0.0;
+};
+
+// All bodies with their properties, mapped from the catalog file
+extern const char* CATALOG_FILE;
+extern BodyCatalog catalog;
+
+// Orbits of all bodies (SoA) and the matrices calculated from them
+extern OrbitalElements orbitalElements;
+extern glm::mat4 bodyMatrices[bEnd];
+
+// World transforms of the bodies, the saturn ring and the orbit lines. The
+// first bEnd nodes are the bodies, so node and body index are the same.
+extern jge::TransformHierarchy transforms;
+extern int ringNode;
+extern int orbitNodes[8];
+extern double transformsTime;
+
+// Gravity simulation of the sun and planets (optional)
+extern NBodySystem nbody;
+extern bool nbodyEnabled;
+extern int nbodyBeltBodies;
+
+// Planet positions from a JPL ephemeris file (optional)
+extern JplEphemeris ephemeris;
+extern bool ephemerisEnabled;
+
+// Recording of the body positions, replaying it drives the simulation (optional)
+extern SimulationRecorder recorder;
+extern SimulationPlayer player;
+extern bool playbackEnabled;
+
+// Asteroid belt between mars and jupiter, the windowed mode draws it in these colors
+extern OrbitalElements asteroidElements;
+extern std::vector<glm::vec4> asteroidColors;
+extern bool asteroidsEnabled;
+
+// Names of the searches of FindEvents(), zero separated
+extern const char* eventSearchList;
+
+void InitSimulation(const char* catalogPath, int asteroidCount);
+void InitEphemeris(const char* path);
+bool InitPlayback(const char* path);
+bool Update(double simTime, SimulationState& state);
+void ApplyEphemeris(double simTime);
+void CreateAsteroidBelt(int count);
+void LoadMinorBodies();
+void ResetNBody(double simTime);
+std::vector<AstronomicalEvent> FindEvents(int search, double begin, double end);
+void FormatEvent(const AstronomicalEvent& event, char* buffer, size_t size);
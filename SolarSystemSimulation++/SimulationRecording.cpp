@@ -0,0 +1,455 @@
+#include "SimulationRecording.h"
+
+#include <string.h>
+#include <math.h>
+
+static const char MAGIC[4] = { 'S', 'S', 'R', 'C' };
+static const uint32_t VERSION = 1;
+
+struct RecordingHeader
+{
+	char magic[4];					// "SSRC"
+	uint32_t version;
+	uint32_t bodyCount;
+	uint32_t framesPerBlock;
+	double quantum;
+};
+
+// Last bytes of the file
+struct RecordingFooter
+{
+	uint64_t indexOffset;
+	uint64_t blockCount;
+	uint64_t frameCount;
+	char magic[4];
+	uint32_t padding;
+};
+
+static int32_t Quantize(float value, double quantum)
+{
+	double q = floor(value / quantum + 0.5);
+	if (q > 2147483647.0)
+		q = 2147483647.0;
+	if (q < -2147483647.0)
+		q = -2147483647.0;
+	return (int32_t)q;
+}
+
+static void WriteVarint(std::vector<unsigned char>& out, int64_t value)
+{
+	uint64_t v = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);	// zigzag, small magnitudes -> few bytes
+	while (v >= 0x80)
+	{
+		out.push_back((unsigned char)(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((unsigned char)v);
+}
+
+// Returns false if the varint runs past <end>
+static bool ReadVarint(const unsigned char*& p, const unsigned char* end, int64_t& value)
+{
+	uint64_t v = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		if (p >= end)
+			return false;
+		unsigned char byte = *p++;
+		v |= (uint64_t)(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0)
+		{
+			value = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+			return true;
+		}
+	}
+	return false;
+}
+
+template <typename T>
+static void WriteRaw(std::vector<unsigned char>& out, const T& value)
+{
+	const unsigned char* p = (const unsigned char*)&value;
+	out.insert(out.end(), p, p + sizeof(T));
+}
+
+
+SimulationRecorder::SimulationRecorder()
+	: file(nullptr)
+	, bodyCount(0)
+	, quantum(1.0)
+	, frameCount(0)
+	, size(0)
+{
+	memset(&blockInfo, 0, sizeof(blockInfo));
+}
+
+SimulationRecorder::~SimulationRecorder()
+{
+	Close();
+}
+
+bool SimulationRecorder::Open(const char* path, int bodyCount, double quantum)
+{
+	Close();
+
+	if (bodyCount <= 0 || !(quantum > 0.0))
+		return false;
+
+	file = fopen(path, "wb");
+	if (!file)
+	{
+		printf("Can't open %s for writing\r\n", path);
+		return false;
+	}
+
+	this->bodyCount = bodyCount;
+	this->quantum = quantum;
+	frameCount = 0;
+	index.clear();
+	block.clear();
+	blockInfo.frameCount = 0;
+
+	RecordingHeader header;
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.bodyCount = bodyCount;
+	header.framesPerBlock = FRAMES_PER_BLOCK;
+	header.quantum = quantum;
+	fwrite(&header, sizeof(header), 1, file);
+	size = sizeof(header);
+	return true;
+}
+
+void SimulationRecorder::Close()
+{
+	if (!file)
+		return;
+
+	FlushBlock();
+
+	// The index is read in place, align it
+	const char padding[8] = {};
+	const size_t alignment = (size_t)((8 - size % 8) % 8);
+	fwrite(padding, 1, alignment, file);
+	size += alignment;
+
+	RecordingFooter footer;
+	footer.indexOffset = size;
+	footer.blockCount = index.size();
+	footer.frameCount = frameCount;
+	memcpy(footer.magic, MAGIC, sizeof(MAGIC));
+	footer.padding = 0;
+
+	if (!index.empty())
+		fwrite(index.data(), sizeof(BlockInfo), index.size(), file);
+	fwrite(&footer, sizeof(footer), 1, file);
+	size += index.size() * sizeof(BlockInfo) + sizeof(footer);
+
+	if (ferror(file))
+		printf("Writing the recording failed\r\n");
+	fclose(file);
+	file = nullptr;
+}
+
+bool SimulationRecorder::IsOpen() const
+{
+	return file != nullptr;
+}
+
+size_t SimulationRecorder::GetFrameCount() const
+{
+	return frameCount;
+}
+
+uint64_t SimulationRecorder::GetSize() const
+{
+	return size + block.size();
+}
+
+void SimulationRecorder::AddFrame(double time, const glm::vec3* positions)
+{
+	if (!file)
+		return;
+	if (blockInfo.frameCount > 0 && !(time > blockInfo.lastTime))
+		return;
+	if (blockInfo.frameCount == 0 && !index.empty() && !(time > index.back().lastTime))
+		return;
+
+	const size_t values = bodyCount * 3;
+	std::vector<int32_t>& older = history[0];
+	std::vector<int32_t>& newer = history[1];
+	older.resize(values);
+	newer.resize(values);
+
+	WriteRaw(block, time);
+	if (blockInfo.frameCount == 0)
+	{
+		// Keyframe, absolute values
+		blockInfo.firstTime = time;
+		for (size_t v = 0; v < values; ++v)
+		{
+			newer[v] = Quantize(positions[v / 3][v % 3], quantum);
+			WriteRaw(block, newer[v]);
+		}
+	}
+	else
+	{
+		// Residual to the constant (second frame) or linear prediction
+		const bool linear = blockInfo.frameCount > 1;
+		for (size_t v = 0; v < values; ++v)
+		{
+			int32_t q = Quantize(positions[v / 3][v % 3], quantum);
+			int64_t predicted = linear ? 2 * (int64_t)newer[v] - older[v] : newer[v];
+			WriteVarint(block, q - predicted);
+			older[v] = newer[v];
+			newer[v] = q;
+		}
+	}
+
+	blockInfo.lastTime = time;
+	++blockInfo.frameCount;
+	++frameCount;
+
+	if (blockInfo.frameCount == FRAMES_PER_BLOCK)
+		FlushBlock();
+}
+
+void SimulationRecorder::FlushBlock()
+{
+	if (blockInfo.frameCount == 0)
+		return;
+
+	blockInfo.offset = size;
+	blockInfo.byteCount = (uint32_t)block.size();
+	fwrite(block.data(), 1, block.size(), file);
+	size += block.size();
+	index.push_back(blockInfo);
+
+	block.clear();
+	blockInfo.frameCount = 0;
+}
+
+
+SimulationPlayer::SimulationPlayer()
+	: bodyCount(0)
+	, quantum(1.0)
+	, frameCount(0)
+	, index(nullptr)
+	, blockCount(0)
+	, block((size_t)-1)
+	, frame(0)
+	, next(nullptr)
+	, end(nullptr)
+{
+	times[0] = times[1] = 0.0;
+}
+
+bool SimulationPlayer::Open(const char* path)
+{
+	Close();
+
+	if (!file.Open(path))
+	{
+		printf("Can't open recording %s\r\n", path);
+		return false;
+	}
+
+	const unsigned char* data = file.GetData();
+	const uint64_t fileSize = file.GetSize();
+	RecordingHeader header;
+	RecordingFooter footer;
+	if (fileSize < sizeof(header) + sizeof(footer))
+	{
+		printf("%s is too small to be a recording\r\n", path);
+		Close();
+		return false;
+	}
+	memcpy(&header, data, sizeof(header));
+	memcpy(&footer, data + fileSize - sizeof(footer), sizeof(footer));
+
+	if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION || header.bodyCount == 0 || !(header.quantum > 0.0))
+	{
+		printf("%s is no recording of version %u\r\n", path, VERSION);
+		Close();
+		return false;
+	}
+
+	// A recording that wasn't closed has no index
+	const uint64_t indexEnd = fileSize - sizeof(footer);
+	if (memcmp(footer.magic, MAGIC, sizeof(MAGIC)) != 0 || footer.blockCount == 0 || footer.indexOffset % 8 != 0
+		|| footer.indexOffset > indexEnd || footer.blockCount != (indexEnd - footer.indexOffset) / sizeof(BlockInfo))
+	{
+		printf("%s wasn't closed properly or is empty\r\n", path);
+		Close();
+		return false;
+	}
+
+	index = (const BlockInfo*)(data + footer.indexOffset);
+	blockCount = (size_t)footer.blockCount;
+
+	// Every block starts with a full keyframe, Sample() reads the next one directly
+	const uint64_t keyframeBytes = sizeof(double) + (uint64_t)header.bodyCount * 3 * sizeof(int32_t);
+	for (size_t i = 0; i < blockCount; ++i)
+	{
+		const BlockInfo& b = index[i];
+		if (b.frameCount == 0 || b.offset > footer.indexOffset || b.byteCount > footer.indexOffset - b.offset
+			|| b.byteCount < keyframeBytes)
+		{
+			printf("%s has a damaged index\r\n", path);
+			Close();
+			return false;
+		}
+	}
+
+	bodyCount = header.bodyCount;
+	quantum = header.quantum;
+	frameCount = (size_t)footer.frameCount;
+	history[0].assign(bodyCount * 3, 0);
+	history[1].assign(bodyCount * 3, 0);
+	keyframe.assign(bodyCount * 3, 0);
+	block = (size_t)-1;
+
+	printf("Loaded recording %s, %d frames of %d bodies, days %.1f - %.1f\r\n",
+		path, (int)frameCount, bodyCount, GetStartTime(), GetEndTime());
+	return true;
+}
+
+void SimulationPlayer::Close()
+{
+	file.Close();
+	index = nullptr;
+	blockCount = 0;
+	frameCount = 0;
+	bodyCount = 0;
+	block = (size_t)-1;
+}
+
+bool SimulationPlayer::IsOpen() const
+{
+	return blockCount > 0;
+}
+
+int SimulationPlayer::GetBodyCount() const
+{
+	return bodyCount;
+}
+
+size_t SimulationPlayer::GetFrameCount() const
+{
+	return frameCount;
+}
+
+double SimulationPlayer::GetStartTime() const
+{
+	return blockCount > 0 ? index[0].firstTime : 0.0;
+}
+
+double SimulationPlayer::GetEndTime() const
+{
+	return blockCount > 0 ? index[blockCount - 1].lastTime : 0.0;
+}
+
+void SimulationPlayer::StartBlock(size_t b)
+{
+	block = b;
+	frame = 0;
+	next = file.GetData() + index[b].offset;
+	end = next + index[b].byteCount;
+	DecodeFrame();
+}
+
+bool SimulationPlayer::DecodeFrame()
+{
+	if (frame >= index[block].frameCount || end - next < (ptrdiff_t)sizeof(double))
+		return false;
+
+	const size_t values = bodyCount * 3;
+	std::vector<int32_t>& older = history[0];
+	std::vector<int32_t>& newer = history[1];
+
+	times[0] = times[1];
+	memcpy(&times[1], next, sizeof(double));
+	next += sizeof(double);
+
+	if (frame == 0)
+	{
+		if ((size_t)(end - next) < values * sizeof(int32_t))
+			return false;
+		memcpy(newer.data(), next, values * sizeof(int32_t));
+		next += values * sizeof(int32_t);
+		older = newer;
+		times[0] = times[1];
+	}
+	else
+	{
+		const bool linear = frame > 1;
+		for (size_t v = 0; v < values; ++v)
+		{
+			int64_t residual;
+			if (!ReadVarint(next, end, residual))
+				return false;
+			int64_t predicted = linear ? 2 * (int64_t)newer[v] - older[v] : newer[v];
+			older[v] = newer[v];
+			newer[v] = (int32_t)(predicted + residual);
+		}
+	}
+
+	++frame;
+	return true;
+}
+
+void SimulationPlayer::Sample(double time, glm::vec3* out)
+{
+	if (!IsOpen())
+		return;
+
+	if (time < GetStartTime())
+		time = GetStartTime();
+	if (time > GetEndTime())
+		time = GetEndTime();
+
+	// Last block starting at or before <time>
+	size_t lo = 0, hi = blockCount;
+	while (hi - lo > 1)
+	{
+		size_t mid = (lo + hi) / 2;
+		if (index[mid].firstTime <= time)
+			lo = mid;
+		else hi = mid;
+	}
+
+	// Keep decoding forward if possible, otherwise start at the keyframe
+	if (block != lo || (frame > 1 && time < times[0]))
+		StartBlock(lo);
+	while (times[1] < time && frame < index[block].frameCount)
+	{
+		if (!DecodeFrame())
+			break;
+	}
+
+	// Between the last frame of the block and the keyframe of the next one
+	const std::vector<int32_t>* from = &history[0];
+	const std::vector<int32_t>* to = &history[1];
+	double t0 = times[0], t1 = times[1];
+	if (times[1] < time && block + 1 < blockCount)
+	{
+		const size_t values = bodyCount * 3;
+		const unsigned char* p = file.GetData() + index[block + 1].offset;
+		memcpy(&t1, p, sizeof(double));
+		memcpy(keyframe.data(), p + sizeof(double), values * sizeof(int32_t));
+		from = &history[1];
+		to = &keyframe;
+		t0 = times[1];
+	}
+
+	const float alpha = t1 > t0 ? (float)((time - t0) / (t1 - t0)) : 1.0f;
+	for (int i = 0; i < bodyCount; ++i)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			double a = (*from)[i * 3 + c] * quantum;
+			double b = (*to)[i * 3 + c] * quantum;
+			out[i][c] = (float)(a + (b - a) * alpha);
+		}
+	}
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <glm/glm.hpp>
+#include "jge/MappedFile.h"
+
+/**
+* Recording of body positions over time, e.g. of an expensive N-body run.
+*
+* Positions are quantized to integers and stored in blocks of up to
+* FRAMES_PER_BLOCK frames. The first frame of a block is a keyframe with
+* the absolute values, every following value is stored as the difference to
+* its linear prediction from the two frames before, as zigzag varint. Smooth
+* orbits leave residuals of a byte or two. An index of the blocks at the end
+* of the file lets the player jump to any time by decoding one keyframe and
+* at most FRAMES_PER_BLOCK - 1 deltas.
+*/
+class SimulationRecorder
+{
+public:
+	static const uint32_t FRAMES_PER_BLOCK = 64;
+
+	SimulationRecorder();
+	~SimulationRecorder();
+
+	// Starts a new recording of <bodyCount> bodies. <quantum> is the resolution
+	// of the stored positions in scene units.
+	bool Open(const char* path, int bodyCount, double quantum = 1e-5);
+
+	// Writes the last block and the index. The file is unusable without it.
+	void Close();
+	bool IsOpen() const;
+
+	// Appends the positions of all bodies at <time>. Frames that aren't
+	// later than the last one (e.g. while paused) are skipped.
+	void AddFrame(double time, const glm::vec3* positions);
+
+	size_t GetFrameCount() const;
+	uint64_t GetSize() const;			// bytes written so far
+
+private:
+	SimulationRecorder(const SimulationRecorder&) = delete;
+	SimulationRecorder& operator=(const SimulationRecorder&) = delete;
+
+	struct BlockInfo
+	{
+		double firstTime;
+		double lastTime;
+		uint64_t offset;
+		uint32_t frameCount;
+		uint32_t byteCount;
+	};
+
+	void FlushBlock();
+
+	FILE* file;
+	int bodyCount;
+	double quantum;
+	size_t frameCount;
+	uint64_t size;
+
+	std::vector<unsigned char> block;	// encoded frames of the open block
+	BlockInfo blockInfo;
+	std::vector<BlockInfo> index;
+	std::vector<int32_t> history[2];	// quantized positions of the last two frames, [1] is the newest
+
+	friend class SimulationPlayer;
+};
+
+
+/**
+* Plays a recording of SimulationRecorder back. The file is memory mapped,
+* positions at any time are interpolated between the two enclosing frames.
+* Playing forward continues decoding where the last call stopped.
+*/
+class SimulationPlayer
+{
+public:
+	SimulationPlayer();
+
+	// Maps the recording and checks its header and index, prints the reason on failure
+	bool Open(const char* path);
+	void Close();
+	bool IsOpen() const;
+
+	int GetBodyCount() const;
+	size_t GetFrameCount() const;
+	double GetStartTime() const;
+	double GetEndTime() const;
+
+	// Writes the positions of all bodies at <time> (clamped to the recording) to <out>
+	void Sample(double time, glm::vec3* out);
+
+private:
+	SimulationPlayer(const SimulationPlayer&) = delete;
+	SimulationPlayer& operator=(const SimulationPlayer&) = delete;
+
+	typedef SimulationRecorder::BlockInfo BlockInfo;
+
+	void StartBlock(size_t block);
+	bool DecodeFrame();
+
+	jge::MappedFile file;
+	int bodyCount;
+	double quantum;
+	size_t frameCount;
+	const BlockInfo* index;
+	size_t blockCount;
+
+	// Decoder position
+	size_t block;
+	uint32_t frame;						// frames decoded in <block>
+	const unsigned char* next;
+	const unsigned char* end;
+	double times[2];					// of the last two decoded frames, [1] is the newest
+	std::vector<int32_t> history[2];
+	std::vector<int32_t> keyframe;		// of the next block, between the blocks
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace jge
+{
+	// Growable heap array with an aligned base address, meant for structure-of-arrays
+	// data that is processed with SIMD instructions. Only for plain data types,
+	// new elements are zero initialized.
+	template<typename T, size_t ALIGNMENT = 64>
+	class AlignedArray
+	{
+	public:
+		AlignedArray()
+			: data(nullptr)
+			, count(0)
+			, capacity(0)
+		{
+		}
+
+		~AlignedArray()
+		{
+			Free(data);
+		}
+
+		void Resize(size_t n)
+		{
+			if (n > capacity)
+				Reserve(n > capacity * 2 ? n : capacity * 2);
+			if (n > count)
+				memset(data + count, 0, (n - count) * sizeof(T));
+			count = n;
+		}
+
+		void Reserve(size_t n)
+		{
+			if (n <= capacity)
+				return;
+
+			T* mem = (T*)Allocate(n * sizeof(T));
+			if (count > 0)
+				memcpy(mem, data, count * sizeof(T));
+			Free(data);
+
+			data = mem;
+			capacity = n;
+		}
+
+		void PushBack(const T& value)
+		{
+			Resize(count + 1);
+			data[count - 1] = value;
+		}
+
+		void Clear()
+		{
+			count = 0;
+		}
+
+		size_t Size() const { return count; }
+		T* Data() { return data; }
+		const T* Data() const { return data; }
+		T& operator[](size_t i) { return data[i]; }
+		const T& operator[](size_t i) const { return data[i]; }
+
+	private:
+		AlignedArray(const AlignedArray&) = delete;
+		AlignedArray& operator=(const AlignedArray&) = delete;
+
+		static void* Allocate(size_t bytes)
+		{
+#ifdef _WIN32
+			return _aligned_malloc(bytes, ALIGNMENT);
+#else
+			void* mem = nullptr;
+			return posix_memalign(&mem, ALIGNMENT, bytes) == 0 ? mem : nullptr;
+#endif
+		}
+
+		static void Free(void* mem)
+		{
+#ifdef _WIN32
+			_aligned_free(mem);
+#else
+			free(mem);
+#endif
+		}
+
+		T* data;
+		size_t count;
+		size_t capacity;
+	};
+}
@@ -67,8 +67,9 @@ namespace jge
 	void FramebufferTools::DeleteFramebufferCube(CubeFramebuffer& fb)
 	{
 		glDeleteTextures(1, &fb.colorTex);
-		glDeleteRenderbuffers(1, &fb.depthTex);
+		glDeleteTextures(1, &fb.depthTex);
 		glDeleteFramebuffers(6, (GLuint*)&fb.handle);
+		glDeleteFramebuffers(1, &fb.layered);
 	}
 
 	GLuint FramebufferTools::MakeCubeTexture_Color(GLsizei size)
@@ -136,6 +137,15 @@ namespace jge
 			GLenum result = glCheckFramebufferStatus(GL_FRAMEBUFFER);
 			assert(result == GL_FRAMEBUFFER_COMPLETE && "Framebuffer is not complete.\n");
 		}
+
+		glGenFramebuffers(1, &fb.layered);
+		glBindFramebuffer(GL_FRAMEBUFFER, fb.layered);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, colorTexture, 0);
+		if (depthTexture) {
+			glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0);
+		}
+		GLenum result = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		assert(result == GL_FRAMEBUFFER_COMPLETE && "Layered framebuffer is not complete.\n");
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
 		return fb;
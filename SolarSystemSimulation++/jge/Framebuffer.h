@@ -16,6 +16,7 @@ namespace jge
 		GLuint colorTex;
 		GLuint depthTex;
 		GLuint handle[6];
+		GLuint layered;			// all faces at once, a geometry shader picks the face with gl_Layer
 	};
 
 	class FramebufferTools
@@ -0,0 +1,82 @@
+#include "Frustum.h"
+
+#include <xmmintrin.h>
+
+using namespace glm;
+
+namespace jge
+{
+	Frustum::Frustum()
+	{
+		// Everything is inside
+		for (int i = 0; i < 6; ++i)
+			m_planes[i] = vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	}
+
+	Frustum::Frustum(const mat4& viewProjection)
+	{
+		// glm is column major, these are the rows
+		vec4 row[4];
+		for (int i = 0; i < 4; ++i)
+			row[i] = vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+		m_planes[0] = row[3] + row[0];		// left
+		m_planes[1] = row[3] - row[0];		// right
+		m_planes[2] = row[3] + row[1];		// bottom
+		m_planes[3] = row[3] - row[1];		// top
+		m_planes[4] = row[3] + row[2];		// near
+		m_planes[5] = row[3] - row[2];		// far
+
+		for (int i = 0; i < 6; ++i)
+			m_planes[i] = m_planes[i] * (1.0f / length(vec3(m_planes[i])));
+	}
+
+	bool Frustum::IsSphereVisible(const vec3& center, float radius) const
+	{
+		for (int i = 0; i < 6; ++i)
+		{
+			if (dot(vec3(m_planes[i]), center) + m_planes[i].w <= -radius)
+				return false;
+		}
+		return true;
+	}
+
+	void Frustum::CullSpheres(const float* x, const float* y, const float* z, const float* radius, size_t count, unsigned char* visible) const
+	{
+		__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+		for (int p = 0; p < 6; ++p)
+		{
+			planeX[p] = _mm_set1_ps(m_planes[p].x);
+			planeY[p] = _mm_set1_ps(m_planes[p].y);
+			planeZ[p] = _mm_set1_ps(m_planes[p].z);
+			planeW[p] = _mm_set1_ps(m_planes[p].w);
+		}
+
+		const __m128 zero = _mm_setzero_ps();
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			const __m128 cx = _mm_loadu_ps(x + i);
+			const __m128 cy = _mm_loadu_ps(y + i);
+			const __m128 cz = _mm_loadu_ps(z + i);
+			const __m128 negRadius = _mm_sub_ps(zero, _mm_loadu_ps(radius + i));
+
+			// All lanes set, cleared by the first plane a sphere is fully behind
+			__m128 inside = _mm_cmpeq_ps(zero, zero);
+			for (int p = 0; p < 6; ++p)
+			{
+				const __m128 distance = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(cx, planeX[p]), _mm_mul_ps(cy, planeY[p])),
+					_mm_add_ps(_mm_mul_ps(cz, planeZ[p]), planeW[p]));
+				inside = _mm_and_ps(inside, _mm_cmpgt_ps(distance, negRadius));
+			}
+
+			const int mask = _mm_movemask_ps(inside);
+			for (int k = 0; k < 4; ++k)
+				visible[i + k] = (unsigned char)((mask >> k) & 1);
+		}
+
+		for (; i < count; ++i)
+			visible[i] = IsSphereVisible(vec3(x[i], y[i], z[i]), radius[i]) ? 1 : 0;
+	}
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <glm/glm.hpp>
+
+namespace jge
+{
+	/**
+	* The six planes of a view frustum, extracted from a view projection matrix
+	* (Gribb/Hartmann). Bounding spheres are tested against all planes, a sphere
+	* that touches the frustum counts as visible. The bulk test takes the spheres
+	* as separate coordinate arrays and tests four at once with SSE.
+	*/
+	class Frustum
+	{
+	public:
+		Frustum();
+		explicit Frustum(const glm::mat4& viewProjection);
+
+		bool IsSphereVisible(const glm::vec3& center, float radius) const;
+
+		// Writes 1 to <visible> for each of the <count> spheres that is at least partly inside, 0 otherwise
+		void CullSpheres(const float* x, const float* y, const float* z, const float* radius, size_t count, unsigned char* visible) const;
+
+	private:
+		glm::vec4 m_planes[6];		// normal pointing inside and distance, normalized
+	};
+}
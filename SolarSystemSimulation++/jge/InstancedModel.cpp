@@ -0,0 +1,212 @@
+#include "InstancedModel.h"
+#include "Frustum.h"
+
+#include <math.h>
+
+using namespace glm;
+
+namespace jge
+{
+	// Largest factor the upper 3x3 of <m> scales a length by
+	static float MaxScale(const mat4& m)
+	{
+		float x = dot(vec3(m[0]), vec3(m[0]));
+		float y = dot(vec3(m[1]), vec3(m[1]));
+		float z = dot(vec3(m[2]), vec3(m[2]));
+		return sqrtf(glm::max(x, glm::max(y, z)));
+	}
+
+	InstancedModel::InstancedModel()
+		: m_mesh(nullptr)
+		, m_shader(nullptr)
+		, m_visibleCount(0)
+		, m_culled(false)
+		, m_transformBuffer(0)
+		, m_colorBuffer(0)
+		, m_attachedVAO(0)
+		, m_colorsDirty(true)
+	{
+	}
+
+	InstancedModel::~InstancedModel()
+	{
+		if (m_transformBuffer == 0)
+			return;
+
+		glDeleteBuffers(1, &m_transformBuffer);
+		glDeleteBuffers(1, &m_colorBuffer);
+	}
+
+	void InstancedModel::SetMesh(Mesh* mesh)
+	{
+		m_mesh = mesh;
+	}
+
+	Mesh* InstancedModel::GetMesh() const
+	{
+		return m_mesh;
+	}
+
+	void InstancedModel::SetShader(ShaderProgram* shdr)
+	{
+		m_shader = shdr;
+	}
+
+	ShaderProgram* InstancedModel::GetShader() const
+	{
+		return m_shader;
+	}
+
+	void InstancedModel::SetInstanceCount(size_t count)
+	{
+		m_transforms.resize(count, mat4(1.0f));
+		m_colors.resize(count, vec4(1.0f));
+		m_colorsDirty = true;
+		m_culled = false;
+	}
+
+	size_t InstancedModel::GetInstanceCount() const
+	{
+		return m_transforms.size();
+	}
+
+	mat4* InstancedModel::GetTransforms()
+	{
+		return m_transforms.data();
+	}
+
+	vec4* InstancedModel::GetColors()
+	{
+		return m_colors.data();
+	}
+
+	void InstancedModel::InvalidateColors()
+	{
+		m_colorsDirty = true;
+	}
+
+	void InstancedModel::Cull(const Frustum& frustum)
+	{
+		if (m_mesh == nullptr)
+			return;
+
+		// The mesh sphere around its origin, moved by modelMatrix and then every instance
+		const vec3 localCenter = vec3(modelMatrix * vec4(0.0f, 0.0f, 0.0f, 1.0f));
+		const float localRadius = m_mesh->GetBoundingRadius() * MaxScale(modelMatrix);
+
+		const size_t count = m_transforms.size();
+		m_boundsX.resize(count);
+		m_boundsY.resize(count);
+		m_boundsZ.resize(count);
+		m_boundsRadius.resize(count);
+		m_visible.resize(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			const mat4& m = m_transforms[i];
+			const vec3 center = vec3(m * vec4(localCenter, 1.0f));
+			m_boundsX[i] = center.x;
+			m_boundsY[i] = center.y;
+			m_boundsZ[i] = center.z;
+			m_boundsRadius[i] = localRadius * MaxScale(m);
+		}
+
+		frustum.CullSpheres(m_boundsX.data(), m_boundsY.data(), m_boundsZ.data(), m_boundsRadius.data(), count, m_visible.data());
+
+		m_visibleCount = 0;
+		for (size_t i = 0; i < count; ++i)
+			m_visibleCount += m_visible[i];
+		m_culled = true;
+	}
+
+	size_t InstancedModel::GetVisibleCount() const
+	{
+		return m_culled ? m_visibleCount : m_transforms.size();
+	}
+
+	void InstancedModel::AttachInstanceBuffers()
+	{
+		if (m_transformBuffer == 0)
+		{
+			glGenBuffers(1, &m_transformBuffer);
+			glGenBuffers(1, &m_colorBuffer);
+		}
+
+		glBindVertexArray(m_mesh->GetVAO());
+
+		// A mat4 attribute is passed as four vec4 columns
+		glBindBuffer(GL_ARRAY_BUFFER, m_transformBuffer);
+		for (int i = 0; i < 4; ++i)
+		{
+			glEnableVertexAttribArray(ATTRIB_MATRIX + i);
+			glVertexAttribPointer(ATTRIB_MATRIX + i, 4, GL_FLOAT, GL_FALSE, sizeof(mat4), (void*)(sizeof(vec4) * i));
+			glVertexAttribDivisor(ATTRIB_MATRIX + i, 1);
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, m_colorBuffer);
+		glEnableVertexAttribArray(ATTRIB_COLOR);
+		glVertexAttribPointer(ATTRIB_COLOR, 4, GL_FLOAT, GL_FALSE, 0, (void*)0);
+		glVertexAttribDivisor(ATTRIB_COLOR, 1);
+
+		m_attachedVAO = m_mesh->GetVAO();
+		m_colorsDirty = true;
+	}
+
+	void InstancedModel::Draw()
+	{
+		if (m_mesh == nullptr || m_transforms.empty())
+			return;
+
+		if (m_attachedVAO != m_mesh->GetVAO())
+			AttachInstanceBuffers();
+
+		// The culled instances are compacted, the colors move with them
+		const mat4* transforms = m_transforms.data();
+		const vec4* colors = m_colors.data();
+		size_t count = m_transforms.size();
+		const bool culled = m_culled && m_visible.size() == count;
+		if (culled)
+		{
+			m_visibleTransforms.resize(m_visibleCount);
+			m_visibleColors.resize(m_visibleCount);
+			size_t k = 0;
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (!m_visible[i])
+					continue;
+				m_visibleTransforms[k] = m_transforms[i];
+				m_visibleColors[k] = m_colors[i];
+				++k;
+			}
+			transforms = m_visibleTransforms.data();
+			colors = m_visibleColors.data();
+			count = m_visibleCount;
+		}
+		if (count == 0)
+			return;
+
+		// Orphan the old storage so the upload doesn't wait for the
+		// previous frame's draw call to finish reading it
+		const GLsizeiptr transformBytes = count * sizeof(mat4);
+		glBindBuffer(GL_ARRAY_BUFFER, m_transformBuffer);
+		glBufferData(GL_ARRAY_BUFFER, transformBytes, nullptr, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, transformBytes, transforms);
+
+		// Compacted colors change with the view, all colors only when invalidated
+		if (culled)
+		{
+			const GLsizeiptr colorBytes = count * sizeof(vec4);
+			glBindBuffer(GL_ARRAY_BUFFER, m_colorBuffer);
+			glBufferData(GL_ARRAY_BUFFER, colorBytes, nullptr, GL_STREAM_DRAW);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, colorBytes, colors);
+			m_colorsDirty = true;
+		}
+		else if (m_colorsDirty)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, m_colorBuffer);
+			glBufferData(GL_ARRAY_BUFFER, m_colors.size() * sizeof(vec4), m_colors.data(), GL_STATIC_DRAW);
+			m_colorsDirty = false;
+		}
+
+		m_mesh->DrawInstanced((int)count);
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "Mesh.h"
+#include <glm\glm.hpp>
+#include <vector>
+
+namespace jge
+{
+	class Frustum;
+	class ShaderProgram;
+
+	/**
+	* Many copies of one mesh drawn with a single instanced draw call. Every
+	* instance has its own model matrix and color. The per instance data is
+	* kept on the CPU and uploaded once per frame in Draw(). After Cull() only
+	* the instances in view are uploaded and drawn.
+	*/
+	class InstancedModel
+	{
+	public:
+		// First vertex attribute location used by the instance data. The mesh
+		// occupies 0-4, the model matrix takes four locations and the color one.
+		static const int ATTRIB_MATRIX = 5;
+		static const int ATTRIB_COLOR = 9;
+
+		InstancedModel();
+		~InstancedModel();
+
+		void SetMesh(Mesh* mesh);
+		Mesh* GetMesh() const;
+
+		void SetShader(ShaderProgram* shdr);
+		ShaderProgram* GetShader() const;
+
+		// Resizes the per instance data. New instances get the identity
+		// matrix and a white color.
+		void SetInstanceCount(size_t count);
+		size_t GetInstanceCount() const;
+
+		// Transform applied to the mesh before the instance matrix, e.g. to
+		// center and normalize the mesh.
+		glm::mat4 modelMatrix;
+
+		// Write access to the per instance data. The transforms are streamed
+		// every frame, the colors are uploaded again after InvalidateColors().
+		glm::mat4* GetTransforms();
+		glm::vec4* GetColors();
+		void InvalidateColors();
+
+		// Tests the bounding spheres of the instances against <frustum>, Draw()
+		// skips the ones outside. Call again after the transforms changed.
+		void Cull(const Frustum& frustum);
+		size_t GetVisibleCount() const;
+
+		// Uploads the instance data and draws all instances, or only the
+		// visible ones once culled.
+		void Draw();
+
+	private:
+		InstancedModel(const InstancedModel&) = delete;
+		InstancedModel& operator=(const InstancedModel&) = delete;
+
+		void AttachInstanceBuffers();
+
+		Mesh* m_mesh;
+		ShaderProgram* m_shader;
+
+		std::vector<glm::mat4> m_transforms;
+		std::vector<glm::vec4> m_colors;
+
+		// Culling: bounding spheres of the instances and the results
+		std::vector<float> m_boundsX;
+		std::vector<float> m_boundsY;
+		std::vector<float> m_boundsZ;
+		std::vector<float> m_boundsRadius;
+		std::vector<unsigned char> m_visible;
+		size_t m_visibleCount;
+		bool m_culled;
+
+		// The visible instances, compacted for the upload
+		std::vector<glm::mat4> m_visibleTransforms;
+		std::vector<glm::vec4> m_visibleColors;
+
+		GLuint m_transformBuffer;
+		GLuint m_colorBuffer;
+		GLuint m_attachedVAO;		// VAO the instance buffers are attached to
+		bool m_colorsDirty;
+	};
+}
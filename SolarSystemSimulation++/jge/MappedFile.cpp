@@ -0,0 +1,126 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace jge
+{
+#ifdef _WIN32
+	MappedFile::MappedFile()
+		: m_data(nullptr)
+		, m_size(0)
+		, m_file(INVALID_HANDLE_VALUE)
+		, m_mapping(nullptr)
+	{
+	}
+#else
+	MappedFile::MappedFile()
+		: m_data(nullptr)
+		, m_size(0)
+		, m_file(-1)
+	{
+	}
+#endif
+
+	MappedFile::~MappedFile()
+	{
+		Close();
+	}
+
+	bool MappedFile::Open(const char* path)
+	{
+		Close();
+
+#ifdef _WIN32
+		m_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+		if (m_file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+		{
+			Close();
+			return false;
+		}
+
+		m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m_mapping == nullptr)
+		{
+			Close();
+			return false;
+		}
+
+		m_data = (const unsigned char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+		m_size = (size_t)size.QuadPart;
+#else
+		m_file = open(path, O_RDONLY);
+		if (m_file < 0)
+			return false;
+
+		struct stat info;
+		if (fstat(m_file, &info) != 0 || info.st_size == 0)
+		{
+			Close();
+			return false;
+		}
+
+		void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, m_file, 0);
+		m_data = data != MAP_FAILED ? (const unsigned char*)data : nullptr;
+		m_size = (size_t)info.st_size;
+
+		// Lookups jump around in the file, read-ahead would only waste memory
+		if (m_data)
+			madvise(data, m_size, MADV_RANDOM);
+#endif
+
+		if (m_data == nullptr)
+		{
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	void MappedFile::Close()
+	{
+#ifdef _WIN32
+		if (m_data)
+			UnmapViewOfFile(m_data);
+		if (m_mapping)
+			CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE)
+			CloseHandle(m_file);
+		m_mapping = nullptr;
+		m_file = INVALID_HANDLE_VALUE;
+#else
+		if (m_data)
+			munmap((void*)m_data, m_size);
+		if (m_file >= 0)
+			close(m_file);
+		m_file = -1;
+#endif
+		m_data = nullptr;
+		m_size = 0;
+	}
+
+	bool MappedFile::IsOpen() const
+	{
+		return m_data != nullptr;
+	}
+
+	const unsigned char* MappedFile::GetData() const
+	{
+		return m_data;
+	}
+
+	size_t MappedFile::GetSize() const
+	{
+		return m_size;
+	}
+}
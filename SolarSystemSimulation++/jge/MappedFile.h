@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace jge
+{
+	/**
+	* Read-only memory mapping of a whole file. Nothing is read on Open(),
+	* the OS pages the data in on first access and can drop it again under
+	* memory pressure.
+	*/
+	class MappedFile
+	{
+	public:
+		MappedFile();
+		~MappedFile();
+
+		// Maps <path>, an already open mapping is closed first.
+		// Returns false if the file can't be opened or is empty.
+		bool Open(const char* path);
+		void Close();
+
+		bool IsOpen() const;
+		const unsigned char* GetData() const;
+		size_t GetSize() const;
+
+	private:
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		const unsigned char* m_data;
+		size_t m_size;
+
+#ifdef _WIN32
+		void* m_file;				// HANDLE
+		void* m_mapping;			// HANDLE
+#else
+		int m_file;
+#endif
+	};
+}
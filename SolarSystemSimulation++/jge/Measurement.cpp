@@ -37,21 +37,6 @@ namespace jge
 		return (1.0f / fps) * 1000.0f;
 	}
 
-	void Stopwatch::Start()
-	{
-		beginTime = glfwGetTime();
-	}
-
-	void Stopwatch::Stop()
-	{
-		endTime = glfwGetTime();
-	}
-
-	double Stopwatch::GetElapsedTime() const
-	{
-		return endTime - beginTime;
-	}
-
 	void jgeSleep(int sleepMs)
 	{
 		#ifdef __unix__
@@ -1,16 +1,232 @@
 #include "Mesh.h"
 
+#include <algorithm>
+#include <unordered_map>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
 using namespace std;
 using namespace glm;
 
 namespace jge
 {
+	// Vertex cache optimization after Tom Forsyth, "Linear-Speed Vertex Cache Optimisation"
+	static const int VERTEX_CACHE_SIZE = 32;
+
+	static float VertexScore(int cachePosition, int remainingTriangles)
+	{
+		if (remainingTriangles == 0)
+			return -1.0f;
+
+		float score = 0.0f;
+		if (cachePosition >= 0)
+		{
+			// The vertices of the last triangle score the same, whichever is used first
+			if (cachePosition < 3)
+				score = 0.75f;
+			else score = powf(1.0f - (cachePosition - 3) * (1.0f / (VERTEX_CACHE_SIZE - 3)), 1.5f);
+		}
+
+		// Vertices with few triangles left are finished off first
+		return score + 2.0f * powf((float)remainingTriangles, -0.5f);
+	}
+
+	static void OptimizeVertexCache(vector<GLuint>& indices, size_t vertexCount)
+	{
+		const size_t triangleCount = indices.size() / 3;
+
+		// The triangles of each vertex, the ones not yet emitted at the front of its range
+		vector<int> remaining(vertexCount, 0);
+		for (size_t i = 0; i < triangleCount * 3; ++i)
+			++remaining[indices[i]];
+
+		vector<int> offsets(vertexCount + 1, 0);
+		for (size_t v = 0; v < vertexCount; ++v)
+			offsets[v + 1] = offsets[v] + remaining[v];
+
+		vector<int> vertexTriangles(triangleCount * 3);
+		vector<int> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t t = 0; t < triangleCount; ++t)
+		{
+			for (int k = 0; k < 3; ++k)
+				vertexTriangles[fill[indices[t * 3 + k]]++] = (int)t;
+		}
+
+		vector<int> cachePosition(vertexCount, -1);
+		vector<float> vertexScore(vertexCount);
+		for (size_t v = 0; v < vertexCount; ++v)
+			vertexScore[v] = VertexScore(-1, remaining[v]);
+
+		vector<float> triangleScore(triangleCount);
+		vector<bool> emitted(triangleCount, false);
+		for (size_t t = 0; t < triangleCount; ++t)
+			triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+		vector<GLuint> result;
+		result.reserve(triangleCount * 3);
+		vector<GLuint> cache, nextCache;
+		int best = -1;
+		for (size_t n = 0; n < triangleCount; ++n)
+		{
+			// Nothing in the cache left to use, start over at the best remaining triangle
+			if (best < 0)
+			{
+				for (size_t t = 0; t < triangleCount; ++t)
+				{
+					if (!emitted[t] && (best < 0 || triangleScore[t] > triangleScore[best]))
+						best = (int)t;
+				}
+			}
+
+			const GLuint* triangle = &indices[best * 3];
+			result.insert(result.end(), triangle, triangle + 3);
+			emitted[best] = true;
+
+			for (int k = 0; k < 3; ++k)
+			{
+				// Swap the triangle behind the remaining ones of the vertex
+				const GLuint v = triangle[k];
+				int* first = &vertexTriangles[offsets[v]];
+				int* last = first + remaining[v] - 1;
+				*std::find(first, last + 1, best) = *last;
+				*last = best;
+				--remaining[v];
+			}
+
+			// The triangles vertices move to the front of the cache, the oldest fall out at the end
+			nextCache.assign(triangle, triangle + 3);
+			for (size_t i = 0; i < cache.size(); ++i)
+			{
+				if (cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2])
+					nextCache.push_back(cache[i]);
+			}
+			cache.swap(nextCache);
+
+			for (size_t i = 0; i < cache.size(); ++i)
+			{
+				const GLuint v = cache[i];
+				cachePosition[v] = i < VERTEX_CACHE_SIZE ? (int)i : -1;
+
+				const float score = VertexScore(cachePosition[v], remaining[v]);
+				const float delta = score - vertexScore[v];
+				vertexScore[v] = score;
+				for (int j = 0; j < remaining[v]; ++j)
+					triangleScore[vertexTriangles[offsets[v] + j]] += delta;
+			}
+			if (cache.size() > VERTEX_CACHE_SIZE)
+				cache.resize(VERTEX_CACHE_SIZE);
+
+			// Continue with the best triangle around the cached vertices
+			best = -1;
+			for (size_t i = 0; i < cache.size(); ++i)
+			{
+				const GLuint v = cache[i];
+				for (int j = 0; j < remaining[v]; ++j)
+				{
+					const int t = vertexTriangles[offsets[v] + j];
+					if (best < 0 || triangleScore[t] > triangleScore[best])
+						best = t;
+				}
+			}
+		}
+
+		indices.swap(result);
+	}
+
+	template <typename T>
+	static void ReorderVertices(vector<T>& data, const vector<GLuint>& order)
+	{
+		if (data.empty())
+			return;
+
+		vector<T> reordered(order.size());
+		for (size_t i = 0; i < order.size(); ++i)
+			reordered[i] = data[order[i]];
+		data.swap(reordered);
+	}
+
+	// The vertex of the packed layout: 24 bytes instead of 56 for the separate float buffers
+	struct PackedVertex
+	{
+		vec3 position;
+		GLuint normal;			// GL_INT_2_10_10_10_REV
+		GLushort uv[2];			// half floats
+		GLuint tangent;			// GL_INT_2_10_10_10_REV, w is the bitangent sign
+	};
+
+	static GLushort FloatToHalf(float value)
+	{
+		GLuint bits;
+		memcpy(&bits, &value, sizeof(bits));
+
+		const GLuint sign = (bits >> 16) & 0x8000;
+		const int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+		GLuint mantissa = bits & 0x7FFFFF;
+
+		// Too large, infinity or NaN
+		if (exponent >= 31)
+			return (GLushort)(sign | 0x7C00 | (value != value ? 0x200 : 0));
+
+		// Denormalized or zero
+		if (exponent <= 0)
+		{
+			if (exponent < -10)
+				return (GLushort)sign;
+
+			mantissa |= 0x800000;
+			const int shift = 14 - exponent;
+			GLuint half = mantissa >> shift;
+			if ((mantissa >> (shift - 1)) & 1)
+				++half;
+			return (GLushort)(sign | half);
+		}
+
+		// Rounds halfway cases up, a carry goes on into the exponent
+		GLuint half = sign | ((GLuint)exponent << 10) | (mantissa >> 13);
+		if (mantissa & 0x1000)
+			++half;
+		return (GLushort)half;
+	}
+
+	// Signed normalized xyz in 10 bits each, the sign of w in the top 2 bits
+	static GLuint PackSnorm1010102(const vec3& v, float w)
+	{
+		GLuint packed = w < 0.0f ? (0x3u << 30) : (0x1u << 30);
+		for (int i = 0; i < 3; ++i)
+		{
+			const int c = (int)floorf(glm::clamp(v[i], -1.0f, 1.0f) * 511.0f + 0.5f);
+			packed |= ((GLuint)c & 0x3FF) << (10 * i);
+		}
+		return packed;
+	}
+
+	// +1 or -1, whether the bitangent agrees with cross(n, t)
+	static float Handedness(const vec3& n, const vec3& t, const vec3& b)
+	{
+		return dot(cross(n, t), b) < 0.0f ? -1.0f : 1.0f;
+	}
+
 	Mesh::Mesh()
+		: m_vertexArrayID(0)
+		, m_indexType(GL_UNSIGNED_INT)
+		, m_layout(LAYOUT_SEPARATE)
+		, m_boundingRadius(0.0f)
+		, m_vertexbuffer(0)
+		, m_uvbuffer(0)
+		, m_normalbuffer(0)
+		, m_tangentbuffer(0)
+		, m_indexbuffer(0)
 	{
 	}
 
 	Mesh::~Mesh()
 	{
+		// Never created, maybe there isn't even a context (headless mode)
+		if (m_vertexArrayID == 0)
+			return;
+
 		// We can safely delete everything - even if the object wasn't created
 		glDeleteVertexArrays(1, &m_vertexArrayID);
 
@@ -18,16 +234,20 @@ namespace jge
 		glDeleteBuffers(1, &m_uvbuffer);
 		glDeleteBuffers(1, &m_normalbuffer);
 		glDeleteBuffers(1, &m_tangentbuffer);
-		glDeleteBuffers(1, &m_bitangentbuffer);
+		glDeleteBuffers(1, &m_indexbuffer);
 
 		glDisableVertexAttribArray(0);
 		glDisableVertexAttribArray(1);
 		glDisableVertexAttribArray(2);
 		glDisableVertexAttribArray(3);
-		glDisableVertexAttribArray(4);
 		glBindVertexArray(0);
 	}
 
+	void Mesh::SetVertexLayout(VertexLayout layout)
+	{
+		m_layout = layout;
+	}
+
 	void Mesh::SetBufferData(GLuint bufferID, const vector<vec2>& data, GLenum usage)
 	{
 		glBindBuffer(GL_ARRAY_BUFFER, bufferID);
@@ -40,18 +260,28 @@ namespace jge
 		glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(glm::vec3), data.data(), usage);
 	}
 
-	void Mesh::Attach(GLuint bufferID, int location, int size)
+	void Mesh::SetBufferData(GLuint bufferID, const vector<vec4>& data, GLenum usage)
 	{
 		glBindBuffer(GL_ARRAY_BUFFER, bufferID);
-		glEnableVertexAttribArray(location);
-		glVertexAttribPointer(
-			location,						  // attribute
-			size,                             // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-			);
+		glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(glm::vec4), data.data(), usage);
+	}
+
+	void Mesh::Attach(GLuint bufferID, const VertexAttribute* attributes, int count, GLsizei stride)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, bufferID);
+		for (int i = 0; i < count; ++i)
+		{
+			const VertexAttribute& a = attributes[i];
+			glEnableVertexAttribArray(a.location);
+			glVertexAttribPointer(
+				a.location,						// attribute
+				a.size,							// size
+				a.type,							// type
+				a.normalized,					// normalized?
+				stride,							// stride
+				(void*)a.offset					// array buffer offset
+				);
+		}
 	}
 
 	void Mesh::Create(GLenum vertexType, GLenum usage, bool generateTangents)
@@ -64,7 +294,7 @@ namespace jge
 		glGenBuffers(1, &m_uvbuffer);
 		glGenBuffers(1, &m_normalbuffer);
 		glGenBuffers(1, &m_tangentbuffer);
-		glGenBuffers(1, &m_bitangentbuffer);
+		glGenBuffers(1, &m_indexbuffer);
 
 		m_drawType = vertexType;
 		m_usageType = usage;
@@ -79,46 +309,114 @@ namespace jge
 	{
 		glBindVertexArray(m_vertexArrayID);
 
+		m_boundingRadius = 0.0f;
+		for (const glm::vec3& v : m_vertices)
+			m_boundingRadius = glm::max(m_boundingRadius, glm::length(v));
+
+		const bool packable = m_normals.size() == m_vertices.size()
+			&& m_uvs.size() == m_vertices.size() && m_uvws.empty();
+		if (m_layout == LAYOUT_PACKED && packable)
+			UpdatePacked();
+		else UpdateSeparate();
+
+		// Bind index buffer, the VAO keeps it
+		if (m_indices.size() > 0)
+		{
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexbuffer);
+			if (m_vertices.size() <= 0xFFFF)
+			{
+				vector<GLushort> shortIndices(m_indices.begin(), m_indices.end());
+				glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(GLushort), shortIndices.data(), m_usageType);
+				m_indexType = GL_UNSIGNED_SHORT;
+			}
+			else
+			{
+				glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(GLuint), m_indices.data(), m_usageType);
+				m_indexType = GL_UNSIGNED_INT;
+			}
+		}
+	}
+
+	void Mesh::UpdateSeparate()
+	{
+		static const VertexAttribute POSITION = { 0, 3, GL_FLOAT, GL_FALSE, 0 };
+		static const VertexAttribute NORMAL = { 1, 3, GL_FLOAT, GL_FALSE, 0 };
+		static const VertexAttribute UV = { 2, 2, GL_FLOAT, GL_FALSE, 0 };
+		static const VertexAttribute UVW = { 2, 3, GL_FLOAT, GL_FALSE, 0 };
+		static const VertexAttribute TANGENT = { 3, 4, GL_FLOAT, GL_FALSE, 0 };
+
 		// Bind vertexbuffer
 		SetBufferData(m_vertexbuffer, m_vertices, m_usageType);
-		Attach(m_vertexbuffer, 0, 3);
+		Attach(m_vertexbuffer, &POSITION, 1, 0);
 
 		// Bind normalbuffer
 		if (m_normals.size() > 0)
 		{
 			SetBufferData(m_normalbuffer, m_normals, m_usageType);
-			Attach(m_normalbuffer, 1, 3);
+			Attach(m_normalbuffer, &NORMAL, 1, 0);
 		}
 
-		// Bind inout_tangent buffer
+		// Bind tangent buffer, the shader reconstructs the bitangent from the sign in w
 		if (m_tangents.size() > 0)
 		{
-			SetBufferData(m_tangentbuffer, m_tangents, m_usageType);
-			Attach(m_tangentbuffer, 3, 3);
-		}
-
-		// Bind bi-inout_tangent buffer
-		if (m_bitangents.size() > 0)
-		{
-			SetBufferData(m_bitangentbuffer, m_bitangents, m_usageType);
-			Attach(m_bitangentbuffer, 4, 3);
+			vector<vec4> tangents(m_tangents.size());
+			for (size_t i = 0; i < m_tangents.size(); ++i)
+			{
+				const float sign = i < m_bitangents.size() && i < m_normals.size()
+					? Handedness(m_normals[i], m_tangents[i], m_bitangents[i]) : 1.0f;
+				tangents[i] = vec4(m_tangents[i], sign);
+			}
+			SetBufferData(m_tangentbuffer, tangents, m_usageType);
+			Attach(m_tangentbuffer, &TANGENT, 1, 0);
 		}
 
 		// Bind uv buffer (2D)
 		if (m_uvs.size() > 0 && m_uvs.size() >= m_uvws.size())
 		{
 			SetBufferData(m_uvbuffer, m_uvs, m_usageType);
-			Attach(m_uvbuffer, 2, 2);
+			Attach(m_uvbuffer, &UV, 1, 0);
 		}
 
 		// Bind uv buffer (3D)
 		if (m_uvws.size() > 0 && m_uvs.size() <= m_uvws.size())
 		{
 			SetBufferData(m_uvbuffer, m_uvws, m_usageType);
-			Attach(m_uvbuffer, 2, 3);
+			Attach(m_uvbuffer, &UVW, 1, 0);
 		}
 	}
 
+	void Mesh::UpdatePacked()
+	{
+		// The tangent is optional and has to stay last
+		static const int ATTRIBUTE_COUNT = 4;
+		static const VertexAttribute ATTRIBUTES[ATTRIBUTE_COUNT] =
+		{
+			{ 0, 3, GL_FLOAT,				GL_FALSE,	offsetof(PackedVertex, position) },
+			{ 1, 4, GL_INT_2_10_10_10_REV,	GL_TRUE,	offsetof(PackedVertex, normal) },
+			{ 2, 2, GL_HALF_FLOAT,			GL_FALSE,	offsetof(PackedVertex, uv) },
+			{ 3, 4, GL_INT_2_10_10_10_REV,	GL_TRUE,	offsetof(PackedVertex, tangent) },
+		};
+
+		const bool hasTangents = m_tangents.size() == m_vertices.size() && m_bitangents.size() == m_vertices.size();
+
+		vector<PackedVertex> packed(m_vertices.size());
+		for (size_t i = 0; i < m_vertices.size(); ++i)
+		{
+			PackedVertex& p = packed[i];
+			p.position = m_vertices[i];
+			p.normal = PackSnorm1010102(m_normals[i], 1.0f);
+			p.uv[0] = FloatToHalf(m_uvs[i].x);
+			p.uv[1] = FloatToHalf(m_uvs[i].y);
+			p.tangent = hasTangents
+				? PackSnorm1010102(m_tangents[i], Handedness(m_normals[i], m_tangents[i], m_bitangents[i]))
+				: 0;
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, m_vertexbuffer);
+		glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(PackedVertex), packed.data(), m_usageType);
+		Attach(m_vertexbuffer, ATTRIBUTES, hasTangents ? ATTRIBUTE_COUNT : ATTRIBUTE_COUNT - 1, sizeof(PackedVertex));
+	}
+
 	vector<vec3>* Mesh::GetVertices()
 	{
 		return &m_vertices;
@@ -149,15 +447,27 @@ namespace jge
 		return &m_bitangents;
 	}
 
+	vector<GLuint>* Mesh::GetIndices()
+	{
+		return &m_indices;
+	}
+
 	GLuint Mesh::GetVAO() const
 	{
 		return m_vertexArrayID;
 	}
 
+	float Mesh::GetBoundingRadius() const
+	{
+		return m_boundingRadius;
+	}
+
 	void Mesh::Draw(GLenum mode)
 	{
 		glBindVertexArray(m_vertexArrayID);
-		glDrawArrays(mode, 0, m_vertices.size());
+		if (m_indices.empty())
+			glDrawArrays(mode, 0, m_vertices.size());
+		else glDrawElements(mode, m_indices.size(), m_indexType, (void*)0);
 	}
 
 	void Mesh::Draw()
@@ -167,35 +477,88 @@ namespace jge
 
 	void Mesh::DrawNoBind()
 	{
-		glDrawArrays(m_drawType, 0, m_vertices.size());
+		if (m_indices.empty())
+			glDrawArrays(m_drawType, 0, m_vertices.size());
+		else glDrawElements(m_drawType, m_indices.size(), m_indexType, (void*)0);
+	}
+
+	void Mesh::DrawInstanced(int instanceCount)
+	{
+		glBindVertexArray(m_vertexArrayID);
+		if (m_indices.empty())
+			glDrawArraysInstanced(m_drawType, 0, m_vertices.size(), instanceCount);
+		else glDrawElementsInstanced(m_drawType, m_indices.size(), m_indexType, (void*)0, instanceCount);
+	}
+
+	void Mesh::OptimizeIndices()
+	{
+		if (m_indices.empty())
+			return;
+
+		OptimizeVertexCache(m_indices, m_vertices.size());
+
+		// Number the vertices in the order the triangles use them, unused ones are dropped
+		const GLuint unused = 0xFFFFFFFF;
+		vector<GLuint> newIndex(m_vertices.size(), unused);
+		vector<GLuint> order;
+		order.reserve(m_vertices.size());
+		for (size_t i = 0; i < m_indices.size(); ++i)
+		{
+			GLuint& index = m_indices[i];
+			if (newIndex[index] == unused)
+			{
+				newIndex[index] = (GLuint)order.size();
+				order.push_back(index);
+			}
+			index = newIndex[index];
+		}
+
+		ReorderVertices(m_vertices, order);
+		ReorderVertices(m_uvs, order);
+		ReorderVertices(m_uvws, order);
+		ReorderVertices(m_normals, order);
+		ReorderVertices(m_tangents, order);
+		ReorderVertices(m_bitangents, order);
 	}
 
     // http://www.opengl-tutorial.org/intermediate-tutorials/tutorial-13-normal-mapping/
 	void Mesh::GenerateTangents()
 	{
-		for (unsigned int i = 0; i < m_vertices.size(); i += 3)
+		// Shared vertices sum up the tangents of their triangles
+		m_tangents.assign(m_vertices.size(), vec3(0.0f));
+		m_bitangents.assign(m_vertices.size(), vec3(0.0f));
+
+		const size_t cornerCount = m_indices.empty() ? m_vertices.size() : m_indices.size();
+		for (size_t i = 0; i + 2 < cornerCount; i += 3)
 		{
+			GLuint c[3];
+			for (int k = 0; k < 3; ++k)
+				c[k] = m_indices.empty() ? (GLuint)(i + k) : m_indices[i + k];
+
 			// Edges of the triangle : postion delta
-			glm::vec3& v0 = m_vertices[i + 0];
-			glm::vec3 deltaPos1 = m_vertices[i + 1] - v0;
-			glm::vec3 deltaPos2 = m_vertices[i + 2] - v0;
+			glm::vec3& v0 = m_vertices[c[0]];
+			glm::vec3 deltaPos1 = m_vertices[c[1]] - v0;
+			glm::vec3 deltaPos2 = m_vertices[c[2]] - v0;
 
 			// UV delta
-			glm::vec2& uv0 = m_uvs[i + 0];
-			glm::vec2 deltaUV1 = m_uvs[i + 1] - uv0;
-			glm::vec2 deltaUV2 = m_uvs[i + 2] - uv0;
+			glm::vec2& uv0 = m_uvs[c[0]];
+			glm::vec2 deltaUV1 = m_uvs[c[1]] - uv0;
+			glm::vec2 deltaUV2 = m_uvs[c[2]] - uv0;
+
+			// No direction on a degenerated uv triangle, it would spoil the shared vertices
+			float det = deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x;
+			if (det == 0.0f)
+				continue;
 
-			float r = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x);
+			float r = 1.0f / det;
 			glm::vec3 inout_tangent = (deltaPos1 * deltaUV2.y - deltaPos2 * deltaUV1.y)*r;
 			glm::vec3 inout_bitangent = (deltaPos2 * deltaUV1.x - deltaPos1 * deltaUV2.x)*r;
 
-			m_tangents.push_back(inout_tangent);
-			m_tangents.push_back(inout_tangent);
-			m_tangents.push_back(inout_tangent);
-
-			m_bitangents.push_back(inout_bitangent);
-			m_bitangents.push_back(inout_bitangent);
-			m_bitangents.push_back(inout_bitangent);
+			for (int k = 0; k < 3; ++k)
+			{
+				m_tangents[c[k]] += inout_tangent;
+				m_bitangents[c[k]] += inout_bitangent;
+			}
 		}
 
         // http://www.opengl-tutorial.org/intermediate-tutorials/tutorial-13-normal-mapping/#going-further
@@ -205,8 +568,12 @@ namespace jge
 			glm::vec3 & t = (m_tangents)[i];
 			glm::vec3 & b = (m_bitangents)[i];
 
-			// Gram-Schmidt orthogonalize
-			t = glm::normalize(t - n * glm::dot(n, t));
+			// Gram-Schmidt orthogonalize. Vertices with only degenerated uv triangles
+			// (the poles) have no tangent, any perpendicular to the normal will do.
+			t = t - n * glm::dot(n, t);
+			if (glm::dot(t, t) < 1e-12f)
+				t = glm::cross(n, fabs(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f));
+			t = glm::normalize(t);
 
 			// Calculate handedness
 			/*if (glm::dot(glm::cross(n, t), b) < 0.0f){
@@ -335,15 +702,28 @@ namespace jge
 			}
 		}
 
-		// For each vertex of each triangle
+		// For each vertex of each triangle, corners with the same position, uv and normal share a vertex
+		std::unordered_map<uint64_t, GLuint> welded;
 		for (unsigned int i = 0; i < vertexIndices.size(); i++)
 		{
+			const uint64_t key = (uint64_t)vertexIndices[i] | ((uint64_t)uvIndices[i] << 21) | ((uint64_t)normalIndices[i] << 42);
+			std::unordered_map<uint64_t, GLuint>::const_iterator it = welded.find(key);
+			if (it != welded.end())
+			{
+				m_indices.push_back(it->second);
+				continue;
+			}
+
 			// Put the attributes in buffers
+			const GLuint index = (GLuint)m_vertices.size();
+			welded[key] = index;
+			m_indices.push_back(index);
 			m_vertices.push_back(temp_vertices[vertexIndices[i] - 1]);
 			m_uvs.push_back(temp_uvs[uvIndices[i] - 1]);
 			m_normals.push_back(temp_normals[normalIndices[i] - 1]);
 		}
 
+		OptimizeIndices();
 		Create(GL_TRIANGLES, GL_STATIC_DRAW, generateTangents);
 	}
 
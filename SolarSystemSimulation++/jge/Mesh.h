@@ -10,9 +10,20 @@ namespace jge
 	class Mesh
 	{
 	public:
+		// How Update() puts the vertices into GPU memory
+		enum VertexLayout
+		{
+			LAYOUT_SEPARATE,	// a float buffer per attribute
+			LAYOUT_PACKED		// one interleaved buffer, 24 bytes per vertex (see Update())
+		};
+
 		Mesh();
 		~Mesh();
 
+		// Call before Create(). The packed layout needs normals and 2D uvs, meshes
+		// without them keep the separate buffers.
+		void SetVertexLayout(VertexLayout layout);
+
 		// Create the mesh manually or from a preset
 		void Create(GLenum vertexType, GLenum usage, bool generateTangents = false);
 		void CreateCircle();
@@ -26,25 +37,50 @@ namespace jge
 		std::vector<glm::vec3>* GetTangents();
 		std::vector<glm::vec3>* GetBiTangents();
 
+		// Triangles (or the primitives of the draw type) as indices into the vertices,
+		// empty if the vertices are drawn in order
+		std::vector<GLuint>* GetIndices();
+
 		GLuint GetVAO() const;
 
+		// Distance of the farthest vertex from the origin, as of the last Update()
+		float GetBoundingRadius() const;
+
 		// Uploads the mesh data to the GPU
 		void Update();
 
 		void Draw();
 		void DrawNoBind();
+		void DrawInstanced(int instanceCount);
+
+		// Reorders the indexed triangles for the post-transform vertex cache (Forsyth) and
+		// the vertices in the order of their first use. Call before Create().
+		void OptimizeIndices();
 
-		// Read a Wavefront OBJ file
+		// Read a Wavefront OBJ file, corners with the same attributes share a vertex
 		void FromObjectFile(const char* objFile, bool generateTangents = false);
 		void SaveBufferToFile(const char* objFile);
 
 	private:
+		// An attribute in a vertex buffer, as passed to glVertexAttribPointer()
+		struct VertexAttribute
+		{
+			GLuint location;
+			GLint size;
+			GLenum type;
+			GLboolean normalized;
+			size_t offset;
+		};
+
 		// Uploads the data to the GPU
 		void SetBufferData(GLuint bufferID, const std::vector<glm::vec2>& data, GLenum usage);
 		void SetBufferData(GLuint bufferID, const std::vector<glm::vec3>& data, GLenum usage);
+		void SetBufferData(GLuint bufferID, const std::vector<glm::vec4>& data, GLenum usage);
 
-		// Attached the buffers to the VAO
-		void Attach(GLuint bufferID, int location, int size);
+		// Attaches the <count> attributes of the table, interleaved with <stride> bytes per vertex
+		void Attach(GLuint bufferID, const VertexAttribute* attributes, int count, GLsizei stride);
+		void UpdateSeparate();
+		void UpdatePacked();
 
 		void GenerateTangents();
 		void Draw(GLenum mode);
@@ -52,6 +88,9 @@ namespace jge
 		GLuint m_vertexArrayID;
 		GLenum m_drawType;
 		GLenum m_usageType;
+		GLenum m_indexType;					// 16 bit indices if the vertices allow
+		VertexLayout m_layout;
+		float m_boundingRadius;
 
 		// The local data
 		std::vector<glm::vec3> m_vertices;
@@ -60,12 +99,13 @@ namespace jge
 		std::vector<glm::vec3> m_normals;
 		std::vector<glm::vec3> m_tangents;
 		std::vector<glm::vec3> m_bitangents;
+		std::vector<GLuint> m_indices;
 
 		// The handle to the uploaded data
 		GLuint m_vertexbuffer;
 		GLuint m_uvbuffer;
 		GLuint m_normalbuffer;
-		GLuint m_tangentbuffer;
-		GLuint m_bitangentbuffer;
+		GLuint m_tangentbuffer;				// with the bitangent sign in w
+		GLuint m_indexbuffer;
 	};
 }
\ No newline at end of file
@@ -21,6 +21,9 @@ namespace jge
 		, m_isGlowing(false)
 		, m_shader(nullptr)
 		, m_blendMode(BlendMode::NORMAL)
+		, m_normalMap(0)
+		, m_specularMap(0)
+		, m_inView(true)
 	{
 		m_meshes[0] = defaultMesh;
 		m_meshes[1] = nullptr;
@@ -32,6 +35,7 @@ namespace jge
 		textureTransforms[1] = mat3();
 
 		memset(&m_useNormalMap, 0, sizeof(bool) * MAX_LOD_LEVELS);
+		memset(&m_useSpecularMap, 0, sizeof(bool) * MAX_LOD_LEVELS);
 	}
 
 
@@ -210,6 +214,20 @@ namespace jge
 		return modelPos;
 	}
 
+	float Model::GetBoundingRadius() const
+	{
+		float radius = 0.0f;
+		for (int i = 0; i < MAX_LOD_LEVELS; ++i)
+		{
+			if (m_meshes[i] != nullptr)
+				radius = glm::max(radius, m_meshes[i]->GetBoundingRadius());
+		}
+
+		// Scaled by the longest axis of the model
+		float scale = glm::max(length(vec3(modelMatrix[0])), glm::max(length(vec3(modelMatrix[1])), length(vec3(modelMatrix[2]))));
+		return radius * scale;
+	}
+
 	void Model::SetShader(ShaderProgram* shdr)
 	{
 		m_shader = shdr;
@@ -31,6 +31,9 @@ namespace jge
 
 		glm::vec3 GetPosition() const;
 
+		// Radius of a sphere around GetPosition() that holds every LOD mesh
+		float GetBoundingRadius() const;
+
 		void SetLODMesh(Mesh* m, int level);
 		Mesh* GetLODMesh(int level) const;
 
@@ -82,6 +85,9 @@ namespace jge
 
         inline float& DistanceToCamera() { return m_distToCam; }
 
+		// Set by the scene each frame, false if the bounding sphere is outside of the cameras view
+		inline bool& InView() { return m_inView; }
+
 
 		glm::mat4 modelMatrix;
 		glm::mat3 textureTransforms[MAX_TEXTURES];
@@ -107,5 +113,6 @@ namespace jge
         ShaderProgram* m_shader;
 
         float m_distToCam;
+		bool m_inView;
 	};
 }
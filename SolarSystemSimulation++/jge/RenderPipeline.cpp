@@ -1,67 +1,92 @@
 #include "RenderPipeline.h"
 #include "ShaderProgram.h"
 #include "Model.h"
+#include "InstancedModel.h"
 #include "Mesh.h"
+#include "Frustum.h"
 
 #include <glm/gtx/transform.hpp>
+#include <algorithm>
+#include <string.h>
+#include <math.h>
 
 using namespace jge;
 using namespace glm;
 
-// World-View-Projection Matrix uniforms
-const std::string UF_VIEW_MATRIX = "view";
-const std::string UF_PROJECTION_MATRIX = "proj";
-const std::string UF_MODEL_MATRIX = "model";
+// Model Matrix uniform, view and projection are in the CameraBlock
+const Uniform<mat4> UF_MODEL_MATRIX("model");
 
-const std::string UF_BLENDMODE = "blendMode";
-const std::string UF_TEXSAMPLER[] = { "textureSampler0", "textureSampler1" };
-const std::string UF_TEX_TRANSFORM[] = { "texTransform[0]", "texTransform[1]" };
-const std::string UF_USETEX[] = { "useTexture[0]", "useTexture[1]" };
+const Uniform<int> UF_BLENDMODE("blendMode");
+const Uniform<int> UF_TEXSAMPLER[] = { Uniform<int>("textureSampler0"), Uniform<int>("textureSampler1") };
+const Uniform<mat3> UF_TEX_TRANSFORM[] = { Uniform<mat3>("texTransform[0]"), Uniform<mat3>("texTransform[1]") };
+const Uniform<int> UF_USETEX[] = { Uniform<int>("useTexture[0]"), Uniform<int>("useTexture[1]") };
 
 // Mastershader options
-const std::string UF_LIGHT_NUM = "numberOfLights";
-const std::string UF_LIGHT_DISABLE = "excludeFromLighting";
-const std::string UF_SOLIDCOLOR = "modelColor";
-const std::string UF_SOLIDCOLOR_ENABLE = "useColor";
-const std::string UF_NORMALMAPPING_ENABLE = "useNormalMapping";
-const std::string UF_NORMALSAMPLER = "normalTexSampler";
-const std::string UF_SPECULARMAPPING_ENABLE = "useSpecularMapping";
-const std::string UF_SPECULARSAMPLER = "specularTexSampler";
-const std::string UF_SHADOWSAMPLER[] = { "shadowCubes[0]", "shadowCubes[1]", "shadowCubes[2]", "shadowCubes[3]" };
-const std::string UF_VIEW_POS = "viewPosition";
+const Uniform<int> UF_LIGHT_DISABLE("excludeFromLighting");
+const Uniform<vec4> UF_SOLIDCOLOR("modelColor");
+const Uniform<int> UF_SOLIDCOLOR_ENABLE("useColor");
+const Uniform<int> UF_NORMALMAPPING_ENABLE("useNormalMapping");
+const Uniform<int> UF_NORMALSAMPLER("normalTexSampler");
+const Uniform<int> UF_SPECULARMAPPING_ENABLE("useSpecularMapping");
+const Uniform<int> UF_SPECULARSAMPLER("specularTexSampler");
+const Uniform<int> UF_SHADOWSAMPLER[] = { Uniform<int>("shadowCubes[0]"), Uniform<int>("shadowCubes[1]"), Uniform<int>("shadowCubes[2]"), Uniform<int>("shadowCubes[3]") };
+
+// Instanced drawing
+const Uniform<int> UF_USE_INSTANCES("useInstances");
+const Uniform<int> UF_COLOR_LAYERS("colorLayers");
+const Uniform<int> UF_DATA_LAYERS("dataLayers");
 
 // Shadowshader options
-const std::string UF_LIGHT_VIEW = "cameraToShadowView";
-const std::string UF_LIGHT_PROJECTION = "cameraToShadowProjector";
+const Uniform<mat4> UF_LIGHT_VIEW[] = { Uniform<mat4>("cameraToShadowView[0]"), Uniform<mat4>("cameraToShadowView[1]"), Uniform<mat4>("cameraToShadowView[2]"),
+	Uniform<mat4>("cameraToShadowView[3]"), Uniform<mat4>("cameraToShadowView[4]"), Uniform<mat4>("cameraToShadowView[5]") };
+const Uniform<mat4> UF_LIGHT_PROJECTION[] = { Uniform<mat4>("cameraToShadowProjector[0]"), Uniform<mat4>("cameraToShadowProjector[1]"), Uniform<mat4>("cameraToShadowProjector[2]"),
+	Uniform<mat4>("cameraToShadowProjector[3]"), Uniform<mat4>("cameraToShadowProjector[4]"), Uniform<mat4>("cameraToShadowProjector[5]") };
 
 // Skybox options
-const std::string UF_BRIGHTNESS = "brightness";
+const Uniform<float> UF_BRIGHTNESS("brightness");
 
 // Blurshader options
-const std::string UF_BLURSCALE = "ScaleU";
-const std::string UF_SKYBOX_SAMPLER = "skyboxTex";
+const Uniform<vec2> UF_BLURSCALE("ScaleU");
+const Uniform<int> UF_SKYBOX_SAMPLER("skyboxTex");
 
-// Uniform Map for the lights. Memory vs. Performance - lookup is faster than string concat.
-const std::string umapLightPosition[] = { "lights[0].position", "lights[1].position", "lights[2].position", "lights[3].position" };
-const std::string umapAmbientColor[] = { "lights[0].ambient", "lights[1].ambient", "lights[2].ambient", "lights[3].ambient" };
-const std::string umapDiffuseColor[] = { "lights[0].diffuse", "lights[1].diffuse", "lights[2].diffuse", "lights[3].diffuse" };
-const std::string umapSpecularColor[] = { "lights[0].specular", "lights[1].specular", "lights[2].specular", "lights[3].specular" };
-
-const std::string umapConstAtt[] = { "lights[0].constantAttenuation", "lights[1].constantAttenuation", "lights[2].constantAttenuation", "lights[3].constantAttenuation" };
-const std::string umapLinAtt[] = { "lights[0].linearAttenuation", "lights[1].linearAttenuation", "lights[2].linearAttenuation", "lights[3].linearAttenuation" };
-const std::string umapQuadAtt[] = { "lights[0].quadraticAttenuation", "lights[1].quadraticAttenuation", "lights[2].quadraticAttenuation", "lights[3].quadraticAttenuation" };
+#define MSAA_SAMPLES 4
+#define MAX_BATCH_INSTANCES 64		// size of the instances array in master.vert and vsm.vert
 
-const std::string umapSpotCosCutoff[] = { "lights[0].spotCosCutoff", "lights[1].spotCosCutoff", "lights[2].spotCosCutoff", "lights[3].spotCosCutoff" };
-const std::string umapSpotExponent[] = { "lights[0].spotExponent", "lights[1].spotExponent", "lights[2].spotExponent", "lights[3].spotExponent" };
-const std::string umapSpotDirection[] = { "lights[0].spotDirection", "lights[1].spotDirection", "lights[2].spotDirection", "lights[3].spotDirection" };
+#define SHADOW_NEAR 0.2f
+#define SHADOW_FAR 300.0f
+#define SHADOW_ALL_SIDES 0x3F
+#define SHADOW_CACHE_TEXELS 0.25f		// a caster moving less than this keeps the cached sides
+#define SHADOW_PRIORITY_SIZE 16.0f		// how much faster the sides of casters filling the view age
 
-#define MSAA_SAMPLES 4
+static int CountSides(int sides)
+{
+	int count = 0;
+	for (; sides != 0; sides &= sides - 1)
+		++count;
+	return count;
+}
 
 RenderPipeline::RenderPipeline(Scene* _scene)
 	: shadowmapSize(768)
 	, scene(_scene)
 	, brightness(60)
+	, shadowMode(SHADOW_CUBE_MAPS)
+	, shadowSideBudget(0)
+	, shadowSidesRendered(0)
+	, shadowInstanceBuffer(0)
+	, opaqueInstanceBuffer(0)
+	, uniformBufferAlignment(256)
+	, colorArray(0)
+	, dataArray(0)
+	, drawCalls(0)
+	, cameraBuffer(0)
+	, lightBuffer(0)
+	, occluderBuffer(0)
 {
+	for (int i = 0; i < MAX_LIGHTS; ++i)
+		shadowCubes[i] = CubeFramebuffer();
+	InvalidateShadowCaches();
+
 	// for the multisampled scene framebuffer
 	glEnable(GL_MULTISAMPLE);
 
@@ -86,10 +111,15 @@ RenderPipeline::~RenderPipeline()
 	FramebufferTools::DeleteFramebuffer(blurFramebuffer);
 	FramebufferTools::DeleteFramebuffer(msaaResultFramebuffer);
 
-	for(unsigned int i = 0; i < scene->lights.size(); ++i)
-	{
-		FramebufferTools::DeleteFramebufferCube(shadowCubes[i]);
-	}
+	DeleteShadowCubes();
+
+	glDeleteBuffers(1, &shadowInstanceBuffer);
+	glDeleteBuffers(1, &opaqueInstanceBuffer);
+	glDeleteBuffers(1, &cameraBuffer);
+	glDeleteBuffers(1, &lightBuffer);
+	glDeleteBuffers(1, &occluderBuffer);
+	glDeleteTextures(1, &colorArray);
+	glDeleteTextures(1, &dataArray);
 }
 
 void RenderPipeline::SetBrightness(int brightness)
@@ -122,21 +152,88 @@ void RenderPipeline::SetSize(int w, int h)
 void RenderPipeline::Build()
 {
 	// Shadow Map
-	lightingShader->UseProgram();
-    lightingShader->UpdateUniform(UF_LIGHT_NUM, (int)scene->lights.size());
-
-	for (unsigned int i = 0; i < scene->lights.size(); ++i)
-	{
-		// Create a shadow cube for the light. TODO: Create simple texures for spotlights...
-		GLuint tex = FramebufferTools::MakeCubeTexture_Color(shadowmapSize);
-		GLuint depth = FramebufferTools::MakeCubeTexture_Depth(shadowmapSize);
-		shadowCubes[i] = FramebufferTools::MakeFramebufferCube(tex, depth);
-	}
+	if (shadowMode == SHADOW_CUBE_MAPS)
+		CreateShadowCubes();
 
 	sceneFramebuffer = FramebufferTools::CreateFramebuffer(sceneW, sceneH, true, MSAA_SAMPLES);
 	msaaResultFramebuffer = FramebufferTools::CreateFramebuffer(sceneW, sceneH, true);	// has to have a depth buffer too!
 	glowFramebuffer = FramebufferTools::CreateFramebuffer(glowW, glowH, true);
 	blurFramebuffer = FramebufferTools::CreateFramebuffer(glowW, glowH, false);
+
+	// Uniform buffers for the instances of the batched draws
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformBufferAlignment);
+	glGenBuffers(1, &shadowInstanceBuffer);
+	glGenBuffers(1, &opaqueInstanceBuffer);
+
+	// The shared uniform blocks stay bound to their binding points
+	glGenBuffers(1, &cameraBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, cameraBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraData), NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, UB_BINDING_CAMERA, cameraBuffer);
+
+	glGenBuffers(1, &lightBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, lightBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(LightBlockData), NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, UB_BINDING_LIGHTS, lightBuffer);
+
+	glGenBuffers(1, &occluderBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, occluderBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(OccluderBlockData), NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, UB_BINDING_OCCLUDERS, occluderBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// Copies the textures into an array as large as the largest of them
+static GLuint CreateLayers(const std::vector<GLuint>& textures, int maxSize, bool srgbInternal)
+{
+	GLint width = 1, height = 1;
+	for (GLuint tex : textures)
+	{
+		GLint w, h;
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+		width = glm::max(width, w);
+		height = glm::max(height, h);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	return Texture::CreateTextureArray(textures.data(), (int)textures.size(),
+		glm::min(width, (GLint)maxSize), glm::min(height, (GLint)maxSize), srgbInternal);
+}
+
+void RenderPipeline::BuildTextureArrays(int maxSize)
+{
+	glDeleteTextures(1, &colorArray);
+	glDeleteTextures(1, &dataArray);
+	colorLayers.clear();
+	dataLayers.clear();
+
+	auto addLayer = [](std::vector<GLuint>& layers, GLuint tex)
+	{
+		if (tex > 0 && std::find(layers.begin(), layers.end(), tex) == layers.end())
+			layers.push_back(tex);
+	};
+
+	// Only models of the default shader are batched
+	for (unsigned int i = 0; i < scene->opaqueModels.size(); ++i)
+	{
+		Model* m = scene->opaqueModels[i];
+		if (m->GetShader() != nullptr)
+			continue;
+
+		if (m->IsUsingTexture())
+		{
+			addLayer(colorLayers, m->textures[0]);
+			addLayer(colorLayers, m->textures[1]);
+		}
+		addLayer(colorLayers, m->GetSpecularMap());
+		addLayer(dataLayers, m->GetNormalMap());
+	}
+
+	// Specular maps are loaded as sRGB like the color textures, normal maps linear
+	colorArray = CreateLayers(colorLayers, maxSize, true);
+	dataArray = CreateLayers(dataLayers, maxSize, false);
 }
 
 void RenderPipeline::SupplyShaders(
@@ -160,6 +257,8 @@ void RenderPipeline::SupplyShaders(
 	lightingShader->UpdateUniform(UF_TEXSAMPLER[1], 5);
 	lightingShader->UpdateUniform(UF_NORMALSAMPLER, 6);
 	lightingShader->UpdateUniform(UF_SPECULARSAMPLER, 7);
+	lightingShader->UpdateUniform(UF_COLOR_LAYERS, 8);
+	lightingShader->UpdateUniform(UF_DATA_LAYERS, 9);
 
 	blurShader = blur;
 	blurShader->UseProgram();
@@ -181,42 +280,121 @@ void RenderPipeline::SupplyShaders(
 void RenderPipeline::ChangeShadowmapSize(int newSize)
 {
 	shadowmapSize = newSize;
+	if (shadowMode != SHADOW_CUBE_MAPS)
+		return;
+
+	DeleteShadowCubes();
+	CreateShadowCubes();
+}
+
+void RenderPipeline::SetShadowMode(ShadowMode mode)
+{
+	if (mode == shadowMode)
+		return;
+
+	shadowMode = mode;
+	if (shadowMode == SHADOW_CUBE_MAPS)
+		CreateShadowCubes();
+	else DeleteShadowCubes();
+}
+
+void RenderPipeline::CreateShadowCubes()
+{
 	for (unsigned int i = 0; i < scene->lights.size(); ++i)
 	{
-		FramebufferTools::DeleteFramebufferCube(shadowCubes[i]);
-
+		// Create a shadow cube for the light. TODO: Create simple texures for spotlights...
 		GLuint tex = FramebufferTools::MakeCubeTexture_Color(shadowmapSize);
 		GLuint depth = FramebufferTools::MakeCubeTexture_Depth(shadowmapSize);
 		shadowCubes[i] = FramebufferTools::MakeFramebufferCube(tex, depth);
 	}
+	InvalidateShadowCaches();
+}
+
+void RenderPipeline::DeleteShadowCubes()
+{
+	for (int i = 0; i < MAX_LIGHTS; ++i)
+	{
+		FramebufferTools::DeleteFramebufferCube(shadowCubes[i]);
+		shadowCubes[i] = CubeFramebuffer();
+	}
+}
+
+void RenderPipeline::InvalidateShadowCaches()
+{
+	for (int i = 0; i < MAX_LIGHTS; ++i)
+	{
+		for (int side = 0; side < 6; ++side)
+		{
+			shadowCaches[i].valid[side] = false;
+			shadowCaches[i].waited[side] = 0;
+			shadowCaches[i].casters[side].clear();
+		}
+	}
+}
+
+void RenderPipeline::UpdateCamera()
+{
+	CameraData camera;
+	camera.view = scene->camera->GetViewMatrix();
+	camera.proj = scene->camera->GetProjectionMatrix();
+	camera.viewPosition = vec4(scene->camera->GetPosition(), 0.0f);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, cameraBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CameraData), &camera);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
 void RenderPipeline::UpdateLights()
 {
-	lightingShader->UseProgram();
+	LightBlockData block;
+	memset(&block, 0, sizeof(block));
+	block.numberOfLights = (int)scene->lights.size();
 	for (unsigned int i = 0; i < scene->lights.size(); ++i)
 	{
-		float constAtt;
-		float linearAtt;
-		float quadricAtt;
-		scene->lights[i]->GetAttenuation(constAtt, linearAtt, quadricAtt);
+		LightData& light = block.lights[i];
+		scene->lights[i]->GetAttenuation(light.constantAttenuation, light.linearAttenuation, light.quadraticAttenuation);
+		scene->lights[i]->GetSpotProperties(light.spotCosCutoff, light.spotExponent, light.spotDirection);	// shader checks for cos(180) = -1;
+		light.position = scene->lights[i]->GetPosition();
+		light.ambient = scene->lights[i]->GetColor(LightComponent::AMBIENT);
+		light.diffuse = scene->lights[i]->GetColor(LightComponent::DIFFUSE);
+		light.specular = scene->lights[i]->GetColor(LightComponent::SPECULAR);
+	}
 
-		float cutoff;
-		float exponent;
-		vec3 direction;
-		scene->lights[i]->GetSpotProperties(cutoff, exponent, direction);
+	glBindBuffer(GL_UNIFORM_BUFFER, lightBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(LightBlockData), &block);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
 
-		lightingShader->UpdateUniform(umapLightPosition[i], scene->lights[i]->GetPosition());
-		lightingShader->UpdateUniform(umapAmbientColor[i], scene->lights[i]->GetColor(LightComponent::AMBIENT));
-		lightingShader->UpdateUniform(umapDiffuseColor[i], scene->lights[i]->GetColor(LightComponent::DIFFUSE));
-		lightingShader->UpdateUniform(umapSpecularColor[i], scene->lights[i]->GetColor(LightComponent::SPECULAR));
-		lightingShader->UpdateUniform(umapConstAtt[i], constAtt);
-		lightingShader->UpdateUniform(umapLinAtt[i], linearAtt);
-		lightingShader->UpdateUniform(umapQuadAtt[i], quadricAtt);
-		lightingShader->UpdateUniform(umapSpotCosCutoff[i], cutoff);	// shader checks for cos(180) = -1;
-		lightingShader->UpdateUniform(umapSpotExponent[i], exponent);
-		lightingShader->UpdateUniform(umapSpotDirection[i], direction);
+void RenderPipeline::UpdateOccluders()
+{
+	OccluderBlockData block;
+	memset(&block, 0, sizeof(block));
+	block.useAnalyticShadows = shadowMode == SHADOW_ANALYTIC;
+	if (block.useAnalyticShadows)
+	{
+		for (unsigned int i = 0; i < scene->shadowCastingModels.size(); ++i)
+		{
+			const vec3 center = scene->shadowCastingModels[i]->GetPosition();
+			const float radius = scene->shadowCastingModels[i]->GetBoundingRadius();
+
+			// A caster around a light is its body, it softens the shadows of the light
+			bool aroundLight = false;
+			for (unsigned int j = 0; j < scene->lights.size() && j < MAX_LIGHTS; ++j)
+			{
+				if (length(center - vec3(scene->lights[j]->GetPosition())) <= radius)
+				{
+					block.lightRadii[j] = glm::max(block.lightRadii[j], radius);
+					aroundLight = true;
+				}
+			}
+			if (!aroundLight && block.numberOfOccluders < MAX_OCCLUDERS)
+				block.occluders[block.numberOfOccluders++] = vec4(center, radius);
+		}
 	}
+
+	glBindBuffer(GL_UNIFORM_BUFFER, occluderBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(OccluderBlockData), &block);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
 
@@ -224,7 +402,7 @@ void RenderPipeline::GetLightMatrices(int dir, glm::vec3 lightPos, glm::mat4& pr
 {
 	glm::mat4 mat, view;
 
-	mat *= glm::perspective(glm::radians(90.0f), 1.0f, 0.2f, 300.0f);
+	mat *= glm::perspective(glm::radians(90.0f), 1.0f, SHADOW_NEAR, SHADOW_FAR);
 	switch (dir) {
 	case 0:
 		// +X
@@ -265,16 +443,207 @@ void RenderPipeline::GetLightMatrices(int dir, glm::vec3 lightPos, glm::mat4& pr
 }
 
 
-void RenderPipeline::DrawShadowCastingModels(ShaderProgram* shader)
+void RenderPipeline::UpdateShadowCasterBounds()
+{
+	const std::vector<Model*>& models = scene->shadowCastingModels;
+	shadowBoundsX.resize(models.size());
+	shadowBoundsY.resize(models.size());
+	shadowBoundsZ.resize(models.size());
+	shadowBoundsRadius.resize(models.size());
+	for (unsigned int i = 0; i < models.size(); ++i)
+	{
+		const vec3 position = models[i]->GetPosition();
+		shadowBoundsX[i] = position.x;
+		shadowBoundsY[i] = position.y;
+		shadowBoundsZ[i] = position.z;
+		shadowBoundsRadius[i] = models[i]->GetBoundingRadius();
+	}
+
+	if (shadowCasterPositions.size() != models.size())
+	{
+		// New or removed casters, start over
+		shadowCasterPositions.resize(models.size());
+		shadowCasterVelocities.assign(models.size(), vec3(0.0f));
+		for (unsigned int i = 0; i < models.size(); ++i)
+			shadowCasterPositions[i] = models[i]->GetPosition();
+		return;
+	}
+
+	for (unsigned int i = 0; i < models.size(); ++i)
+	{
+		const vec3 position = models[i]->GetPosition();
+		shadowCasterVelocities[i] = position - shadowCasterPositions[i];
+		shadowCasterPositions[i] = position;
+	}
+}
+
+void RenderPipeline::CollectShadowCasters(int light, const glm::vec3& lightPos, const glm::mat4* projectionMatrices)
+{
+	// One frustum test of all casters per side
+	const size_t count = scene->shadowCastingModels.size();
+	shadowCullResults.resize(6 * count);
+	for (int side = 0; side < 6; ++side)
+	{
+		const Frustum frustum(projectionMatrices[side]);
+		frustum.CullSpheres(shadowBoundsX.data(), shadowBoundsY.data(), shadowBoundsZ.data(), shadowBoundsRadius.data(), count, &shadowCullResults[side * count]);
+	}
+
+	std::vector<ShadowCaster>& casters = shadowCasters[light];
+	casters.clear();
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		Model* m = scene->shadowCastingModels[i];
+		ShadowCaster caster;
+		caster.model = m;
+		caster.mesh = m->GetLODMesh(scene->DetermineLODLevel(*m));
+		caster.center = shadowCasterPositions[i] - lightPos;
+		caster.velocity = shadowCasterVelocities[i];
+		caster.radius = shadowBoundsRadius[i];
+		caster.sides = 0;
+
+		// A caster around the light (the sun) would darken every side
+		if (length(caster.center) <= caster.radius)
+			continue;
+
+		for (int side = 0; side < 6; ++side)
+		{
+			if (shadowCullResults[side * count + i])
+				caster.sides |= 1 << side;
+		}
+		if (caster.sides != 0)
+			casters.push_back(caster);
+	}
+}
+
+bool RenderPipeline::IsShadowSideCurrent(int light, int side) const
+{
+	// Both lists are in the order of the scenes shadow casters
+	const std::vector<ShadowCaster>& casters = shadowCasters[light];
+	const std::vector<ShadowCaster>& cached = shadowCaches[light].casters[side];
+	unsigned int k = 0;
+	for (unsigned int i = 0; i < casters.size(); ++i)
+	{
+		const ShadowCaster& caster = casters[i];
+		if ((caster.sides & (1 << side)) == 0)
+			continue;
+		if (k == cached.size())
+			return false;
+
+		const ShadowCaster& old = cached[k++];
+		if (caster.model != old.model || caster.mesh != old.mesh)
+			return false;
+
+		// Movement in texels at the near end of the caster, the rotation is ignored as the casters are spheres
+		const float texel = 2.0f * glm::max(length(caster.center) - caster.radius, SHADOW_NEAR) / shadowmapSize;
+		if (length(caster.center - old.center) > SHADOW_CACHE_TEXELS * texel || fabs(caster.radius - old.radius) > SHADOW_CACHE_TEXELS * texel)
+			return false;
+	}
+	return k == cached.size();
+}
+
+float RenderPipeline::GetShadowSidePriority(int light, int side) const
+{
+	// Sides age by one each frame they wait, faster if a caster looks large from the camera
+	const vec3 cameraToLight = vec3(scene->lights[light]->GetPosition()) - scene->camera->GetPosition();
+	const std::vector<ShadowCaster>& casters = shadowCasters[light];
+	float size = 0.0f;
+	for (unsigned int i = 0; i < casters.size(); ++i)
+	{
+		if ((casters[i].sides & (1 << side)) == 0)
+			continue;
+		const float distance = length(cameraToLight + casters[i].center);
+		size = glm::max(size, casters[i].radius / glm::max(distance, casters[i].radius));
+	}
+	return (shadowCaches[light].waited[side] + 1) * (1.0f + SHADOW_PRIORITY_SIZE * size);
+}
+
+void RenderPipeline::DrawShadowCastingModels()
 {
-	Model* m;
 	glEnable(GL_CULL_FACE);
-	for (unsigned int i = 0; i < scene->shadowCastingModels.size(); ++i)
+	DrawBatches(shadowBatches, shadowInstanceBuffer);
+}
+
+bool RenderPipeline::FillInstanceData(Model& m, int lvl, InstanceData& data) const
+{
+	auto layerOf = [](const std::vector<GLuint>& layers, GLuint tex)
 	{
-		m = scene->shadowCastingModels[i];
-		shader->UpdateUniform(UF_MODEL_MATRIX, m->modelMatrix);
-		int lvl = scene->DetermineLODLevel(*m);
-		m->Draw(lvl);
+		std::vector<GLuint>::const_iterator it = std::find(layers.begin(), layers.end(), tex);
+		return it != layers.end() ? (int)(it - layers.begin()) : -1;
+	};
+
+	data.model = m.modelMatrix;
+	for (int t = 0; t < MAX_TEXTURES; ++t)
+	{
+		for (int c = 0; c < 3; ++c)
+			data.texTransforms[t * 3 + c] = vec4(m.textureTransforms[t][c], 0.0f);
+	}
+	data.layers = ivec4(-1);
+	data.options = ivec4(!m.IsUsingTexture(), (int)m.GetBlendMode(), !m.IsAffectedByLighting(), 0);
+	data.color = m.GetColor();
+
+	if (m.IsUsingTexture())
+	{
+		data.layers.x = layerOf(colorLayers, m.textures[0]);
+		if (data.layers.x < 0)
+			return false;
+		if (m.textures[1] > 0 && (data.layers.y = layerOf(colorLayers, m.textures[1])) < 0)
+			return false;
+	}
+	if (m.IsUsingNormalMap(lvl) && (data.layers.z = layerOf(dataLayers, m.GetNormalMap())) < 0)
+		return false;
+	if (m.IsUsingSpecularMap(lvl) && (data.layers.w = layerOf(colorLayers, m.GetSpecularMap())) < 0)
+		return false;
+	return true;
+}
+
+void RenderPipeline::AddToBatch(std::vector<InstanceBatch>& batches, Mesh* mesh, const InstanceData& data)
+{
+	// There are only a few meshes, a linear search is fine
+	for (unsigned int i = 0; i < batches.size(); ++i)
+	{
+		if (batches[i].mesh == mesh && batches[i].instances.size() < MAX_BATCH_INSTANCES)
+		{
+			batches[i].instances.push_back(data);
+			return;
+		}
+	}
+
+	InstanceBatch batch;
+	batch.mesh = mesh;
+	batch.offset = 0;
+	batch.instances.push_back(data);
+	batches.push_back(batch);
+}
+
+void RenderPipeline::UploadBatches(std::vector<InstanceBatch>& batches, GLuint buffer)
+{
+	if (batches.empty())
+		return;
+
+	// The shader reads the whole array, so every batch gets a full block at an aligned offset
+	const GLsizeiptr blockSize = sizeof(InstanceData) * MAX_BATCH_INSTANCES;
+	const GLsizeiptr stride = (blockSize + uniformBufferAlignment - 1) / uniformBufferAlignment * uniformBufferAlignment;
+	instanceUpload.resize(batches.size() * stride);
+	for (unsigned int i = 0; i < batches.size(); ++i)
+	{
+		batches[i].offset = i * stride;
+		memcpy(&instanceUpload[batches[i].offset], batches[i].instances.data(), batches[i].instances.size() * sizeof(InstanceData));
+	}
+
+	// Orphan the old storage, the previous frame may still read it
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferData(GL_UNIFORM_BUFFER, instanceUpload.size(), instanceUpload.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void RenderPipeline::DrawBatches(const std::vector<InstanceBatch>& batches, GLuint buffer)
+{
+	const GLsizeiptr blockSize = sizeof(InstanceData) * MAX_BATCH_INSTANCES;
+	for (unsigned int i = 0; i < batches.size(); ++i)
+	{
+		glBindBufferRange(GL_UNIFORM_BUFFER, UB_BINDING_INSTANCES, buffer, batches[i].offset, blockSize);
+		batches[i].mesh->DrawInstanced((int)batches[i].instances.size());
+		++drawCalls;
 	}
 }
 
@@ -330,6 +699,7 @@ void RenderPipeline::DrawModelMinimal(ShaderProgram& shader, Model& m, int lvl)
 	// upload model position
 	shader.UpdateUniform(UF_MODEL_MATRIX, m.modelMatrix);
 	m.Draw(lvl);
+	++drawCalls;
 }
 
 void RenderPipeline::DrawNonShadowCastingModels(ShaderProgram* defaultShader)
@@ -337,37 +707,60 @@ void RenderPipeline::DrawNonShadowCastingModels(ShaderProgram* defaultShader)
 	Model* m;
 	ShaderProgram* currentShader = nullptr;
 	ShaderProgram* lastShader = nullptr;
+	InstanceData instance;
+	opaqueBatches.clear();
 
-
-	// Render front to back to allow early Z test
-	// unsigned iterator, beware wrap around
-	for (unsigned int i = scene->opaqueModels.size(); i--;)
+	// Render front to back to allow early Z test, the queue groups the models by state
+	const std::vector<Model*>& opaqueModels = scene->renderQueue.GetModels(RenderQueue::PASS_OPAQUE);
+	for (unsigned int i = 0; i < opaqueModels.size(); ++i)
 	{
-		m = scene->opaqueModels[i];
+		m = opaqueModels[i];
 
 		currentShader = m->GetShader();
 		if (currentShader == nullptr)
 			currentShader = defaultShader;
 
-		if (currentShader != lastShader)
+		// Models of the default shader are collected and drawn instanced below,
+		// the batches keep the front to back order of their first model
+		int lvl = scene->DetermineLODLevel(*m);
+		if (currentShader == defaultShader && FillInstanceData(*m, lvl, instance))
 		{
-			currentShader->UseProgram();
-			currentShader->UpdateUniform(UF_VIEW_MATRIX, scene->camera->GetViewMatrix());
-			currentShader->UpdateUniform(UF_PROJECTION_MATRIX, scene->camera->GetProjectionMatrix());
+			AddToBatch(opaqueBatches, m->GetLODMesh(lvl), instance);
+			continue;
 		}
 
-		int lvl = scene->DetermineLODLevel(*m);
+		if (currentShader != lastShader)
+			currentShader->UseProgram();
+
 		DrawModel(*currentShader, *m, lvl);
 
 		lastShader = currentShader;
 	}
 
+	if (!opaqueBatches.empty())
+	{
+		UploadBatches(opaqueBatches, opaqueInstanceBuffer);
+
+		defaultShader->UseProgram();
+		defaultShader->UpdateUniform(UF_USE_INSTANCES, 1);
+		glActiveTexture(GL_TEXTURE8);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, colorArray);
+		glActiveTexture(GL_TEXTURE9);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, dataArray);
+		DrawBatches(opaqueBatches, opaqueInstanceBuffer);
+		defaultShader->UpdateUniform(UF_USE_INSTANCES, 0);
+	}
+
+	DrawInstancedModels();
+	lastShader = nullptr;
+
 	glDisable(GL_CULL_FACE);
 
 	// Render transparent models back to front for correct visibility
-	for (unsigned int i = 0; i < scene->transparentModels.size(); ++i)
+	const std::vector<Model*>& transparentModels = scene->renderQueue.GetModels(RenderQueue::PASS_TRANSPARENT);
+	for (unsigned int i = 0; i < transparentModels.size(); ++i)
 	{
-		m = scene->transparentModels[i];
+		m = transparentModels[i];
 
         currentShader = m->GetShader();
         if (currentShader == nullptr)
@@ -378,8 +771,6 @@ void RenderPipeline::DrawNonShadowCastingModels(ShaderProgram* defaultShader)
             currentShader->UseProgram();
             // normal draw is too much, minimal not enough...
             currentShader->UpdateUniform(UF_LIGHT_DISABLE, !m->IsAffectedByLighting());
-            currentShader->UpdateUniform(UF_VIEW_MATRIX, scene->camera->GetViewMatrix());
-            currentShader->UpdateUniform(UF_PROJECTION_MATRIX, scene->camera->GetProjectionMatrix());
         }
 
         int lvl = scene->DetermineLODLevel(*m);
@@ -389,35 +780,157 @@ void RenderPipeline::DrawNonShadowCastingModels(ShaderProgram* defaultShader)
 	}
 }
 
+void RenderPipeline::DrawInstancedModels()
+{
+	// Instanced models bring their own shader and are lit by the first light only
+	ShaderProgram* lastShader = nullptr;
+	for (unsigned int i = 0; i < scene->instancedModels.size(); ++i)
+	{
+		InstancedModel* m = scene->instancedModels[i];
+		ShaderProgram* shader = m->GetShader();
+		if (shader == nullptr)
+			continue;
+
+		if (shader != lastShader)
+		{
+			shader->UseProgram();
+			lastShader = shader;
+		}
+
+		shader->UpdateUniform(UF_MODEL_MATRIX, m->modelMatrix);
+		m->Draw();
+		++drawCalls;
+	}
+}
+
 void RenderPipeline::ShadowPass()
 {
 	glDisable(GL_BLEND);
 	glViewport(0, 0, shadowmapSize, shadowmapSize);
-
 	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	shadowShader->UseProgram();
+	shadowSidesRendered = 0;
+	UpdateShadowCasterBounds();
+
+	// Find the sides of every light whose casters changed
+	const int lightCount = glm::min((int)scene->lights.size(), MAX_LIGHTS);
+	glm::mat4 lightViewMatrices[MAX_LIGHTS][6], lightProjectionMatrices[MAX_LIGHTS][6];
+	unsigned int forcedCount = 0;
+	shadowRequests.clear();
+	for (int i = 0; i < lightCount; ++i)
+	{
+		const vec3 lightPos = vec3(scene->lights[i]->GetPosition());
+		for (int side = 0; side < 6; ++side)
+			GetLightMatrices(side, lightPos, lightProjectionMatrices[i][side], lightViewMatrices[i][side]);
+
+		CollectShadowCasters(i, lightPos, lightProjectionMatrices[i]);
+
+		for (int side = 0; side < 6; ++side)
+		{
+			ShadowCache& cache = shadowCaches[i];
+			if (cache.valid[side] && IsShadowSideCurrent(i, side))
+			{
+				cache.waited[side] = 0;
+				continue;
+			}
+
+			// Sides without contents are never postponed
+			ShadowSideRequest request = { i, side, !cache.valid[side], GetShadowSidePriority(i, side) };
+			shadowRequests.push_back(request);
+			forcedCount += request.forced;
+		}
+	}
+
+	// Over the budget, the sides with the highest priority are redrawn and the others
+	// keep their stale contents. The redrawn casters are placed ahead on their path
+	// by half the expected wait, so the shadows lead as much as they lag later.
+	float lead = 0.0f;
+	const unsigned int budget = glm::max((unsigned int)shadowSideBudget, forcedCount);
+	if (shadowSideBudget > 0 && shadowRequests.size() > budget)
+	{
+		std::stable_sort(shadowRequests.begin(), shadowRequests.end(), [](const ShadowSideRequest& a, const ShadowSideRequest& b)
+		{
+			return a.forced != b.forced ? a.forced : a.priority > b.priority;
+		});
+
+		lead = 0.5f * shadowRequests.size() / budget;
+		for (unsigned int k = budget; k < shadowRequests.size(); ++k)
+			++shadowCaches[shadowRequests[k].light].waited[shadowRequests[k].side];
+		shadowRequests.resize(budget);
+	}
+
+	// Remember the casters the sides are redrawn with
+	int sides[MAX_LIGHTS] = { 0 };
+	for (unsigned int k = 0; k < shadowRequests.size(); ++k)
+	{
+		const int light = shadowRequests[k].light;
+		const int side = shadowRequests[k].side;
+		ShadowCache& cache = shadowCaches[light];
+		sides[light] |= 1 << side;
+		cache.valid[side] = true;
+		cache.waited[side] = 0;
+		cache.casters[side].clear();
+		for (unsigned int c = 0; c < shadowCasters[light].size(); ++c)
+		{
+			ShadowCaster caster = shadowCasters[light][c];
+			if ((caster.sides & (1 << side)) == 0)
+				continue;
+			caster.center += caster.velocity * lead;
+			cache.casters[side].push_back(caster);
+		}
+	}
 
 	// For each light, we render from every 6 sides into the framebuffer
 	// in order to determine the shadowed areas in the shader later.
-	for (unsigned int i = 0; i < scene->lights.size() && i < MAX_LIGHTS; ++i)
+	// The geometry shader sends the triangles to the sides they cover.
+	for (int i = 0; i < lightCount; ++i)
 	{
-		// For each side of the cubemap (framebuffercube)
-		for (int side = 0; side < 6; ++side)
+		if (sides[i] == 0)
+			continue;
+
+		// Clear the sides, one clear of the layered framebuffer covers all of them
+		if (sides[i] != SHADOW_ALL_SIDES)
 		{
-			// bind side
-			glBindFramebuffer(GL_FRAMEBUFFER, shadowCubes[i].handle[side]);
+			for (int side = 0; side < 6; ++side)
+			{
+				if ((sides[i] & (1 << side)) == 0)
+					continue;
+				glBindFramebuffer(GL_FRAMEBUFFER, shadowCubes[i].handle[side]);
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			}
+			glBindFramebuffer(GL_FRAMEBUFFER, shadowCubes[i].layered);
+		}
+		else
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, shadowCubes[i].layered);
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		}
 
-			// position ourselfs on one side and render
-			glm::mat4 lightViewMatrix, lightProjectionMatrix;
-			GetLightMatrices(side, vec3(scene->lights[i]->GetPosition()), lightProjectionMatrix, lightViewMatrix);
-			shadowShader->UpdateUniform(UF_LIGHT_VIEW, lightViewMatrix);
-			shadowShader->UpdateUniform(UF_LIGHT_PROJECTION, lightProjectionMatrix);
+		// position ourselfs on every side
+		for (int side = 0; side < 6; ++side)
+		{
+			shadowShader->UpdateUniform(UF_LIGHT_VIEW[side], lightViewMatrices[i][side]);
+			shadowShader->UpdateUniform(UF_LIGHT_PROJECTION[side], lightProjectionMatrices[i][side]);
+		}
 
-			DrawShadowCastingModels(shadowShader);
+		// The casters of those sides in one draw per mesh, each instance names its sides to the geometry shader
+		InstanceData instance;
+		shadowBatches.clear();
+		for (unsigned int c = 0; c < shadowCasters[i].size(); ++c)
+		{
+			const ShadowCaster& caster = shadowCasters[i][c];
+			const int casterSides = caster.sides & sides[i];
+			if (casterSides == 0)
+				continue;
+			instance.model = glm::translate(caster.velocity * lead) * caster.model->modelMatrix;
+			instance.options = ivec4(casterSides, 0, 0, 0);
+			AddToBatch(shadowBatches, caster.mesh, instance);
 		}
+		UploadBatches(shadowBatches, shadowInstanceBuffer);
+
+		DrawShadowCastingModels();
+		shadowSidesRendered += CountSides(sides[i]);
 	}
 }
 
@@ -438,19 +951,9 @@ void RenderPipeline::NormalPass(GLuint renderTarget)
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, scene->skyBoxTexture);
 	skyboxShader->UpdateUniform(UF_BRIGHTNESS, brightness * 0.01f / 100.0f);
-	skyboxShader->UpdateUniform(UF_VIEW_MATRIX, scene->camera->GetViewMatrix());
-	skyboxShader->UpdateUniform(UF_PROJECTION_MATRIX, scene->camera->GetProjectionMatrix());
 	fullscreenQuad.Draw();
 	glDepthMask(GL_TRUE);
 
-	// Update Camera / World Position
-	lightingShader->UseProgram();
-	lightingShader->UpdateUniform(UF_VIEW_MATRIX, scene->camera->GetViewMatrix());
-	lightingShader->UpdateUniform(UF_PROJECTION_MATRIX, scene->camera->GetProjectionMatrix());
-	lightingShader->UpdateUniform(UF_VIEW_POS, glm::vec4(scene->camera->GetPosition(),0.0f));
-	// Update Light Position and Uniforms
-	this->UpdateLights();
-
 	// Bind ShadowCubes to the Texture Units
 	for (int i = 0; i < MAX_LIGHTS; ++i)
 	{
@@ -464,8 +967,6 @@ void RenderPipeline::NormalPass(GLuint renderTarget)
 void RenderPipeline::RenderGlowMap()
 {
 	glowmapShader->UseProgram();
-	glowmapShader->UpdateUniform(UF_VIEW_MATRIX, scene->camera->GetViewMatrix());
-	glowmapShader->UpdateUniform(UF_PROJECTION_MATRIX, scene->camera->GetProjectionMatrix());
 
 	glBindFramebuffer(GL_FRAMEBUFFER, glowFramebuffer.handle);
 
@@ -477,9 +978,9 @@ void RenderPipeline::RenderGlowMap()
 	// Only depth buffer gets written
 	glColorMask(false, false, false, false);
 	Model* m;
-	for (unsigned int i = 0; i < scene->nonglowingModels.size(); ++i)
+	for (unsigned int i = 0; i < scene->visibleNonglowingModels.size(); ++i)
 	{
-		m = scene->nonglowingModels[i];
+		m = scene->visibleNonglowingModels[i];
 
 		int lvl = scene->DetermineLODLevel(*m);
 		DrawModelMinimal(*glowmapShader, *m, lvl);
@@ -487,9 +988,9 @@ void RenderPipeline::RenderGlowMap()
 	glColorMask(true, true, true, true);
 
 	// Render glowing objects, depth test will occlude glow
-	for (unsigned int i = 0; i < scene->glowingModels.size(); ++i)
+	for (unsigned int i = 0; i < scene->visibleGlowingModels.size(); ++i)
 	{
-		m = scene->glowingModels[i];
+		m = scene->visibleGlowingModels[i];
 		glowmapShader->UpdateUniform(UF_SOLIDCOLOR, m->GetColor());
 
 		int lvl = scene->DetermineLODLevel(*m);
@@ -537,8 +1038,18 @@ void RenderPipeline::ApplyGlow()
 
 void RenderPipeline::Render()
 {
+	drawCalls = 0;
+	ShaderProgram::ResetUploadCounters();
+
+	// Camera and lights are the same for all passes and shaders
+	UpdateCamera();
+	UpdateLights();
+	UpdateOccluders();
+
 	timerShadowPass.Start();
-	ShadowPass();
+	if (shadowMode == SHADOW_CUBE_MAPS)
+		ShadowPass();
+	else shadowSidesRendered = 0;
 	timerShadowPass.Stop();
 
 	timerNormalPass.Start();
@@ -573,3 +1084,10 @@ unsigned int RenderPipeline::GetTimingShadowPass() const { return timeElapsedSha
 unsigned int RenderPipeline::GetTimingNormalPass() const { return timeElapsedNormalPass; }
 unsigned int RenderPipeline::GetTimingAntialiasing() const { return timeElapsedMSAA; }
 unsigned int RenderPipeline::GetTimingPostProcessing() const { return timeElapsedPost; }
+unsigned int RenderPipeline::GetDrawCallCount() const { return drawCalls; }
+unsigned int RenderPipeline::GetShadowSideCount() const { return shadowSidesRendered; }
+
+void RenderPipeline::SetShadowSideBudget(int sides)
+{
+	shadowSideBudget = sides;
+}
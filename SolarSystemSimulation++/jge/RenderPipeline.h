@@ -6,6 +6,7 @@
 #include "Measurement.h"
 
 #include <glm/glm.hpp>
+#include <vector>
 
 namespace jge
 {
@@ -13,6 +14,14 @@ namespace jge
 	class Model;
 	class Mesh;
 
+	const int MAX_OCCLUDERS = 32;		// size of the occluders array in masterOptimised.frag
+
+	enum ShadowMode
+	{
+		SHADOW_CUBE_MAPS,		// a variance shadow cube per light
+		SHADOW_ANALYTIC			// the lighting shader occludes the lights by the casters as spheres
+	};
+
 	class RenderPipeline
 	{
 	public:
@@ -35,7 +44,22 @@ namespace jge
 
 		// Create all buffers used to render the scene. call last
 		void Build();
+
+		// Copies the textures of the scenes opaque models into texture arrays of at most
+		// <maxSize> texels per side, so models sharing a mesh can be drawn instanced.
+		// Call after the models are added, textured models added later are drawn one by one.
+		void BuildTextureArrays(int maxSize);
+
 		void ChangeShadowmapSize(int shadowMapSz);
+
+		// The analytic mode frees the shadow cubes and skips the shadow pass, for scenes
+		// of spheres lit by point lights or spheres around them (the sun)
+		void SetShadowMode(ShadowMode mode);
+
+		// Redraws at most <sides> changed shadow cube sides per frame over all lights, in the
+		// order they waited, sides with casters close to the camera first. The other sides keep
+		// their last contents. 0 redraws every changed side.
+		void SetShadowSideBudget(int sides);
 		void SetBrightness(int brightness);
 
 		// Renders the scene
@@ -45,18 +69,127 @@ namespace jge
 		unsigned int GetTimingNormalPass() const;
 		unsigned int GetTimingAntialiasing() const;
 		unsigned int GetTimingPostProcessing() const;
+		unsigned int GetDrawCallCount() const;		// of the scenes models in the last frame
+		unsigned int GetShadowSideCount() const;	// shadow cube sides redrawn in the last frame
 
 	private:
-		// Positions the lights in the world
+		// CameraBlock of the shaders (std140)
+		struct CameraData
+		{
+			glm::mat4 view;
+			glm::mat4 proj;
+			glm::vec4 viewPosition;
+		};
+
+		// lightSource of the shaders (std140)
+		struct LightData
+		{
+			glm::vec4 position;
+			glm::vec4 diffuse;
+			glm::vec4 specular;
+			glm::vec4 ambient;
+			float constantAttenuation, linearAttenuation, quadraticAttenuation;
+			float spotCosCutoff, spotExponent;
+			float padding0[3];
+			glm::vec3 spotDirection;
+			float padding1;
+		};
+
+		// LightBlock of the shaders (std140)
+		struct LightBlockData
+		{
+			LightData lights[MAX_LIGHTS];
+			int numberOfLights;
+			int padding[3];
+		};
+
+		// OccluderBlock of masterOptimised.frag (std140)
+		struct OccluderBlockData
+		{
+			glm::vec4 occluders[MAX_OCCLUDERS];	// center and radius
+			glm::vec4 lightRadii;
+			int numberOfOccluders;
+			int useAnalyticShadows;
+			int padding[2];
+		};
+
+		// One instance of a batched draw, matches instanceData in master.vert and vsm.vert (std140)
+		struct InstanceData
+		{
+			glm::mat4 model;
+			glm::vec4 texTransforms[2 * 3];	// mat3 columns padded to vec4
+			glm::ivec4 layers;				// texture 0 and 1, normal and specular map, -1 if unused
+			glm::ivec4 options;				// useColor, blendMode, excludeFromLighting
+			glm::vec4 color;
+		};
+
+		// Instances that share a mesh, drawn with one call
+		struct InstanceBatch
+		{
+			Mesh* mesh;
+			GLintptr offset;				// of the instances in the uniform buffer
+			std::vector<InstanceData> instances;
+		};
+
+		// A shadow caster as seen from a light, bounded by a sphere
+		struct ShadowCaster
+		{
+			Model* model;
+			Mesh* mesh;
+			glm::vec3 center;				// relative to the light
+			glm::vec3 velocity;				// per frame
+			float radius;
+			int sides;						// bit per cube side the sphere overlaps
+		};
+
+		// The casters each side of a shadow cube was last drawn with. A side keeps its
+		// contents until a caster enters, leaves, changes its LOD or moves too far.
+		struct ShadowCache
+		{
+			bool valid[6];
+			int waited[6];					// frames a changed side was postponed
+			std::vector<ShadowCaster> casters[6];
+		};
+
+		// Fills the instance of the model, false if its textures are not in the arrays
+		bool FillInstanceData(Model& m, int lvl, InstanceData& data) const;
+		void AddToBatch(std::vector<InstanceBatch>& batches, Mesh* mesh, const InstanceData& data);
+		void UploadBatches(std::vector<InstanceBatch>& batches, GLuint buffer);
+		void DrawBatches(const std::vector<InstanceBatch>& batches, GLuint buffer);
+
+		// Writes the uniform blocks shared by all shaders, once per frame
+		void UpdateCamera();
 		void UpdateLights();
+		void UpdateOccluders();
 		void DrawModelMinimal(ShaderProgram& shader, Model& m, int lvl);
 		void DrawModel(ShaderProgram& shader, Model& m, int lvl);
 
 		// Returns the matrices for a specific direction (cube map face)
 		void GetLightMatrices(int dir, glm::vec3 lightPos, glm::mat4& projectionMatrix, glm::mat4& viewMatrix);
 
-		void DrawShadowCastingModels(jge::ShaderProgram* shader);
+		// A changed side of a shadow cube
+		struct ShadowSideRequest
+		{
+			int light;
+			int side;
+			bool forced;					// the side has no contents yet
+			float priority;
+		};
+
+		void CreateShadowCubes();
+		void DeleteShadowCubes();
+
+		// Bounding spheres of the shadow casters and their moves since the last frame
+		void UpdateShadowCasterBounds();
+
+		// Fills shadowCasters of the light with the casters it sees, except those containing it
+		void CollectShadowCasters(int light, const glm::vec3& lightPos, const glm::mat4* projectionMatrices);
+		bool IsShadowSideCurrent(int light, int side) const;
+		float GetShadowSidePriority(int light, int side) const;
+		void InvalidateShadowCaches();
+		void DrawShadowCastingModels();
 		void DrawNonShadowCastingModels(jge::ShaderProgram* shader);
+		void DrawInstancedModels();
 
 		// Lighting with Shadow
 		void ShadowPass();
@@ -92,6 +225,16 @@ namespace jge
 
 		// Framebuffer Object (FBO) for the Shadows - One FBO per lightsource!
 		CubeFramebuffer shadowCubes[MAX_LIGHTS];
+		ShadowMode shadowMode;
+		ShadowCache shadowCaches[MAX_LIGHTS];
+		std::vector<ShadowCaster> shadowCasters[MAX_LIGHTS];
+		std::vector<ShadowSideRequest> shadowRequests;
+		std::vector<glm::vec3> shadowCasterPositions;	// of the last frame
+		std::vector<glm::vec3> shadowCasterVelocities;
+		std::vector<float> shadowBoundsX, shadowBoundsY, shadowBoundsZ, shadowBoundsRadius;
+		std::vector<unsigned char> shadowCullResults;	// per side and caster
+		int shadowSideBudget;
+		unsigned int shadowSidesRendered;
 
 		OpenGlTimer timerShadowPass;
 		OpenGlTimer timerNormalPass;
@@ -102,5 +245,23 @@ namespace jge
 		unsigned int timeElapsedNormalPass;
 		unsigned int timeElapsedMSAA;
 		unsigned int timeElapsedPost;
+
+		// Instancing
+		std::vector<InstanceBatch> shadowBatches;
+		std::vector<InstanceBatch> opaqueBatches;
+		std::vector<unsigned char> instanceUpload;
+		GLuint shadowInstanceBuffer;
+		GLuint opaqueInstanceBuffer;
+		GLint uniformBufferAlignment;
+		GLuint colorArray;					// sRGB textures and specular maps
+		GLuint dataArray;					// normal maps
+		std::vector<GLuint> colorLayers;	// the texture copied to each layer
+		std::vector<GLuint> dataLayers;
+		unsigned int drawCalls;
+
+		// Shared uniform blocks
+		GLuint cameraBuffer;
+		GLuint lightBuffer;
+		GLuint occluderBuffer;
 	};
 }
\ No newline at end of file
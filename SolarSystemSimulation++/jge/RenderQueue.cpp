@@ -0,0 +1,92 @@
+#include "RenderQueue.h"
+
+#include <string.h>
+
+namespace jge
+{
+	// Key layout from the highest bit down
+	//	opaque:			pass:1 | shader:8 | texture:12 | mesh:11 | distance:32
+	//	transparent:	pass:1 | far to near distance:32 | shader:8 | texture:12 | mesh:11
+	static const uint64_t SHADER_MASK = (1 << 8) - 1;
+	static const uint64_t TEXTURE_MASK = (1 << 12) - 1;
+	static const uint64_t MESH_MASK = (1 << 11) - 1;
+
+	RenderQueue::RenderQueue()
+	{
+	}
+
+	RenderQueue::~RenderQueue()
+	{
+	}
+
+	void RenderQueue::Clear()
+	{
+		m_items.clear();
+		for (int i = 0; i < PASS_COUNT; ++i)
+			m_models[i].clear();
+	}
+
+	unsigned int RenderQueue::GetStateId(const void* state)
+	{
+		const auto& f = m_stateIds.find(state);
+		if (f != m_stateIds.end())
+			return f->second;
+
+		unsigned int id = (unsigned int)m_stateIds.size();
+		m_stateIds[state] = id;
+		return id;
+	}
+
+	void RenderQueue::Add(Pass pass, Model* model, const void* shader, unsigned int texture, const void* mesh, float distance)
+	{
+		// The bits of a positive float sort like the float itself
+		uint32_t depth;
+		memcpy(&depth, &distance, sizeof(depth));
+
+		const uint64_t state = ((GetStateId(shader) & SHADER_MASK) << 23)
+			| ((texture & TEXTURE_MASK) << 11)
+			| (GetStateId(mesh) & MESH_MASK);
+
+		Item item;
+		item.model = model;
+		if (pass == PASS_OPAQUE)
+			item.key = (state << 32) | depth;
+		else item.key = (1ull << 63) | ((uint64_t)~depth << 31) | state;
+		m_items.push_back(item);
+	}
+
+	void RenderQueue::Sort()
+	{
+		const size_t count = m_items.size();
+		m_scratch.resize(count);
+
+		// LSD radix sort on bytes, bytes that are the same in all keys take no pass
+		for (int shift = 0; shift < 64 && count > 1; shift += 8)
+		{
+			size_t offsets[256] = {};
+			for (size_t i = 0; i < count; ++i)
+				++offsets[(m_items[i].key >> shift) & 0xFF];
+			if (offsets[(m_items[0].key >> shift) & 0xFF] == count)
+				continue;
+
+			size_t sum = 0;
+			for (int b = 0; b < 256; ++b)
+			{
+				size_t c = offsets[b];
+				offsets[b] = sum;
+				sum += c;
+			}
+			for (size_t i = 0; i < count; ++i)
+				m_scratch[offsets[(m_items[i].key >> shift) & 0xFF]++] = m_items[i];
+			m_items.swap(m_scratch);
+		}
+
+		for (size_t i = 0; i < count; ++i)
+			m_models[m_items[i].key >> 63].push_back(m_items[i].model);
+	}
+
+	const std::vector<Model*>& RenderQueue::GetModels(Pass pass) const
+	{
+		return m_models[pass];
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+
+namespace jge
+{
+	class Model;
+
+	/**
+	* Orders the draws of a frame by one 64 bit key per draw. The key packs the
+	* pass, the render state (shader, texture, mesh) and the distance to the
+	* camera. Opaque draws are grouped by state and go front to back within a
+	* state, transparent draws go back to front with the state as tie breaker.
+	* The keys are sorted with a radix sort, which is linear in the draws.
+	*/
+	class RenderQueue
+	{
+	public:
+		enum Pass
+		{
+			PASS_OPAQUE = 0,
+			PASS_TRANSPARENT = 1,
+			PASS_COUNT
+		};
+
+		RenderQueue();
+		~RenderQueue();
+
+		void Clear();
+
+		// <distance> is the models distance to the camera, not negative
+		void Add(Pass pass, Model* model, const void* shader, unsigned int texture, const void* mesh, float distance);
+		void Sort();
+
+		// The models of a pass in drawing order, valid after Sort()
+		const std::vector<Model*>& GetModels(Pass pass) const;
+
+	private:
+		struct Item
+		{
+			uint64_t key;
+			Model* model;
+		};
+
+		// Small ids of the shaders and meshes, stable over the frames
+		unsigned int GetStateId(const void* state);
+
+		std::vector<Item> m_items;
+		std::vector<Item> m_scratch;
+		std::vector<Model*> m_models[PASS_COUNT];
+		std::unordered_map<const void*, unsigned int> m_stateIds;
+	};
+}
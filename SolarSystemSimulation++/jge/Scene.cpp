@@ -1,10 +1,11 @@
-#include <algorithm>    // std::sort
+#include <algorithm>    // std::remove
 
 #include "Scene.h"
 #include "Camera.h"
 #include "Model.h"
 #include "TransparencySorter.h"
 #include "Measurement.h"
+#include "Frustum.h"
 
 #include <glm/glm.hpp>
 
@@ -16,6 +17,7 @@ namespace jge
 		: enableSorting(true)
 		, lodLevel1Distance(30.0f)
 		, lodLevel2Distance(60.0f)
+		, visibleModelCount(0)
 	{
 	}
 
@@ -70,6 +72,17 @@ namespace jge
             std::remove(nonglowingModels.begin(), nonglowingModels.end(), model), nonglowingModels.end());
     }
 
+	void Scene::AddInstancedModel(InstancedModel* model)
+	{
+		instancedModels.push_back(model);
+	}
+
+	void Scene::RemoveInstancedModel(InstancedModel* model)
+	{
+		instancedModels.erase(
+			std::remove(instancedModels.begin(), instancedModels.end(), model), instancedModels.end());
+	}
+
 	void Scene::SetCamera(Camera* c)
 	{
 		camera = c;
@@ -99,44 +112,86 @@ namespace jge
 		else return 0;
 	}
 
-	struct ModelDistanceComparer
+	void Scene::CullModels()
 	{
-		Camera* camera;
-		ModelDistanceComparer(Camera* c)
+		// Every model is either opaque or transparent
+		cullModels.clear();
+		cullModels.insert(cullModels.end(), opaqueModels.begin(), opaqueModels.end());
+		cullModels.insert(cullModels.end(), transparentModels.begin(), transparentModels.end());
+
+		const size_t count = cullModels.size();
+		boundsX.resize(count);
+		boundsY.resize(count);
+		boundsZ.resize(count);
+		boundsRadius.resize(count);
+		cullResults.resize(count);
+		for (size_t i = 0; i < count; ++i)
 		{
-			camera = c;
+			const vec3 center = cullModels[i]->GetPosition();
+			boundsX[i] = center.x;
+			boundsY[i] = center.y;
+			boundsZ[i] = center.z;
+			boundsRadius[i] = cullModels[i]->GetBoundingRadius();
 		}
 
-		inline bool operator() (Model* m1, Model* m2)
-		{
-			m1->DistanceToCamera() = glm::length(camera->GetPosition() - m1->GetPosition());
-			m2->DistanceToCamera() = glm::length(camera->GetPosition() - m2->GetPosition());
+		const Frustum frustum(camera->GetProjectionMatrix() * camera->GetViewMatrix());
+		frustum.CullSpheres(boundsX.data(), boundsY.data(), boundsZ.data(), boundsRadius.data(), count, cullResults.data());
 
-			return (m1->DistanceToCamera() > m2->DistanceToCamera());
+		visibleModelCount = 0;
+		for (size_t i = 0; i < count; ++i)
+		{
+			cullModels[i]->InView() = cullResults[i] != 0;
+			visibleModelCount += cullResults[i];
 		}
-	};
 
-	struct ShaderComparer
-	{
-		inline bool operator() (Model* m1, Model* m2)
+		// The instanced models cull their instances themselves
+		for (unsigned int i = 0; i < instancedModels.size(); ++i)
+			instancedModels[i]->Cull(frustum);
+
+		// The glow pass draws from the same camera
+		visibleGlowingModels.clear();
+		for (unsigned int i = 0; i < glowingModels.size(); ++i)
 		{
-			return (m1->GetShader() > m2->GetShader());
+			if (glowingModels[i]->InView())
+				visibleGlowingModels.push_back(glowingModels[i]);
 		}
-	};
+		visibleNonglowingModels.clear();
+		for (unsigned int i = 0; i < nonglowingModels.size(); ++i)
+		{
+			if (nonglowingModels[i]->InView())
+				visibleNonglowingModels.push_back(nonglowingModels[i]);
+		}
+	}
 
-	void Scene::SortModelsByDistance()
+	void Scene::QueueModels()
 	{
-		std::sort(transparentModels.begin(), transparentModels.end(), ModelDistanceComparer(camera));
-		std::sort(opaqueModels.begin(), opaqueModels.end(), ModelDistanceComparer(camera));
-
-		std::stable_sort(transparentModels.begin(), transparentModels.end(), ShaderComparer());
-		std::stable_sort(opaqueModels.begin(), opaqueModels.end(), ShaderComparer());
+		// One distance per model, the LOD selection uses it too
+		const vec3 cameraPosition = camera->GetPosition();
+		renderQueue.Clear();
+		for (unsigned int i = 0; i < opaqueModels.size(); ++i)
+		{
+			Model* m = opaqueModels[i];
+			m->DistanceToCamera() = glm::length(cameraPosition - m->GetPosition());
+			if (m->InView())
+				renderQueue.Add(RenderQueue::PASS_OPAQUE, m, m->GetShader(), m->textures[0], m->GetLODMesh(DetermineLODLevel(*m)), m->DistanceToCamera());
+		}
+		for (unsigned int i = 0; i < transparentModels.size(); ++i)
+		{
+			Model* m = transparentModels[i];
+			m->DistanceToCamera() = glm::length(cameraPosition - m->GetPosition());
+			if (m->InView())
+				renderQueue.Add(RenderQueue::PASS_TRANSPARENT, m, m->GetShader(), m->textures[0], m->GetLODMesh(DetermineLODLevel(*m)), m->DistanceToCamera());
+		}
+		renderQueue.Sort();
 	}
 
 	void Scene::SortTransparentTrianglesByDistance()
 	{
 		for (unsigned int i = 0; i < sortedModels.size(); ++i)
 		{
+			if (!sortedModels[i]->InView())
+				continue;
+
 			int lodLevel = DetermineLODLevel(*sortedModels[i]);
 			Mesh* lvlMesh = sortedModels[i]->GetLODMesh(lodLevel);			// Instanciated....! #FIX!
 			
@@ -148,9 +203,20 @@ namespace jge
 
 	void Scene::Optimize()
 	{
-		SortModelsByDistance();
+		CullModels();
+		QueueModels();
 
 		if (enableSorting)
 			SortTransparentTrianglesByDistance();
 	}
+
+	unsigned int Scene::GetVisibleModelCount() const
+	{
+		return visibleModelCount;
+	}
+
+	unsigned int Scene::GetModelCount() const
+	{
+		return (unsigned int)(opaqueModels.size() + transparentModels.size());
+	}
 }
\ No newline at end of file
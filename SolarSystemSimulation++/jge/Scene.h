@@ -6,7 +6,9 @@
 #include "LightSource.h"
 #include "Camera.h"
 #include "Model.h"
+#include "InstancedModel.h"
 #include "Framebuffer.h"
+#include "RenderQueue.h"
 
 namespace jge
 {
@@ -26,24 +28,34 @@ namespace jge
 		void AddLight(LightSource* light);
 		void AddModel(Model* model);
         void RemoveModel(Model*);
+		void AddInstancedModel(InstancedModel* model);
+		void RemoveInstancedModel(InstancedModel* model);
 		void SetSkyboxTexture(GLuint tex);
 
 		// This enables correctly rendered transparency.
 		void EnableTriangleSorting(bool);
 		bool IsTriangleSortingEnabled() const;
 
-		// Sort the models by distance to allow for an early z-test
+		// Cull the models outside of the cameras view, queue the others by state and
+		// distance to allow for an early z-test.
 		// If enabled, sort triangles to get transparency right.
 		void Optimize();
 
+		// Models in the cameras view after the last Optimize(), out of all models
+		unsigned int GetVisibleModelCount() const;
+		unsigned int GetModelCount() const;
+
 		// Allow the render pipeline to access our private members
 		// like sorted models, lights and other render relevant stuff.
 		friend class RenderPipeline;
 
 	private:
+		// Visibility, with the bounding spheres of the models
+		void CullModels();
+
 		// Rendering order
 		// Sort models to get transparency right (if enabled)
-		void SortModelsByDistance();
+		void QueueModels();
 		void SortTransparentTrianglesByDistance();
 		
 		// Some helper
@@ -63,6 +75,16 @@ namespace jge
 		std::vector<Model*> shadowCastingModels;
 		std::vector<Model*> glowingModels;
 		std::vector<Model*> nonglowingModels;
+		std::vector<InstancedModel*> instancedModels;	// Opaque, unshadowed, drawn after opaqueModels
+		std::vector<Model*> visibleGlowingModels;		// glowingModels in the cameras view
+		std::vector<Model*> visibleNonglowingModels;
+		RenderQueue renderQueue;				// Opaque and transparent models in drawing order, only visible ones
+
+		// Bounding spheres of opaqueModels followed by transparentModels
+		std::vector<Model*> cullModels;
+		std::vector<float> boundsX, boundsY, boundsZ, boundsRadius;
+		std::vector<unsigned char> cullResults;
+		unsigned int visibleModelCount;
 
 		std::vector<LightSource*> lights;
 	};
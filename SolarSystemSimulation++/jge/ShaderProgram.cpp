@@ -1,8 +1,25 @@
 #include "ShaderProgram.h"
 #include <stdio.h>					// For reading the shader files
+#include <string.h>
 
 namespace jge
 {
+	unsigned int ShaderProgram::s_issuedUploads = 0;
+	unsigned int ShaderProgram::s_skippedUploads = 0;
+
+	// Uniform names of the handles, the index is the id
+	static std::vector<std::string>& UniformNames()
+	{
+		static std::vector<std::string> names;
+		return names;
+	}
+
+	static std::unordered_map<std::string, int>& UniformNameIds()
+	{
+		static std::unordered_map<std::string, int> ids;
+		return ids;
+	}
+
 	ShaderProgram::ShaderProgram()
 		: m_programId(0)
 		, m_vertexShaderId(0)
@@ -14,6 +31,11 @@ namespace jge
 	}
 
 	bool ShaderProgram::Create(GLuint vertShader, GLuint fragShader)
+	{
+		return Create(vertShader, 0, fragShader);
+	}
+
+	bool ShaderProgram::Create(GLuint vertShader, GLuint geomShader, GLuint fragShader)
 	{
 		assert(!m_isInitialized);
 		assert(vertShader != 0);
@@ -22,6 +44,8 @@ namespace jge
 		m_programId = glCreateProgram();
 
 		glAttachShader(m_programId, vertShader);
+		if (geomShader != 0)
+			glAttachShader(m_programId, geomShader);
 		glAttachShader(m_programId, fragShader);
 
 		GLint isLinked = 0;
@@ -31,13 +55,19 @@ namespace jge
 		m_isInitialized = true;
 
 		if (m_isValid)
+		{
 			RegisterUniforms();
+			BindUniformBlocks();
+		}
 
 		return m_isValid;
 	}
 
 	ShaderProgram::~ShaderProgram()
 	{
+		if (!m_isInitialized)
+			return;
+
 		glDeleteProgram(m_programId);
 
 		// Spec: A value of 0 for shader will be silently ignored.
@@ -69,66 +99,179 @@ namespace jge
 		for (int i = 0; i < count; ++i)
 		{
 			glGetActiveUniform(m_programId, (GLuint)i, bufferSize, &len, &size, &type, name);
-			GLuint location = glGetUniformLocation(m_programId, name);
-			m_uniformMap[name] = location;
+			GLint location = glGetUniformLocation(m_programId, name);
+			AddSlot(name, location);
 			//printf("uniform location %2d: %s\n", location, name);
 		}
 		//printf("\n");
 	}
 
+	void ShaderProgram::BindUniformBlocks()
+	{
+		BindUniformBlock("InstanceBlock", UB_BINDING_INSTANCES);
+		BindUniformBlock("CameraBlock", UB_BINDING_CAMERA);
+		BindUniformBlock("LightBlock", UB_BINDING_LIGHTS);
+		BindUniformBlock("OccluderBlock", UB_BINDING_OCCLUDERS);
+	}
+
 	bool ShaderProgram::RegisterUniform(const char* name)
 	{
-		GLuint location = glGetUniformLocation(m_programId, name);
+		GLint location = glGetUniformLocation(m_programId, name);
 		if (location >= 0)
 		{
-			m_uniformMap[name] = location;
+			AddSlot(name, location);
 			return true;
 		}
 		else return false;
 	}
 
-	void ShaderProgram::UpdateUniform(const std::string& name, int i)
+	bool ShaderProgram::BindUniformBlock(const char* name, GLuint binding)
 	{
-		const auto& f = m_uniformMap.find(name);
-		if (f != m_uniformMap.end())
-			glUniform1i(f->second, i);
+		GLuint index = glGetUniformBlockIndex(m_programId, name);
+		if (index == GL_INVALID_INDEX)
+			return false;
+
+		glUniformBlockBinding(m_programId, index, binding);
+		return true;
 	}
-	void ShaderProgram::UpdateUniform(const std::string& name, float f)
+
+	int ShaderProgram::RegisterName(const char* name)
 	{
-		const auto& fv = m_uniformMap.find(name);
-		if (fv != m_uniformMap.end())
-			glUniform1f(fv->second, f);
+		std::unordered_map<std::string, int>& ids = UniformNameIds();
+		const auto& f = ids.find(name);
+		if (f != ids.end())
+			return f->second;
+
+		UniformNames().push_back(name);
+		ids[name] = (int)UniformNames().size() - 1;
+		return ids[name];
 	}
-	void ShaderProgram::UpdateUniform(const std::string& name, const glm::vec2& vec2)
+
+	int ShaderProgram::AddSlot(const std::string& name, GLint location)
 	{
 		const auto& f = m_uniformMap.find(name);
 		if (f != m_uniformMap.end())
-			glUniform2fv(f->second, 1, glm::value_ptr(vec2));
+		{
+			m_uniforms[f->second].location = location;
+			m_uniforms[f->second].isSet = false;
+			return f->second;
+		}
+
+		UniformSlot uniform;
+		uniform.location = location;
+		uniform.isSet = false;
+		m_uniforms.push_back(uniform);
+		int slot = (int)m_uniforms.size() - 1;
+		m_uniformMap[name] = slot;
+
+		// A handle of the name might have been resolved to nothing already
+		const auto& id = UniformNameIds().find(name);
+		if (id != UniformNameIds().end() && id->second < (int)m_slotsByNameId.size())
+			m_slotsByNameId[id->second] = slot;
+		return slot;
 	}
-	void ShaderProgram::UpdateUniform(const std::string& name, const glm::vec3& vec3)
+
+	int ShaderProgram::FindSlot(const std::string& name) const
 	{
 		const auto& f = m_uniformMap.find(name);
-		if (f != m_uniformMap.end())
-			glUniform3fv(f->second, 1, glm::value_ptr(vec3));
+		return f != m_uniformMap.end() ? f->second : -1;
 	}
-	void ShaderProgram::UpdateUniform(const std::string& name, const glm::mat3& mat3)
+
+	int ShaderProgram::FindSlot(int nameId)
 	{
-		const auto& f = m_uniformMap.find(name);
-		if (f != m_uniformMap.end())
-			glUniformMatrix3fv(f->second, 1, GL_FALSE, glm::value_ptr(mat3));
+		// Resolve the names registered since the last call. Array elements after
+		// the first aren't listed as active uniforms, so ask for those.
+		const std::vector<std::string>& names = UniformNames();
+		while ((int)m_slotsByNameId.size() <= nameId)
+		{
+			const std::string& name = names[m_slotsByNameId.size()];
+			int slot = FindSlot(name);
+			if (slot < 0 && m_isValid)
+			{
+				GLint location = glGetUniformLocation(m_programId, name.c_str());
+				if (location >= 0)
+					slot = AddSlot(name, location);
+			}
+			m_slotsByNameId.push_back(slot);
+		}
+		return m_slotsByNameId[nameId];
 	}
-	void ShaderProgram::UpdateUniform(const std::string& name, const glm::vec4& vec4)
+
+	bool ShaderProgram::Changed(int slot, const void* data, size_t size)
 	{
-		const auto& f = m_uniformMap.find(name);
-		if (f != m_uniformMap.end())
-			glUniform4fv(f->second, 1, glm::value_ptr(vec4));
+		UniformSlot& uniform = m_uniforms[slot];
+		if (uniform.isSet && memcmp(uniform.value, data, size) == 0)
+		{
+			++s_skippedUploads;
+			return false;
+		}
+
+		memcpy(uniform.value, data, size);
+		uniform.isSet = true;
+		++s_issuedUploads;
+		return true;
 	}
-	void ShaderProgram::UpdateUniform(const std::string& name, const glm::mat4& mat4)
+
+	void ShaderProgram::Upload(int slot, int i)
 	{
-		const auto& f = m_uniformMap.find(name);
-		if (f != m_uniformMap.end())
-			glUniformMatrix4fv(f->second, 1, GL_FALSE, glm::value_ptr(mat4));
+		if (slot >= 0 && Changed(slot, &i, sizeof(i)))
+			glUniform1i(m_uniforms[slot].location, i);
+	}
+	void ShaderProgram::Upload(int slot, float f)
+	{
+		if (slot >= 0 && Changed(slot, &f, sizeof(f)))
+			glUniform1f(m_uniforms[slot].location, f);
+	}
+	void ShaderProgram::Upload(int slot, const glm::vec2& vec2)
+	{
+		if (slot >= 0 && Changed(slot, glm::value_ptr(vec2), sizeof(vec2)))
+			glUniform2fv(m_uniforms[slot].location, 1, glm::value_ptr(vec2));
+	}
+	void ShaderProgram::Upload(int slot, const glm::vec3& vec3)
+	{
+		if (slot >= 0 && Changed(slot, glm::value_ptr(vec3), sizeof(vec3)))
+			glUniform3fv(m_uniforms[slot].location, 1, glm::value_ptr(vec3));
+	}
+	void ShaderProgram::Upload(int slot, const glm::mat3& mat3)
+	{
+		if (slot >= 0 && Changed(slot, glm::value_ptr(mat3), sizeof(mat3)))
+			glUniformMatrix3fv(m_uniforms[slot].location, 1, GL_FALSE, glm::value_ptr(mat3));
+	}
+	void ShaderProgram::Upload(int slot, const glm::vec4& vec4)
+	{
+		if (slot >= 0 && Changed(slot, glm::value_ptr(vec4), sizeof(vec4)))
+			glUniform4fv(m_uniforms[slot].location, 1, glm::value_ptr(vec4));
 	}
+	void ShaderProgram::Upload(int slot, const glm::mat4& mat4)
+	{
+		if (slot >= 0 && Changed(slot, glm::value_ptr(mat4), sizeof(mat4)))
+			glUniformMatrix4fv(m_uniforms[slot].location, 1, GL_FALSE, glm::value_ptr(mat4));
+	}
+
+	void ShaderProgram::UpdateUniform(const std::string& name, int i) { Upload(FindSlot(name), i); }
+	void ShaderProgram::UpdateUniform(const std::string& name, float f) { Upload(FindSlot(name), f); }
+	void ShaderProgram::UpdateUniform(const std::string& name, const glm::vec2& vec2) { Upload(FindSlot(name), vec2); }
+	void ShaderProgram::UpdateUniform(const std::string& name, const glm::vec3& vec3) { Upload(FindSlot(name), vec3); }
+	void ShaderProgram::UpdateUniform(const std::string& name, const glm::mat3& mat3) { Upload(FindSlot(name), mat3); }
+	void ShaderProgram::UpdateUniform(const std::string& name, const glm::vec4& vec4) { Upload(FindSlot(name), vec4); }
+	void ShaderProgram::UpdateUniform(const std::string& name, const glm::mat4& mat4) { Upload(FindSlot(name), mat4); }
+
+	void ShaderProgram::UpdateUniform(const Uniform<int>& uniform, int i) { Upload(FindSlot(uniform.GetNameId()), i); }
+	void ShaderProgram::UpdateUniform(const Uniform<float>& uniform, float f) { Upload(FindSlot(uniform.GetNameId()), f); }
+	void ShaderProgram::UpdateUniform(const Uniform<glm::vec2>& uniform, const glm::vec2& vec2) { Upload(FindSlot(uniform.GetNameId()), vec2); }
+	void ShaderProgram::UpdateUniform(const Uniform<glm::vec3>& uniform, const glm::vec3& vec3) { Upload(FindSlot(uniform.GetNameId()), vec3); }
+	void ShaderProgram::UpdateUniform(const Uniform<glm::mat3>& uniform, const glm::mat3& mat3) { Upload(FindSlot(uniform.GetNameId()), mat3); }
+	void ShaderProgram::UpdateUniform(const Uniform<glm::vec4>& uniform, const glm::vec4& vec4) { Upload(FindSlot(uniform.GetNameId()), vec4); }
+	void ShaderProgram::UpdateUniform(const Uniform<glm::mat4>& uniform, const glm::mat4& mat4) { Upload(FindSlot(uniform.GetNameId()), mat4); }
+
+	void ShaderProgram::ResetUploadCounters()
+	{
+		s_issuedUploads = 0;
+		s_skippedUploads = 0;
+	}
+
+	unsigned int ShaderProgram::GetIssuedUploads() { return s_issuedUploads; }
+	unsigned int ShaderProgram::GetSkippedUploads() { return s_skippedUploads; }
 
 	GLuint ShaderProgram::CreateShader(GLenum type, const char* source, unsigned int length)
 	{
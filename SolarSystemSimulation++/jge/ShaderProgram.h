@@ -6,9 +6,23 @@
 #include <glm/gtc/type_ptr.hpp>		// For Uniform get,set
 
 #include <unordered_map>
+#include <vector>
 
 namespace jge
 {
+	// Fixed binding points of the uniform blocks shared by all programs. Create()
+	// connects every block a program declares, the buffers are bound once.
+	enum UniformBlockBinding
+	{
+		UB_BINDING_INSTANCES = 0,		// InstanceBlock, per instance data of batched draws
+		UB_BINDING_CAMERA = 1,			// CameraBlock, view and projection of the frame
+		UB_BINDING_LIGHTS = 2,			// LightBlock, the light array
+		UB_BINDING_OCCLUDERS = 3		// OccluderBlock, the shadow casters as spheres
+	};
+
+	template <typename T>
+	class Uniform;
+
 	/**
     * Simple abstraction of a OpenGL shader program consisting of vertex and fragmentshader.
     * Sharing single shaders across shaderprograms is not supported.
@@ -20,10 +34,14 @@ namespace jge
 		~ShaderProgram();
 
 		bool Create(GLuint vertShader, GLuint fragShader);
+		bool Create(GLuint vertShader, GLuint geomShader, GLuint fragShader);
 		bool IsValid() const;
 		void UseProgram();
 		bool RegisterUniform(const char* name);
 
+		// Connects the uniform block <name> to the buffer bound at <binding>
+		bool BindUniformBlock(const char* name, GLuint binding);
+
 		void UpdateUniform(const std::string& name, int i);
 		void UpdateUniform(const std::string& name, float f);
 		void UpdateUniform(const std::string& name, const glm::vec2& vec2);
@@ -32,9 +50,49 @@ namespace jge
 		void UpdateUniform(const std::string& name, const glm::vec4& vec4);
 		void UpdateUniform(const std::string& name, const glm::mat4& mat4);
 
+		// Same as above without the name lookup, for the draw path
+		void UpdateUniform(const Uniform<int>& uniform, int i);
+		void UpdateUniform(const Uniform<float>& uniform, float f);
+		void UpdateUniform(const Uniform<glm::vec2>& uniform, const glm::vec2& vec2);
+		void UpdateUniform(const Uniform<glm::vec3>& uniform, const glm::vec3& vec3);
+		void UpdateUniform(const Uniform<glm::mat3>& uniform, const glm::mat3& mat3);
+		void UpdateUniform(const Uniform<glm::vec4>& uniform, const glm::vec4& vec4);
+		void UpdateUniform(const Uniform<glm::mat4>& uniform, const glm::mat4& mat4);
+
+		// Every program keeps a copy of its uniforms values and skips uploads that
+		// wouldn't change them. Counts the uploads of all programs since the reset.
+		static void ResetUploadCounters();
+		static unsigned int GetIssuedUploads();
+		static unsigned int GetSkippedUploads();
+
+		// Id of a uniform name shared by all programs, used by Uniform
+		static int RegisterName(const char* name);
+
 		static GLuint CreateShader(GLenum type, const char* source, unsigned int length);
 	private:
+		struct UniformSlot
+		{
+			GLint location;
+			bool isSet;
+			float value[16];			// the last uploaded value, large enough for a mat4
+		};
+
 		void RegisterUniforms();
+		void BindUniformBlocks();
+		int AddSlot(const std::string& name, GLint location);
+		int FindSlot(const std::string& name) const;
+		int FindSlot(int nameId);
+
+		// True if <size> bytes at <data> differ from the slots copy, which takes them then
+		bool Changed(int slot, const void* data, size_t size);
+
+		void Upload(int slot, int i);
+		void Upload(int slot, float f);
+		void Upload(int slot, const glm::vec2& vec2);
+		void Upload(int slot, const glm::vec3& vec3);
+		void Upload(int slot, const glm::mat3& mat3);
+		void Upload(int slot, const glm::vec4& vec4);
+		void Upload(int slot, const glm::mat4& mat4);
 		
 		GLuint m_programId;
 		GLuint m_vertexShaderId;
@@ -44,7 +102,28 @@ namespace jge
 		bool m_isValid;
 
 		// Cannot use const char ptrs here as they are not treated
-		// as string by the map template. 
-		std::unordered_map<std::string, GLuint> m_uniformMap;
+		// as string by the map template. Maps to the slot of the uniform.
+		std::unordered_map<std::string, int> m_uniformMap;
+		std::vector<UniformSlot> m_uniforms;
+		std::vector<int> m_slotsByNameId;		// resolved on first use, -1 if not in the program
+
+		static unsigned int s_issuedUploads;
+		static unsigned int s_skippedUploads;
+	};
+
+	/**
+	* Typed handle of a uniform name, created once at startup and usable with every
+	* program. Each program looks the name up on first use only, setting the uniform
+	* is an array access after that.
+	*/
+	template <typename T>
+	class Uniform
+	{
+	public:
+		explicit Uniform(const char* name) : m_nameId(ShaderProgram::RegisterName(name)) {}
+		int GetNameId() const { return m_nameId; }
+
+	private:
+		int m_nameId;
 	};
 }
\ No newline at end of file
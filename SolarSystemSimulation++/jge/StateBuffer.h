@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+
+namespace jge
+{
+	/**
+	* Lock-free hand over of states from one producer to one consumer thread.
+	* A triple buffer with a fourth slot: the producer always has a slot to write,
+	* one slot is in transit and the consumer keeps the two latest states it
+	* received, so it can interpolate between them. Neither side ever waits,
+	* a state the consumer didn't pick up in time is overwritten by the next one.
+	*/
+	template <typename T>
+	class StateBuffer
+	{
+	public:
+		StateBuffer()
+			: writeSlot(0)
+			, previousSlot(1)
+			, latestSlot(2)
+			, received(0)
+			, transit(3)
+		{
+		}
+
+		// Producer: the slot to fill, its old content is undefined
+		T& GetWriteState()
+		{
+			return slots[writeSlot];
+		}
+
+		// Producer: hands the written state over and gets a free slot back
+		void Publish()
+		{
+			writeSlot = transit.exchange(writeSlot | FRESH, std::memory_order_acq_rel) & SLOT_MASK;
+		}
+
+		// Consumer: takes the newest published state if there is one. The former
+		// latest state becomes the previous one. Returns false if nothing new arrived.
+		bool Acquire()
+		{
+			if ((transit.load(std::memory_order_relaxed) & FRESH) == 0)
+				return false;
+
+			unsigned int slot = transit.exchange(previousSlot, std::memory_order_acq_rel);
+			previousSlot = latestSlot;
+			latestSlot = slot & SLOT_MASK;
+			if (received < 2)
+				++received;
+			return true;
+		}
+
+		// Consumer: the states are only valid after one / two successful Acquire() calls
+		const T& GetLatest() const { return slots[latestSlot]; }
+		const T& GetPrevious() const { return slots[previousSlot]; }
+		int GetReceivedCount() const { return received; }
+
+	private:
+		StateBuffer(const StateBuffer&) = delete;
+		StateBuffer& operator=(const StateBuffer&) = delete;
+
+		static const unsigned int SLOT_MASK = 3;
+		static const unsigned int FRESH = 4;		// the slot in transit wasn't acquired yet
+
+		T slots[4];
+		unsigned int writeSlot;						// owned by the producer
+		unsigned int previousSlot;					// owned by the consumer
+		unsigned int latestSlot;
+		int received;
+		std::atomic<unsigned int> transit;
+	};
+}
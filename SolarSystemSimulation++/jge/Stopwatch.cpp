@@ -0,0 +1,27 @@
+#include "Measurement.h"
+
+#include <chrono>
+
+// Apart from the rest of Measurement.cpp, the headless build links it without glfw and OpenGL
+namespace jge
+{
+	static double SecondsSinceEpoch()
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void Stopwatch::Start()
+	{
+		beginTime = SecondsSinceEpoch();
+	}
+
+	void Stopwatch::Stop()
+	{
+		endTime = SecondsSinceEpoch();
+	}
+
+	double Stopwatch::GetElapsedTime() const
+	{
+		return endTime - beginTime;
+	}
+}
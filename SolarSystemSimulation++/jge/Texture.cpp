@@ -4,6 +4,8 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "../stb_image.h"
 
+#include <stdio.h>
+
 namespace jge
 {
 	GLuint Texture::LoadCubemap(const char* posx,
@@ -47,6 +49,54 @@ namespace jge
 		return textureID;
 	}
 
+	GLuint Texture::CreateTextureArray(const GLuint* textures, int count, int width, int height, bool srgbInternal)
+	{
+		if (count <= 0)
+			return 0;
+
+		GLuint arrayID;
+		glGenTextures(1, &arrayID);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, arrayID);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, srgbInternal ? GL_SRGB8_ALPHA8 : GL_RGBA8, width, height, count, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+		// Blit every texture into its layer, the GPU does the scaling
+		GLint previousFramebuffer;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+		GLuint framebuffers[2];
+		glGenFramebuffers(2, framebuffers);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[0]);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[1]);
+		for (int i = 0; i < count; ++i)
+		{
+			GLint sourceWidth, sourceHeight;
+			glBindTexture(GL_TEXTURE_2D, textures[i]);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &sourceWidth);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &sourceHeight);
+
+			glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[i], 0);
+			glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, arrayID, 0, i);
+			if (glCheckFramebufferStatus(GL_READ_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			{
+				printf("Texture %u is not color renderable and can't be copied into layer %d\r\n", textures[i], i);
+				continue;
+			}
+			glBlitFramebuffer(0, 0, sourceWidth, sourceHeight, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+		glDeleteFramebuffers(2, framebuffers);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glBindTexture(GL_TEXTURE_2D_ARRAY, arrayID);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		return arrayID;
+	}
+
 	GLuint Texture::LoadTexture(const char* file)
 	{
 		return LoadTexture(file, GL_REPEAT, true);
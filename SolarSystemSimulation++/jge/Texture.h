@@ -10,6 +10,11 @@ namespace jge
 		static GLuint LoadTexture(const char* file);
 		static GLuint LoadTexture(const char* file, GLuint wrapMode, bool srgbInternal);
 
+		// Copies 2D textures of any size into the layers of a new texture array
+		// of <width> x <height>, scaled with linear filtering. The sources are
+		// left alone. Returns 0 if <count> is 0.
+		static GLuint CreateTextureArray(const GLuint* textures, int count, int width, int height, bool srgbInternal);
+
 		static GLuint LoadCubemap(const char* posx,
 			const char* negx,
 			const char* posy,
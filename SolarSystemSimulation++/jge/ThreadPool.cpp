@@ -0,0 +1,141 @@
+#include "ThreadPool.h"
+
+namespace jge
+{
+	// Set on threads currently executing chunks, nested loops run inline
+	static thread_local bool insideParallelFor = false;
+
+	ThreadPool::ThreadPool(unsigned int threads)
+		: job(nullptr)
+		, jobCount(0)
+		, jobGrain(1)
+		, chunkCount(0)
+		, nextChunk(0)
+		, pendingChunks(0)
+		, generation(0)
+		, busyWorkers(0)
+		, quit(false)
+	{
+		if (threads == 0)
+		{
+			unsigned int hw = std::thread::hardware_concurrency();
+			threads = hw > 1 ? hw - 1 : 0;
+		}
+
+		for (unsigned int i = 0; i < threads; ++i)
+			workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+	}
+
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		wake.notify_all();
+
+		for (std::thread& t : workers)
+			t.join();
+	}
+
+
+	void ThreadPool::ParallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn)
+	{
+		if (count == 0)
+			return;
+		if (grain == 0)
+			grain = 1;
+
+		// Not worth waking anybody up
+		if (workers.empty() || count <= grain || insideParallelFor)
+		{
+			for (size_t begin = 0; begin < count; begin += grain)
+				fn(begin, begin + grain < count ? begin + grain : count);
+			return;
+		}
+
+		std::lock_guard<std::mutex> call(callMutex);
+		{
+			// Workers that woke up late for the previous job must be out
+			std::unique_lock<std::mutex> lock(mutex);
+			done.wait(lock, [this] { return busyWorkers == 0; });
+
+			job = &fn;
+			jobCount = count;
+			jobGrain = grain;
+			chunkCount = (count + grain - 1) / grain;
+			nextChunk = 0;
+			pendingChunks = chunkCount;
+			++generation;
+		}
+		wake.notify_all();
+
+		insideParallelFor = true;
+		RunChunks();
+		insideParallelFor = false;
+
+		// Wait for the chunks other threads are still working on
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this] { return pendingChunks == 0 && busyWorkers == 0; });
+		job = nullptr;
+	}
+
+
+	unsigned int ThreadPool::GetThreadCount() const
+	{
+		return (unsigned int)workers.size() + 1;
+	}
+
+
+	ThreadPool& ThreadPool::Shared()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+
+
+	void ThreadPool::WorkerLoop()
+	{
+		unsigned long long seen = 0;
+		insideParallelFor = true;
+
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&] { return quit || generation != seen; });
+				if (quit)
+					return;
+
+				seen = generation;
+				++busyWorkers;
+			}
+
+			RunChunks();
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				--busyWorkers;
+			}
+			done.notify_all();
+		}
+	}
+
+
+	void ThreadPool::RunChunks()
+	{
+		for (;;)
+		{
+			size_t chunk = nextChunk.fetch_add(1);
+			if (chunk >= chunkCount)
+				break;
+
+			size_t begin = chunk * jobGrain;
+			size_t end = begin + jobGrain < jobCount ? begin + jobGrain : jobCount;
+			(*job)(begin, end);
+
+			pendingChunks.fetch_sub(1);
+		}
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+namespace jge
+{
+	// Persistent worker threads for data parallel loops.
+	// The threads sleep while there is no work, so keeping one around is cheap.
+	class ThreadPool
+	{
+	public:
+		// <threads> worker threads, 0 = one less than the number of hardware threads
+		explicit ThreadPool(unsigned int threads = 0);
+		~ThreadPool();
+
+		// Calls fn(begin, end) for consecutive chunks of [0, count) with at most
+		// <grain> elements each. The calling thread works on chunks too.
+		// Returns when all chunks are done. Nested calls run serially.
+		void ParallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn);
+
+		unsigned int GetThreadCount() const;
+
+		// Pool shared by the simulation systems
+		static ThreadPool& Shared();
+
+	private:
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		void WorkerLoop();
+		void RunChunks();
+
+		std::vector<std::thread> workers;
+		std::mutex callMutex;		// one ParallelFor() at a time
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::condition_variable done;
+
+		// Current job, written under <mutex> before <generation> changes
+		const std::function<void(size_t, size_t)>* job;
+		size_t jobCount;
+		size_t jobGrain;
+		size_t chunkCount;
+		std::atomic<size_t> nextChunk;
+		std::atomic<size_t> pendingChunks;
+
+		unsigned long long generation;
+		unsigned int busyWorkers;
+		bool quit;
+	};
+}
@@ -0,0 +1,108 @@
+#include "TransformHierarchy.h"
+
+#include <assert.h>
+
+using namespace glm;
+
+namespace jge
+{
+	TransformHierarchy::TransformHierarchy()
+		: m_firstDirty(0)
+	{
+	}
+
+	int TransformHierarchy::Add(int parent, const mat4& local, TransformInheritance inheritance)
+	{
+		assert(parent < (int)Count());
+
+		int node = (int)Count();
+		m_local.push_back(local);
+		m_world.push_back(local);
+		m_parents.push_back(parent);
+		m_inheritance.push_back(inheritance);
+		m_dirty.push_back(1);
+
+		if ((size_t)node < m_firstDirty)
+			m_firstDirty = node;
+		return node;
+	}
+
+	void TransformHierarchy::Clear()
+	{
+		m_local.clear();
+		m_world.clear();
+		m_parents.clear();
+		m_inheritance.clear();
+		m_dirty.clear();
+		m_firstDirty = 0;
+	}
+
+	void TransformHierarchy::SetLocal(int node, const mat4& local)
+	{
+		m_local[node] = local;
+		m_dirty[node] = 1;
+		if ((size_t)node < m_firstDirty)
+			m_firstDirty = node;
+	}
+
+	const mat4& TransformHierarchy::GetLocal(int node) const
+	{
+		return m_local[node];
+	}
+
+	const mat4& TransformHierarchy::GetWorld(int node) const
+	{
+		return m_world[node];
+	}
+
+	vec3 TransformHierarchy::GetWorldPosition(int node) const
+	{
+		return vec3(m_world[node][3]);
+	}
+
+	int TransformHierarchy::GetParent(int node) const
+	{
+		return m_parents[node];
+	}
+
+	size_t TransformHierarchy::Count() const
+	{
+		return m_local.size();
+	}
+
+	size_t TransformHierarchy::Update()
+	{
+		const size_t count = Count();
+		size_t updated = 0;
+
+		// Children come after their parents, so a dirty parent has been handled
+		// (and has passed its flag on) before its children are visited
+		for (size_t i = m_firstDirty; i < count; ++i)
+		{
+			const int parent = m_parents[i];
+			if (parent >= 0 && m_dirty[parent])
+				m_dirty[i] = 1;
+
+			if (!m_dirty[i])
+				continue;
+
+			if (parent < 0)
+				m_world[i] = m_local[i];
+			else if (m_inheritance[i] == TransformInheritance::TRANSLATION)
+			{
+				m_world[i] = m_local[i];
+				m_world[i][3] += vec4(vec3(m_world[parent][3]), 0.0f);
+			}
+			else m_world[i] = m_world[parent] * m_local[i];
+
+			++updated;
+		}
+
+		// The flags are only cleared after the pass, children read their parents flag
+		for (size_t i = m_firstDirty; i < count; ++i)
+			m_dirty[i] = 0;
+
+		m_firstDirty = count;
+		return updated;
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace jge
+{
+	// What a node takes over from its parents world matrix
+	enum class TransformInheritance
+	{
+		ALL,				// world = parent world * local
+		TRANSLATION,		// world = translate(parent position) * local, e.g. moons and rings
+	};
+
+	/**
+	* Parent/child transforms stored as flat arrays in topological order:
+	* a node can only be added after its parent, so one pass from front to
+	* back sees every parent before its children. Changing a local matrix
+	* marks the node dirty and Update() recomputes only the dirty nodes and
+	* their descendants. Nodes that don't change cost a flag test per Update().
+	*/
+	class TransformHierarchy
+	{
+	public:
+		static const int NO_PARENT = -1;
+
+		TransformHierarchy();
+
+		// Adds a node and returns its index. <parent> has to exist already.
+		int Add(int parent = NO_PARENT, const glm::mat4& local = glm::mat4(1.0f),
+			TransformInheritance inheritance = TransformInheritance::ALL);
+		void Clear();
+
+		void SetLocal(int node, const glm::mat4& local);
+		const glm::mat4& GetLocal(int node) const;
+
+		// Valid after Update()
+		const glm::mat4& GetWorld(int node) const;
+		glm::vec3 GetWorldPosition(int node) const;
+
+		int GetParent(int node) const;
+		size_t Count() const;
+
+		// Recomputes the world matrices of all dirty nodes and their
+		// descendants. Returns the number of recomputed nodes.
+		size_t Update();
+
+	private:
+		std::vector<glm::mat4> m_local;
+		std::vector<glm::mat4> m_world;
+		std::vector<int> m_parents;
+		std::vector<TransformInheritance> m_inheritance;
+
+		// Per node: 1 if its local matrix changed since the last Update(),
+		// during Update() also set for nodes whose parent moved.
+		std::vector<unsigned char> m_dirty;
+		size_t m_firstDirty;		// nodes before it are up to date
+	};
+}
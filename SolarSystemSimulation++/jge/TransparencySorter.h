@@ -11,6 +11,13 @@ namespace jge
 	public:
 		static void SortTrianglesByDistanceToCamera(const glm::vec3& cameraPos, Mesh* mesh, const glm::mat4& modelMatrix)
 		{
+			// Indexed meshes only reorder their indices
+			if (!mesh->GetIndices()->empty())
+			{
+				SortIndexedTrianglesByDistanceToCamera(cameraPos, mesh, modelMatrix);
+				return;
+			}
+
 			std::vector<glm::vec3>* verts = mesh->GetVertices();
 			std::vector<glm::vec2>* uvs = mesh->GetTexCoords2D();
 			std::vector<glm::vec3>* normals = mesh->GetNormals();
@@ -46,6 +53,38 @@ namespace jge
 
 	private:
 
+		static void SortIndexedTrianglesByDistanceToCamera(const glm::vec3& cameraPos, Mesh* mesh, const glm::mat4& modelMatrix)
+		{
+			const std::vector<glm::vec3>& verts = *mesh->GetVertices();
+			std::vector<GLuint>& indices = *mesh->GetIndices();
+
+			std::vector<IndexedTriangle> triangles(indices.size() / 3);
+			for (unsigned int i = 0; i < triangles.size(); ++i)
+			{
+				IndexedTriangle& t = triangles[i];
+				for (int k = 0; k < 3; ++k)
+					t.indices[k] = indices[i * 3 + k];
+
+				glm::vec3 s = CalcCentroid(verts[t.indices[0]], verts[t.indices[1]], verts[t.indices[2]]);
+				t.distance = glm::length(cameraPos - glm::vec3(modelMatrix * glm::vec4(s, 1.0f)));
+			}
+
+			// Far to near
+			std::sort(triangles.begin(), triangles.end(), [](const IndexedTriangle& a, const IndexedTriangle& b) { return a.distance > b.distance; });
+
+			for (unsigned int i = 0; i < triangles.size(); ++i)
+			{
+				for (int k = 0; k < 3; ++k)
+					indices[i * 3 + k] = triangles[i].indices[k];
+			}
+		}
+
+		struct IndexedTriangle
+		{
+			float distance;
+			GLuint indices[3];
+		};
+
 		struct Triangle
 		{
 			Triangle(glm::vec3 _a, glm::vec3 _b, glm::vec3 _c, glm::vec2 uv1, glm::vec2 uv2, glm::vec2 uv3, glm::vec3 n1, glm::vec3 n2, glm::vec3 n3, glm::mat4 mm)
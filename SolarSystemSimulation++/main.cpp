@@ -4,6 +4,15 @@
 #include <glm/glm.hpp>						// Math
 #include <glm/gtx/transform.hpp>			// 3D transforms
 #include <glm/gtx/matrix_transform_2d.hpp>	// 2D transforms
+#include <random>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <future>
 
 #include "jge/Mesh.h"
 #include "jge/Model.h"
@@ -14,11 +23,24 @@
 #include "jge/Measurement.h"
 #include "jge/Texture.h"
 #include "jge/Util.h"
+#include "jge/InstancedModel.h"
+#include "jge/ThreadPool.h"
+#include "jge/TransformHierarchy.h"
+#include "jge/StateBuffer.h"
 
 #include "PlanetInfo.h"
 #include "PlanetData.h"
 #include "PlanetMovementSystem.h"
+#include "NBodySystem.h"
+#include "KeplerPropagator.h"
+#include "JplEphemeris.h"
+#include "BodyCatalog.h"
+#include "SimulationRecording.h"
+#include "BoundingVolumeHierarchy.h"
+#include "EventFinder.h"
 #include "GpuInfo.h"
+#include "Simulation.h"
+#include "Headless.h"
 
 #include "imgui\imgui.h"
 #include "imgui_impl_glfw_gl3.h"
@@ -65,7 +87,15 @@ float simSpeeds[] =
 	800.0f / SIMULATION_FREQ,
 };
 double simulationTime;
-float simulationTick = simSpeeds[2];
+std::atomic<float> simulationTick(simSpeeds[2]);
+
+// The simulation steps on its own thread, SIMULATION_SUBSTEPS times per
+// SIMULATION_DELTA. The render thread blends the two latest states.
+const int SIMULATION_SUBSTEPS = 1;
+std::thread simulationThread;
+std::atomic<bool> simulationRunning(false);
+std::mutex simulationMutex;		// held during a step, the UI takes it to change the simulation
+double displayTime = 0.0;		// simulation time shown in the current frame
 
 // The Scene Composition
 LightSource* sunLight;
@@ -77,6 +107,7 @@ ShaderProgram glowmapShader;
 ShaderProgram blendShader;
 ShaderProgram textShader;
 ShaderProgram starShader;
+ShaderProgram instancedShader;
 
 // Meshes
 Mesh highPolySphere;
@@ -85,6 +116,7 @@ Mesh lowPolySphere;
 Mesh ringMesh;
 Mesh circleMesh;
 Mesh starMesh;
+Mesh asteroidMesh;
 
 // Models (Meshes + Texture)
 Model bodies[12];
@@ -93,6 +125,29 @@ Model saturnrings;
 Model orbits[8];
 Model stars;
 
+// Files of the windowed mode, the simulation itself lives in Simulation.cpp
+const char* EPHEMERIS_FILE = "ephemeris\\de440.bin";
+const char* RECORDING_FILE = "recording.ssr";
+
+// Asteroid belt between mars and jupiter, drawn with one instanced draw call
+const int ASTEROID_COUNT = 100000;
+InstancedModel asteroids;
+
+// Spheres of all pickable bodies for the mouse picking and proximity queries.
+// Sphere i is body i of the catalog, sphere bEnd + j is asteroid j.
+BoundingVolumeHierarchy pickingTree;
+std::vector<vec3> pickingCenters;
+std::vector<float> pickingRadii;
+double pickingUpdateTime = 0.0;
+
+// Eclipse and conjunction search, runs in the background
+std::future<std::vector<AstronomicalEvent>> eventSearch;
+std::vector<AstronomicalEvent> events;
+double eventSearchTime = 0.0;			// start of the running search, duration of the last one
+
+StateBuffer<SimulationState> simulationStates;
+float appliedAlpha = -1.0f;			// blend factor of the last applied states
+
 FrameCounter fpsCounter;
 
 // Forward declarations
@@ -100,7 +155,10 @@ void Display();
 void DisplayUi();
 void InitGraphics();
 void InitData();
-void Update(double simTime);
+void RunSimulation();
+void ApplySimulationState(double wallTime);
+void UpdatePickingTree();
+const char* GetBodyName(int index);
 void DoPlanetSelection(glm::vec3 rayOrigin, glm::vec3 rayDirection);
 
 GLuint LoadShader(GLenum type, const char* path);
@@ -295,8 +353,16 @@ void ProcessInput(double fracLastInput)
 /**
  * Entry Point: Manages OpenGL context creation, window creation, gameloop
  */
-int main(void)
+int main(int argc, char** argv)
 {
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--headless") == 0)
+			return RunHeadless(argc, argv);
+		if (strcmp(argv[i], "--convert-catalog") == 0 && i + 2 < argc)
+			return BodyCatalog::Convert(argv[i + 1], argv[i + 2]) ? 0 : -1;
+	}
+
 	if (!glfwInit())
 	{
 		MessageBox(NULL, "Failed to initialize GLFW.\r\nThis should never happen...", "Much Uh-oh :/", MB_OK | MB_ICONERROR);
@@ -354,6 +420,8 @@ int main(void)
 	try
 	{
 		InitGraphics();
+		InitSimulation(CATALOG_FILE, ASTEROID_COUNT);
+		InitEphemeris(EPHEMERIS_FILE);
 		InitData();
 	}
 	catch (const std::runtime_error& ex)
@@ -375,28 +443,30 @@ int main(void)
 	glfwSetWindowSizeCallback(window, OnResizeViewport);
 	glfwSetWindowCloseCallback(window, OnWindowClosing);
 
-	double simOldTime = glfwGetTime();
-	double simNewTime;
-	double simTickDiff;
 	double inputOldTime = glfwGetTime();
+	double inputNewTime;
 
-	simulationTime = 0.0f;
+	// The first state is published here, so the first frame has something to show
+	simulationTime = 0.0;
+	SimulationState& first = simulationStates.GetWriteState();
+	Update(simulationTime, first);
+	first.wallTime = glfwGetTime();
+	simulationStates.Publish();
+
+	simulationRunning = true;
+	simulationThread = std::thread(RunSimulation);
 
 	// Loop until the user closes the window
 	while (!glfwWindowShouldClose(window))
 	{
 		ImGui_ImplGlfwGL3_NewFrame();
 
-		// The simulationtime gets incremented every delta-t (0.01667s) = 60Hz by the simulation speed (simulationTick).
-		simNewTime = glfwGetTime();
-        simTickDiff = (simNewTime - simOldTime) / SIMULATION_DELTA;
-		simOldTime = simNewTime;
-		simulationTime += simTickDiff * simulationTick;
-		
-		// We update as often as possible and also interpolate the simulationtime to get that extra bit of smoothness.
-		// Rendering is also done as often as possible
-        ProcessInput(simTickDiff);
-		Update(simulationTime);
+		// Input and rendering run as often as possible, the simulation on its own thread.
+		// The frame shows the simulation states blended to the current time.
+		inputNewTime = glfwGetTime();
+		ProcessInput((inputNewTime - inputOldTime) / SIMULATION_DELTA);
+		inputOldTime = inputNewTime;
+		ApplySimulationState(inputNewTime);
 		Display();
 		DisplayUi();
 
@@ -407,6 +477,9 @@ int main(void)
 		glfwPollEvents();
 	}
 
+	simulationRunning = false;
+	simulationThread.join();
+
 	ImGui_ImplGlfwGL3_Shutdown();
 
 	glfwTerminate();
@@ -435,8 +508,9 @@ void InitGraphics()
 	lightingShader.RegisterUniform("texTransform[1]");	// uniform doesn't count as active, so register it manually?
 
 	GLuint shadowVShader = LoadShader(GL_VERTEX_SHADER, "shader\\vsm.vert");
+	GLuint shadowGShader = LoadShader(GL_GEOMETRY_SHADER, "shader\\vsm.geom");
 	GLuint shadowFShader = LoadShader(GL_FRAGMENT_SHADER, "shader\\vsm.frag");
-	shadowShader.Create(shadowVShader, shadowFShader);
+	shadowShader.Create(shadowVShader, shadowGShader, shadowFShader);
 
 	GLuint skyboxVShader = LoadShader(GL_VERTEX_SHADER, "shader\\skybox.vert");
 	GLuint skyboxFShader = LoadShader(GL_FRAGMENT_SHADER, "shader\\skybox.frag");
@@ -461,6 +535,10 @@ void InitGraphics()
 	GLuint starFShader = LoadShader(GL_FRAGMENT_SHADER, "shader\\stars.frag");
 	starShader.Create(starVShader, starFShader);
 
+	GLuint instancedVShader = LoadShader(GL_VERTEX_SHADER, "shader\\instanced.vert");
+	GLuint instancedFShader = LoadShader(GL_FRAGMENT_SHADER, "shader\\instanced.frag");
+	instancedShader.Create(instancedVShader, instancedFShader);
+
 	sw.Stop();
 	double shaderTiming = sw.GetElapsedTime();
 	printf("Loaded shaders in %3.3f seconds.\r\n", shaderTiming);
@@ -543,13 +621,19 @@ void InitData()
 	printf("Loaded textures in %3.3f seconds.\r\n", textureTiming);
 	sw.Start();
 
-	// Load sphere models in different detail levels
+	// Load sphere models in different detail levels, the lit meshes are stored
+	// packed. The stars use their normals as colors, they stay float.
+	Mesh* packedMeshes[] = { &highPolySphere, &mediumPolySphere, &lowPolySphere, &ringMesh, &asteroidMesh };
+	for (Mesh* mesh : packedMeshes)
+		mesh->SetVertexLayout(Mesh::LAYOUT_PACKED);
+
 	highPolySphere.FromObjectFile("models\\sphereHighPoly.obj", true);
 	mediumPolySphere.FromObjectFile("models\\sphereMediumPoly.obj", true);
 	lowPolySphere.FromObjectFile("models\\sphereLowPoly.obj", true);
 
 	// Other models
 	ringMesh.FromObjectFile("models\\saturnrings.obj");
+	asteroidMesh.FromObjectFile("models\\asteroid.obj");
 
 	// Stars
 	LoadStarCatalog(starMesh);
@@ -583,14 +667,6 @@ void InitData()
 	orbits[0].SetShadowCasting(false);
 	orbits[0].SetTextureUsage(false);
 	orbits[1] = orbits[2] = orbits[3] = orbits[4] = orbits[5] = orbits[6] = orbits[7] = orbits[0];
-	orbits[0].modelMatrix = glm::scale(glm::rotate(mercuryInfo.orbitInclination, vec3(0, 0, 1)), glm::vec3(mercuryInfo.distanceToParent, 0, mercuryInfo.distanceToParent));
-	orbits[1].modelMatrix = glm::scale(glm::rotate(venusInfo.orbitInclination, vec3(0, 0, 1)), glm::vec3(venusInfo.distanceToParent, 0, venusInfo.distanceToParent));
-	orbits[2].modelMatrix = glm::scale(glm::rotate(earthInfo.orbitInclination, vec3(0, 0, 1)), glm::vec3(earthInfo.distanceToParent, 0, earthInfo.distanceToParent));
-	orbits[3].modelMatrix = glm::scale(glm::rotate(marsInfo.orbitInclination, vec3(0, 0, 1)), glm::vec3(marsInfo.distanceToParent, 0, marsInfo.distanceToParent));
-	orbits[4].modelMatrix = glm::scale(glm::rotate(jupiterInfo.orbitInclination, vec3(0, 0, 1)), glm::vec3(jupiterInfo.distanceToParent, 0, jupiterInfo.distanceToParent));
-	orbits[5].modelMatrix = glm::scale(glm::rotate(saturnInfo.orbitInclination, vec3(0, 0, 1)), glm::vec3(saturnInfo.distanceToParent, 0, saturnInfo.distanceToParent));
-	orbits[6].modelMatrix = glm::scale(glm::rotate(uranusInfo.orbitInclination, vec3(0, 0, 1)), glm::vec3(uranusInfo.distanceToParent, 0, uranusInfo.distanceToParent));
-	orbits[7].modelMatrix = glm::scale(glm::rotate(neptuneInfo.orbitInclination, vec3(0, 0, 1)), glm::vec3(neptuneInfo.distanceToParent, 0, neptuneInfo.distanceToParent));
 	float ringAlpha = 0.1f;
 	orbits[0].SetColor(vec4(0.3f, 0.3f, 0.3f, ringAlpha));
 	orbits[1].SetColor(vec4(0.3f, 0.3f, 0.3f, ringAlpha));
@@ -603,7 +679,7 @@ void InitData()
 
 	// Sun is not affected by lighting (light source is inside the sun)
 	// static modelmatrix in case i am removing the animation in Update()
-    bodies[bSun].modelMatrix = glm::scale(glm::mat4(1.0f), glm::vec3(sunInfo.planetSize, sunInfo.planetSize, sunInfo.planetSize));
+    bodies[bSun].modelMatrix = glm::scale(glm::mat4(1.0f), glm::vec3(catalog.GetInfo(bSun).planetSize));
     bodies[bSun].SetMeshes(&highPolySphere);
     bodies[bSun].SetTexture(sunTex, 0);
     bodies[bSun].SetTexture(sunTex2, 1);
@@ -675,6 +751,28 @@ void InitData()
 	{
 		scene->AddModel(&orbits[i]);
 	}
+
+	// Bodies sharing a sphere mesh are drawn instanced with their textures in arrays
+	pipeline->BuildTextureArrays(2048);
+
+	// Center the asteroid mesh and scale it to a diameter of 1, the instance
+	// matrices then scale it to the asteroids size like the planets
+	std::vector<vec3>& vertices = *asteroidMesh.GetVertices();
+	vec3 lower(1e30f), upper(-1e30f);
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		lower = glm::min(lower, vertices[i]);
+		upper = glm::max(upper, vertices[i]);
+	}
+	vec3 extent = upper - lower;
+	float diameter = glm::max(extent.x, glm::max(extent.y, extent.z));
+	asteroids.modelMatrix = glm::scale(vec3(1.0f / diameter)) * glm::translate(-0.5f * (lower + upper));
+	asteroids.SetMesh(&asteroidMesh);
+	asteroids.SetShader(&instancedShader);
+	asteroids.SetInstanceCount(asteroidColors.size());
+	std::copy(asteroidColors.begin(), asteroidColors.end(), asteroids.GetColors());
+	asteroids.InvalidateColors();
+	scene->AddInstancedModel(&asteroids);
 }
 
 
@@ -692,13 +790,24 @@ int callCnt = 0;
 int sp = 0, np = 0, aa = 0, pp = 0;
 int brightness = 50;
 int shadowMapQuality = 1;
+int shadowSideBudget = 0;
+bool analyticShadows = false;
 bool normalMappingEnabled = true;
 bool orbitsEnabled = true;
 const char* itemList = "Low (512px)\0Medium (768px)\0High (1024px)\0Very High (2048px)\0";
+int integrator = INTEGRATOR_YOSHIDA4;
+const char* integratorList = "Leapfrog\0Yoshida 4th order\0";
+int forceMethod = FORCE_DIRECT;
+const char* forceMethodList = "Exact (direct sum)\0Barnes-Hut\0";
+float openingAngle = 0.5f;
+float nbodyTimeStep = 0.25f;
 
 bool showSimInfo = true;
 bool showGraphicOptions = true;
 bool showPlanetInfo = true;
+bool showEvents = false;
+int eventSearchType = 0;
+int eventSearchYears = 100;
 void DisplayUi()
 {
 	ImGuiStyle& style = ImGui::GetStyle();
@@ -727,6 +836,7 @@ void DisplayUi()
 		ImGui::MenuItem("Sim. Info", NULL, &showSimInfo);
 		ImGui::MenuItem("Options", NULL, &showGraphicOptions);
 		ImGui::MenuItem("Selection", NULL, &showPlanetInfo);
+		ImGui::MenuItem("Events", NULL, &showEvents);
 		ImGui::EndMenu();
 	}
 	ImGui::EndMainMenuBar();
@@ -736,13 +846,34 @@ void DisplayUi()
 		if (ImGui::Begin("Info", &showSimInfo))
 		{
 			ImGui::Text("%-12s %d (%.1f ms)", "fps:", fpsCounter.GetFPS(), fpsCounter.GetTimeForFrame());
-			ImGui::Text("%-12s %.1f days", "time:", (float)simulationTime);
+			const SimulationState& state = simulationStates.GetLatest();
+			ImGui::Text("%-12s %.1f days", "time:", (float)displayTime);
 			ImGui::Text("%-12s %.1f days/s", "sim speed:", simulationTick * SIMULATION_FREQ);
+			if (nbodyEnabled)
+				ImGui::Text("%-12s %d bodies (%.1f ms)", "n-body:", state.nbodyCount, state.nbodyStepTime * 1000.0);
+			if (ephemerisEnabled)
+				ImGui::Text("%-12s DE%d, JD %.1f", "ephemeris:", ephemeris.GetVersion(), JplEphemeris::J2000 + displayTime);
+			if (asteroidsEnabled)
+				ImGui::Text("%-12s %d of %d bodies (%.1f ms)", "asteroids:", (int)asteroids.GetVisibleCount(), (int)asteroids.GetInstanceCount(), state.asteroidUpdateTime * 1000.0);
+			if (recorder.IsOpen())
+				ImGui::Text("%-12s %d frames (%.1f KB)", "recording:", (int)state.recordedFrames, state.recordedBytes / 1024.0);
+			if (playbackEnabled)
+				ImGui::Text("%-12s %d frames, days %.1f - %.1f", "replay:", (int)player.GetFrameCount(), player.GetStartTime(), player.GetEndTime());
+			ImGui::Text("%-12s %d nodes (%.2f ms, %d rebuilds)", "picking:", (int)pickingTree.GetNodeCount(), pickingUpdateTime * 1000.0, (int)pickingTree.GetRebuildCount());
+
+			float distance;
+			int nearest = pickingTree.Nearest(camera->GetPosition(), FAR_PLANE, distance);
+			if (nearest >= 0)
+				ImGui::Text("%-12s %s (%.1f)", "nearest:", GetBodyName(nearest), distance);
 
 			ImGui::Text("\r\n%-12s %d us", "shadow:", sp);
 			ImGui::Text("%-12s %d us", "render:", np);
 			ImGui::Text("%-12s %d us", "msaa:", aa);
 			ImGui::Text("%-12s %d us", "post:", pp);
+			ImGui::Text("%-12s %d of %d", "visible:", scene->GetVisibleModelCount(), scene->GetModelCount());
+			ImGui::Text("%-12s %d", "draw calls:", pipeline->GetDrawCallCount());
+			ImGui::Text("%-12s %d", "shadow sides:", pipeline->GetShadowSideCount());
+			ImGui::Text("%-12s %d sent, %d skipped", "uniforms:", ShaderProgram::GetIssuedUploads(), ShaderProgram::GetSkippedUploads());
 		}
 		ImGui::End();
 	}
@@ -762,6 +893,14 @@ void DisplayUi()
 				default: break;
 				}
 			}
+			if (ImGui::SliderInt("Shadow sides", &shadowSideBudget, 0, 24, shadowSideBudget > 0 ? "%.0f per frame" : "all"))
+			{
+				pipeline->SetShadowSideBudget(shadowSideBudget);
+			}
+			if (ImGui::Checkbox("Analytic Shadows", &analyticShadows))
+			{
+				pipeline->SetShadowMode(analyticShadows ? SHADOW_ANALYTIC : SHADOW_CUBE_MAPS);
+			}
 			if (ImGui::SliderInt("Brightness", &brightness, 0, 100, "%.0f%%"))
 			{
 				pipeline->SetBrightness(brightness);
@@ -785,6 +924,90 @@ void DisplayUi()
                         : scene->RemoveModel(&orbits[i]);
                 }
             }
+
+			// The simulation thread reads these settings, so they are only written
+			// under <simulationMutex>. Only this thread writes them, reading is fine.
+			bool enabled = asteroidsEnabled;
+			if (ImGui::Checkbox("Asteroid Belt", &enabled))
+			{
+				std::lock_guard<std::mutex> lock(simulationMutex);
+				asteroidsEnabled = enabled;
+				transformsTime = NAN;
+				asteroidsEnabled
+					? scene->AddInstancedModel(&asteroids)
+					: scene->RemoveInstancedModel(&asteroids);
+			}
+			enabled = ephemerisEnabled;
+			if (ephemeris.IsOpen() && ImGui::Checkbox("JPL Ephemeris", &enabled))
+			{
+				std::lock_guard<std::mutex> lock(simulationMutex);
+				ephemerisEnabled = enabled;
+				transformsTime = NAN;
+			}
+			enabled = nbodyEnabled;
+			if (ImGui::Checkbox("N-Body Gravity", &enabled))
+			{
+				std::lock_guard<std::mutex> lock(simulationMutex);
+				nbodyEnabled = enabled;
+				if (nbodyEnabled)
+					ResetNBody(simulationTime);
+				transformsTime = NAN;
+			}
+			if (ImGui::Combo("Integrator", &integrator, integratorList))
+			{
+				std::lock_guard<std::mutex> lock(simulationMutex);
+				nbody.SetIntegrator((NBodyIntegrator)integrator);
+			}
+			if (ImGui::SliderFloat("Time Step", &nbodyTimeStep, 0.05f, 5.0f, "%.2f days"))
+			{
+				std::lock_guard<std::mutex> lock(simulationMutex);
+				nbody.SetTimeStep(nbodyTimeStep);
+			}
+			if (ImGui::Combo("Gravity", &forceMethod, forceMethodList))
+			{
+				std::lock_guard<std::mutex> lock(simulationMutex);
+				nbody.SetForceMethod((NBodyForceMethod)forceMethod);
+			}
+			if (ImGui::SliderFloat("Opening Angle", &openingAngle, 0.0f, 1.5f))
+			{
+				std::lock_guard<std::mutex> lock(simulationMutex);
+				nbody.SetOpeningAngle(openingAngle);
+			}
+			enabled = recorder.IsOpen();
+			if (!playbackEnabled && ImGui::Checkbox("Record", &enabled))
+			{
+				std::lock_guard<std::mutex> lock(simulationMutex);
+				if (enabled)
+					recorder.Open(RECORDING_FILE, bEnd);
+				else recorder.Close();
+			}
+			enabled = playbackEnabled;
+			if (!recorder.IsOpen() && ImGui::Checkbox("Replay", &enabled))
+			{
+				std::lock_guard<std::mutex> lock(simulationMutex);
+				if (enabled && InitPlayback(RECORDING_FILE))
+					simulationTime = player.GetStartTime();
+				else
+				{
+					playbackEnabled = false;
+					player.Close();
+				}
+				transformsTime = NAN;
+			}
+			float replayTime = (float)displayTime;
+			if (playbackEnabled && ImGui::SliderFloat("Replay Time", &replayTime, (float)player.GetStartTime(), (float)player.GetEndTime(), "%.1f days"))
+			{
+				std::lock_guard<std::mutex> lock(simulationMutex);
+				simulationTime = replayTime;
+			}
+			int beltBodies = nbodyBeltBodies;
+			if (ImGui::SliderInt("Belt Bodies", &beltBodies, 0, 50000))
+			{
+				std::lock_guard<std::mutex> lock(simulationMutex);
+				nbodyBeltBodies = beltBodies;
+				if (nbodyEnabled)
+					ResetNBody(simulationTime);
+			}
 		}
 		ImGui::End();
 	}
@@ -794,12 +1017,73 @@ void DisplayUi()
 		if (ImGui::Begin("Selection", &showPlanetInfo))
 		{
 			int si = selectedBodyIndex;
-			ImGui::Text("%-12s %s", "Name:", bodyNames[si]);
-			ImGui::Text("%-12s %.1f", "Size:", planetInfo[si].planetSize);
-			ImGui::Text("%-12s %.1f days around parent", "RTT:", planetInfo[si].roundTripTime);
-			ImGui::Text("%-12s %.1f earth days/rotation", "Revs:", planetInfo[si].selfRotationTime);
-			ImGui::Text("%-12s %.1f deg", "Equator inclination:", glm::degrees(planetInfo[si].equatorInclination));
-			ImGui::Text("%-12s %.1f deg", "Orbit inclination:", glm::degrees(planetInfo[si].orbitInclination));
+			if (si < (int)catalog.Count())
+			{
+				const PlanetInfo& info = catalog.GetInfo(si);
+				ImGui::Text("%-12s %s", "Name:", catalog.GetName(si));
+				ImGui::Text("%-12s %.1f", "Size:", info.planetSize);
+				ImGui::Text("%-12s %.1f days around parent", "RTT:", info.roundTripTime);
+				ImGui::Text("%-12s %.1f earth days/rotation", "Revs:", info.selfRotationTime);
+				ImGui::Text("%-12s %.1f deg", "Equator inclination:", glm::degrees(info.equatorInclination));
+				ImGui::Text("%-12s %.1f deg", "Orbit inclination:", glm::degrees(info.orbitInclination));
+				ImGui::Text("%-12s %.3f", "Eccentricity:", info.eccentricity);
+			}
+			else
+			{
+				// Random belt asteroid, it only has a size
+				ImGui::Text("%-12s %s", "Name:", GetBodyName(si));
+				ImGui::Text("%-12s %.2f", "Size:", asteroidElements.size[si - bEnd]);
+			}
+		}
+		ImGui::End();
+	}
+
+	if (showEvents)
+	{
+		if (ImGui::Begin("Events", &showEvents))
+		{
+			if (eventSearch.valid() && eventSearch.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+			{
+				events = eventSearch.get();
+				eventSearchTime = glfwGetTime() - eventSearchTime;
+			}
+
+			ImGui::Combo("Search", &eventSearchType, eventSearchList);
+			ImGui::SliderInt("Years", &eventSearchYears, 1, 1000);
+			if (eventSearch.valid())
+				ImGui::Text("Searching...");
+			else
+			{
+				// From the displayed time on. The orbits are read only, so the search can run in the background.
+				if (ImGui::Button("Find"))
+				{
+					const double end = displayTime + eventSearchYears * 365.25;
+					eventSearch = std::async(std::launch::async, FindEvents, eventSearchType, displayTime, end);
+					eventSearchTime = glfwGetTime();
+				}
+				ImGui::SameLine();
+				ImGui::Text("%d events (%.2f s)", (int)events.size(), eventSearchTime);
+			}
+
+			// Clicking an event jumps to it
+			ImGui::BeginChild("EventList");
+			ImGuiListClipper clipper((int)events.size());
+			while (clipper.Step())
+			{
+				for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i)
+				{
+					char label[128];
+					FormatEvent(events[i], label, sizeof(label));
+					ImGui::PushID(i);
+					if (ImGui::Selectable(label))
+					{
+						std::lock_guard<std::mutex> lock(simulationMutex);
+						simulationTime = events[i].time;
+					}
+					ImGui::PopID();
+				}
+			}
+			ImGui::EndChild();
 		}
 		ImGui::End();
 	}
@@ -809,54 +1093,182 @@ void DisplayUi()
 
 
 /**
- * Routine responsible to calculate & update all objects state. => MVP matrix and other properties.
- * Called before rendering, once per frame, but with a time reference as parameter to be CPU speed independent.
- * @param time Number of elapsed simulation ticks. <SIMULATION_FREQ> ticks / s.
+ * Simulation thread. Steps Update() at SIMULATION_FREQ * SIMULATION_SUBSTEPS
+ * and publishes every new state to the render thread. A step that takes longer
+ * than its period (e.g. a big N-body system) isn't caught up on, the
+ * simulation then runs slower than real time instead of stalling the rendering.
+ */
+void RunSimulation()
+{
+	const double period = SIMULATION_DELTA / SIMULATION_SUBSTEPS;
+	double stepTime = glfwGetTime();
+
+	while (simulationRunning)
+	{
+		{
+			std::lock_guard<std::mutex> lock(simulationMutex);
+			simulationTime += simulationTick / SIMULATION_SUBSTEPS;
+			if (playbackEnabled)
+				simulationTime = glm::clamp(simulationTime, player.GetStartTime(), player.GetEndTime());
+
+			SimulationState& state = simulationStates.GetWriteState();
+			if (Update(simulationTime, state))
+			{
+				state.wallTime = stepTime;
+				simulationStates.Publish();
+			}
+		}
+
+		stepTime += period;
+		double now = glfwGetTime();
+		if (now > stepTime + period)
+			stepTime = now;
+
+		// Sleep is coarse on some systems, the last two milliseconds are yielded away
+		while ((now = glfwGetTime()) < stepTime && simulationRunning)
+		{
+			if (stepTime - now > 0.002)
+				std::this_thread::sleep_for(std::chrono::duration<double>(stepTime - now - 0.002));
+			else std::this_thread::yield();
+		}
+	}
+}
+
+
+/**
+ * Blends two transforms of the same body. The translation is interpolated
+ * linearly, the axes are interpolated and keep their length in <b>. Axes that
+ * turned by more than 90 degrees between the states can't be blended that way,
+ * the orientation of <b> is used then.
  */
-void Update(double time)
+mat4 BlendTransforms(const mat4& a, const mat4& b, float alpha)
 {
+	mat4 m = b;
+	m[3] = mix(a[3], b[3], alpha);
+	for (int c = 0; c < 3; ++c)
+	{
+		if (dot(vec3(a[c]), vec3(b[c])) <= 0.0f)
+			return m;
+	}
+	for (int c = 0; c < 3; ++c)
+	{
+		vec3 axis = normalize(mix(vec3(a[c]), vec3(b[c]), alpha));
+		m[c] = vec4(axis * length(vec3(b[c])), 0.0f);
+	}
+	return m;
+}
+
+
+/**
+ * Takes the newest simulation state and blends the two latest ones to <wallTime>.
+ * The frame shows the simulation one step behind: within one step period it
+ * moves from the previous to the latest state, so it never has to extrapolate.
+ */
+void ApplySimulationState(double wallTime)
+{
+	const bool fresh = simulationStates.Acquire();
+	const int received = simulationStates.GetReceivedCount();
+	if (received == 0)
+		return;
+
+	const SimulationState& b = simulationStates.GetLatest();
+	const SimulationState& a = received > 1 ? simulationStates.GetPrevious() : b;
+
+	float alpha = 1.0f;
+	if (b.wallTime > a.wallTime && a.nodes.size() == b.nodes.size())
+		alpha = (float)glm::clamp((wallTime - b.wallTime) / (b.wallTime - a.wallTime), 0.0, 1.0);
+
+	// Paused or waiting for the next state, the models are up to date
+	if (!fresh && alpha == appliedAlpha)
+		return;
+	appliedAlpha = alpha;
+
+	displayTime = a.time + (b.time - a.time) * alpha;
+
 	// Animate sun
-	float move = (float)(fmod(time, (double)sunInfo.selfRotationTime));
+	float move = (float)(fmod(displayTime, (double)catalog.GetInfo(bSun).selfRotationTime));
     bodies[bSun].textureTransforms[1] = glm::translate(mat3(), vec2(move*1.5, 0.0f));
-    bodies[bSun].modelMatrix = PlanetMovementSystem::OrbitAroundSun(time, sunInfo);
-	
 
-	// Update the planets position
-    bodies[bMercury].modelMatrix =	PlanetMovementSystem::OrbitAroundSun(time, mercuryInfo);
-    bodies[bVenus].modelMatrix =	PlanetMovementSystem::OrbitAroundSun(time, venusInfo);
-    bodies[bEarth].modelMatrix =	PlanetMovementSystem::OrbitAroundSun(time, earthInfo);
-    bodies[bMars].modelMatrix =		PlanetMovementSystem::OrbitAroundSun(time, marsInfo);
-    bodies[bJupiter].modelMatrix =	PlanetMovementSystem::OrbitAroundSun(time, jupiterInfo);
-    bodies[bSaturn].modelMatrix =	PlanetMovementSystem::OrbitAroundSun(time, saturnInfo);
-    bodies[bUranus].modelMatrix =	PlanetMovementSystem::OrbitAroundSun(time, uranusInfo);
-    bodies[bNeptune].modelMatrix =	PlanetMovementSystem::OrbitAroundSun(time, neptuneInfo);
-
-	// Update the moons positions...
-    bodies[bIo].modelMatrix =		PlanetMovementSystem::OrbitAroundParent(time, ioInfo, vec3(bodies[bJupiter].modelMatrix[3]));
-    bodies[bEuropa].modelMatrix =	PlanetMovementSystem::OrbitAroundParent(time, europaInfo, vec3(bodies[bJupiter].modelMatrix[3]));
-    bodies[bMoon].modelMatrix =		PlanetMovementSystem::OrbitAroundParent(time, moonInfo, vec3(bodies[bEarth].modelMatrix[3]));
-
-	// ... and the saturn ring
-	saturnrings.modelMatrix = PlanetMovementSystem::SimulateRing(time, saturnRing, vec3(bodies[bSaturn].modelMatrix[3]));
+	for (int i = bSun; i < bEnd; ++i)
+		bodies[i].modelMatrix = BlendTransforms(a.nodes[i], b.nodes[i], alpha);
+	saturnrings.modelMatrix = BlendTransforms(a.nodes[ringNode], b.nodes[ringNode], alpha);
+	for (int i = 0; i < 8; ++i)
+		orbits[i].modelMatrix = b.nodes[orbitNodes[i]];
+
+	// Only the asteroids positions are blended, they tumble too fast for their axes
+	if (b.asteroidsValid)
+	{
+		mat4* instances = asteroids.GetTransforms();
+		const size_t count = glm::min(b.asteroids.size(), asteroids.GetInstanceCount());
+		const bool blend = a.asteroidsValid && a.asteroids.size() == b.asteroids.size();
+		for (size_t i = 0; i < count; ++i)
+		{
+			instances[i] = b.asteroids[i];
+			if (blend)
+				instances[i][3] = mix(a.asteroids[i][3], b.asteroids[i][3], alpha);
+		}
+	}
+
+	UpdatePickingTree();
+}
+
+
+/**
+ * Moves the spheres of <pickingTree> to the displayed bodies and asteroids.
+ * Only the boxes are refit, the tree rebuilds itself once they got too loose.
+ */
+void UpdatePickingTree()
+{
+	Stopwatch sw;
+	sw.Start();
+
+	const size_t asteroidCount = asteroids.GetInstanceCount();
+	pickingCenters.resize(bEnd + asteroidCount);
+	pickingRadii.resize(bEnd + asteroidCount);
+
+	// The sun isn't pickable
+	for (int i = bSun; i < bEnd; ++i)
+	{
+		pickingCenters[i] = bodies[i].GetPosition();
+		pickingRadii[i] = i == bSun ? 0.0f : catalog.GetInfo(i).planetSize;
+	}
+
+	// The asteroid mesh is scaled to a diameter of 1, hidden ones stay in the tree with radius 0
+	const mat4* instances = asteroids.GetTransforms();
+	for (size_t j = 0; j < asteroidCount; ++j)
+	{
+		pickingCenters[bEnd + j] = vec3(instances[j][3]);
+		pickingRadii[bEnd + j] = asteroidsEnabled ? 0.5f * asteroidElements.size[j] : 0.0f;
+	}
+
+	if (pickingTree.GetCount() != pickingCenters.size())
+		pickingTree.Build(pickingCenters.data(), pickingRadii.data(), pickingCenters.size());
+	else pickingTree.Refit(pickingCenters.data(), pickingRadii.data());
+
+	sw.Stop();
+	pickingUpdateTime = sw.GetElapsedTime();
 }
 
+/**
+ * Name of sphere <index> of <pickingTree>. Random asteroids aren't in the catalog
+ * and share a static buffer.
+ */
+const char* GetBodyName(int index)
+{
+	if (index < (int)catalog.Count())
+		return catalog.GetName(index);
+
+	static char name[32];
+	sprintf(name, "Asteroid %d", index - bEnd);
+	return name;
+}
 
 void DoPlanetSelection(glm::vec3 rayOrigin, glm::vec3 rayDirection)
 {
-    float smallestDistance = 999999.9f;
-    for (int i = bMercury; i < bEnd; ++i)
-    {
-		float radius = planetInfo[i].planetSize;
-        float d1, d2;
-        if(jge::Util::RaySphereIntersection(rayOrigin, rayDirection, bodies[i].GetPosition(), radius, d1, d2) > 0)
-        {
-            if (d1 > 0.0f && d1 < smallestDistance)
-            {
-                smallestDistance = d1;
-                selectedBodyIndex = i;
-            }
-        }
-    }
+	float distance;
+	int hit = pickingTree.Raycast(rayOrigin, rayDirection, distance);
+	if (hit >= 0)
+		selectedBodyIndex = hit;
 }
 
 
@@ -13,8 +13,14 @@ layout(location = 2) in vec3 in_texcoord;
 
 // Transformation Matrices
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 proj;
+
+// Camera of the frame, shared by all shaders
+layout(std140) uniform CameraBlock
+{
+	mat4 view;
+	mat4 proj;
+	vec4 viewPosition;
+};
 
 out vec3 inout_texcoord;
 
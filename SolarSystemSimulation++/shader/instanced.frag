@@ -0,0 +1,37 @@
+#version 330
+
+in vec3 inout_positionWorld;
+in vec3 inout_normal;
+in vec4 inout_color;
+
+// The pixels final color
+out vec4 out_color;
+
+// Light Definition, only the first light is used
+struct lightSource
+{
+	vec4 position;	// World Space
+	vec4 diffuse;	// Diffuse color
+	vec4 specular;	// Specular color
+	vec4 ambient;
+	float constantAttenuation, linearAttenuation, quadraticAttenuation;
+	float spotCosCutoff, spotExponent;
+	vec3 spotDirection;
+};
+
+layout(std140) uniform LightBlock
+{
+	lightSource lights[4];
+	int numberOfLights;
+};
+
+void main()
+{
+	// Plain lambert, the instances are too small for shadows and specular highlights
+	vec3 N = normalize(inout_normal);
+	vec3 L = normalize(lights[0].position.xyz - inout_positionWorld);
+	float diffuse = max(dot(N, L), 0.0);
+
+	out_color = inout_color * (lights[0].ambient + lights[0].diffuse * diffuse);
+	out_color.a = inout_color.a;
+}
@@ -0,0 +1,42 @@
+/*
+ * Vertex Shader for instanced models. Every instance brings its own
+ * model matrix and color as per instance vertex attributes.
+ */
+
+#version 330
+
+// Untransformed Inputs (Model Space)
+layout(location = 0) in vec3 in_position;
+layout(location = 1) in vec3 in_normal;
+
+// Per Instance Inputs
+layout(location = 5) in mat4 in_instanceMatrix;
+layout(location = 9) in vec4 in_instanceColor;
+
+// Transformed Outputs
+out vec3 inout_positionWorld;
+out vec3 inout_normal;
+out vec4 inout_color;
+
+// Transformation Matrices
+uniform mat4 model;
+
+// Camera of the frame, shared by all shaders
+layout(std140) uniform CameraBlock
+{
+	mat4 view;
+	mat4 proj;
+	vec4 viewPosition;
+};
+
+void main()
+{
+	mat4 world = in_instanceMatrix * model;
+	vec4 positionWorld = world * vec4(in_position, 1.0);
+
+	// Instances are scaled uniformly, no inverse transpose needed
+	inout_positionWorld = positionWorld.xyz;
+	inout_normal = normalize(vec3(world * vec4(in_normal, 0.0)));
+	inout_color = in_instanceColor;
+	gl_Position = proj * view * positionWorld;
+}
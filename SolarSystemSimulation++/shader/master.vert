@@ -4,8 +4,7 @@
 layout(location = 0) in vec3 in_position;
 layout(location = 1) in vec3 in_normal;
 layout(location = 2) in vec2 in_texcoord;
-layout(location = 3) in vec3 in_tangent;
-layout(location = 4) in vec3 in_bitangent;
+layout(location = 3) in vec4 in_tangent;		// w is the sign of the bitangent
 
 // Transformed Outputs
 out vec4 inout_positionWorld;
@@ -17,12 +16,39 @@ out vec3 inout_bitangent;
 out vec3 inout_lightVector;
 out vec3 inout_viewVector;
 
+// Material of instanced draws, the fragment shader takes the uniforms otherwise
+flat out ivec4 inout_layers;
+flat out ivec4 inout_options;
+flat out vec4 inout_color;
+
 // Transformation Matrices
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 proj;
 uniform mat3 texTransform[2];
 
+// Camera of the frame, shared by all shaders
+layout(std140) uniform CameraBlock
+{
+	mat4 view;
+	mat4 proj;
+	vec4 viewPosition;
+};
+
+// Per instance data of batched draws, matches RenderPipeline::InstanceData
+struct instanceData
+{
+	mat4 model;
+	mat3 texTransform[2];
+	ivec4 layers;		// texture 0 and 1, normal and specular map, -1 if unused
+	ivec4 options;		// useColor, blendMode, excludeFromLighting
+	vec4 color;
+};
+
+layout(std140) uniform InstanceBlock
+{
+	instanceData instances[64];
+};
+uniform int useInstances;
+
 // Light Definition
 struct lightSource
 {
@@ -35,8 +61,11 @@ struct lightSource
 	vec3 spotDirection;
 };
 
-uniform lightSource lights[4];
-uniform vec4 viewPosition;
+layout(std140) uniform LightBlock
+{
+	lightSource lights[4];
+	int numberOfLights;
+};
 
 // Multiplication of Normals:
 // transform(inverse(M)) for non orthhogonal matrices
@@ -48,21 +77,39 @@ uniform vec4 viewPosition;
 
 void main()
 {
-	inout_positionWorld = model * vec4(in_position, 1.0);
+	mat4 modelMatrix = model;
+	mat3 texTransform0 = texTransform[0];
+	mat3 texTransform1 = texTransform[1];
+	inout_layers = ivec4(-1);
+	inout_options = ivec4(0);
+	inout_color = vec4(0.0);
+	if(useInstances > 0)
+	{
+		modelMatrix = instances[gl_InstanceID].model;
+		texTransform0 = instances[gl_InstanceID].texTransform[0];
+		texTransform1 = instances[gl_InstanceID].texTransform[1];
+		inout_layers = instances[gl_InstanceID].layers;
+		inout_options = instances[gl_InstanceID].options;
+		inout_color = instances[gl_InstanceID].color;
+	}
+
+	inout_positionWorld = modelMatrix * vec4(in_position, 1.0);
 
 	// Basics - transform model and pass on texture coordinates
-	inout_texcoord = (texTransform[0] * vec3(in_texcoord,1.0)).xy;
-	inout_texcoord2 = (texTransform[1] * vec3(in_texcoord,1.0)).xy;
-	gl_Position = proj * view * model * vec4(in_position, 1.0);
+	inout_texcoord = (texTransform0 * vec3(in_texcoord,1.0)).xy;
+	inout_texcoord2 = (texTransform1 * vec3(in_texcoord,1.0)).xy;
+	gl_Position = proj * view * modelMatrix * vec4(in_position, 1.0);
 	
 	// Calc the vectors for shading
 	vec3 viewVectorWorldSpace = viewPosition.xyz - inout_positionWorld.xyz;
 	vec3 lightVectorWorldSpace = lights[0].position.xyz - inout_positionWorld.xyz;
 	
 	// Prepare Lighting & Normal Mapping
-	inout_normal = normalize(vec3(model * vec4(in_normal, 0.0)));
-	inout_tangent = normalize(vec3(model * vec4(in_tangent, 0.0)));
-	inout_bitangent = normalize(vec3(model * vec4(in_bitangent, 0.0)));
+	inout_normal = normalize(vec3(modelMatrix * vec4(in_normal, 0.0)));
+	// Packed tangents may bring w as -1/3 instead of -1, only the sign counts
+	vec3 bitangent = cross(in_normal, in_tangent.xyz) * (in_tangent.w < 0.0 ? -1.0 : 1.0);
+	inout_tangent = normalize(vec3(modelMatrix * vec4(in_tangent.xyz, 0.0)));
+	inout_bitangent = normalize(vec3(modelMatrix * vec4(bitangent, 0.0)));
 	inout_viewVector = viewVectorWorldSpace;
 	inout_lightVector = lightVectorWorldSpace;
 }
\ No newline at end of file
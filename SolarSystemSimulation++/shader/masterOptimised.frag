@@ -8,11 +8,15 @@ in vec3 inout_tangent;
 in vec3 inout_bitangent;
 in vec3 inout_lightVector;
 in vec3 inout_viewVector;
+flat in ivec4 inout_layers;
+flat in ivec4 inout_options;
+flat in vec4 inout_color;
 
 // The pixels final color
 out vec4 out_color;
 
 float FAR_PLANE = 250.0;
+const float PI = 3.14159265;
 
 // Light Definition
 struct lightSource
@@ -35,10 +39,6 @@ struct material
   float shininess;
 };
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 proj;
-
 // Solid color or textured
 uniform int useColor;
 uniform vec4 modelColor;
@@ -55,13 +55,31 @@ uniform sampler2D normalTexSampler;
 uniform int useSpecularMapping;
 uniform sampler2D specularTexSampler;
 
+// Instanced draws take the material from the instance and the textures from the arrays
+uniform int useInstances;
+uniform sampler2DArray colorLayers;
+uniform sampler2DArray dataLayers;
+
 // With shadowmapping for 4 lights!
 uniform samplerCube shadowCubes[4];
 uniform int excludeFromLighting;
-uniform lightSource lights[4];
 float shadowFactors[4];
 
-uniform int numberOfLights;
+// The lights of the frame, shared by all shaders
+layout(std140) uniform LightBlock
+{
+	lightSource lights[4];
+	int numberOfLights;
+};
+
+// The shadow casters as spheres for the analytic shadows, matches RenderPipeline::OccluderBlockData
+layout(std140) uniform OccluderBlock
+{
+	vec4 occluders[32];			// center and radius
+	vec4 lightRadii;			// of the body around each light, 0 for a point light
+	int numberOfOccluders;
+	int useAnalyticShadows;		// instead of the shadow cubes
+};
 
 // TODO: reflect/refract material
 // Default Material for now (white -> color preserving)
@@ -122,6 +140,46 @@ float calculateShadowFactor(samplerCube cube, lightSource light)
 }
 
 
+// Fraction of a disc with radius r1 covered by a disc with radius r2 at distance d
+float discOverlap(float r1, float r2, float d)
+{
+	if (d >= r1 + r2)
+		return 0.0;
+	if (d <= abs(r1 - r2))
+		return min(r2 * r2 / (r1 * r1), 1.0);
+
+	float a = r1 * r1 * acos(clamp((d * d + r1 * r1 - r2 * r2) / (2.0 * d * r1), -1.0, 1.0));
+	float b = r2 * r2 * acos(clamp((d * d + r2 * r2 - r1 * r1) / (2.0 * d * r2), -1.0, 1.0));
+	float c = 0.5 * sqrt(max((-d + r1 + r2) * (d + r1 - r2) * (d - r1 + r2) * (d + r1 + r2), 0.0));
+	return (a + b - c) / (PI * r1 * r1);
+}
+
+// Calculate the shadow factor for a light as the visible part of its disc,
+// the occluders are discs in front of it as seen from the fragment.
+float calculateOcclusion(lightSource light, float lightRadius)
+{
+	vec3 toLight = (light.position - inout_positionWorld).xyz;
+	float lightDistance = length(toLight);
+	float lightAngle = max(asin(min(lightRadius / lightDistance, 1.0)), 0.0001);
+
+	float visible = 1.0;
+	for (int i = 0; i < numberOfOccluders; ++i)
+	{
+		vec3 toOccluder = occluders[i].xyz - inout_positionWorld.xyz;
+		float occluderDistance = length(toOccluder);
+
+		// Skip the body of the fragment (the facets lie inside the sphere) and bodies behind the light
+		if (occluderDistance < occluders[i].w * 1.05 || occluderDistance - occluders[i].w > lightDistance)
+			continue;
+
+		float occluderAngle = asin(occluders[i].w / occluderDistance);
+		float separation = atan(length(cross(toLight, toOccluder)), dot(toLight, toOccluder));
+		visible *= 1.0 - discOverlap(lightAngle, occluderAngle, separation);
+	}
+	return visible;
+}
+
+
 const float cosMinusAngle = 0.0472; // 5 degree
 void pointOrSpotLight(in int i, in vec3 N, in vec3 V, in vec3 D, in float shininess, in float spec, inout vec4 ambient, inout vec4 diffuse, inout vec4 specular)
 {
@@ -176,16 +234,16 @@ void calculateLighting(in int numLights, in vec3 N, in vec3 V, in vec3 D, in flo
 {
 	// 'error: sampler arrays indexed with non-constant expressions are forbidden in GLSL 1.30 and later'
 	if(numLights > 0) {
-		shadowFactors[0] = calculateShadowFactor(shadowCubes[0], lights[0]);
+		shadowFactors[0] = useAnalyticShadows != 0 ? calculateOcclusion(lights[0], lightRadii.x) : calculateShadowFactor(shadowCubes[0], lights[0]);
 	}
 	if(numLights > 1) {
-		shadowFactors[1] = calculateShadowFactor(shadowCubes[1], lights[1]);
+		shadowFactors[1] = useAnalyticShadows != 0 ? calculateOcclusion(lights[1], lightRadii.y) : calculateShadowFactor(shadowCubes[1], lights[1]);
 	}
 	if(numLights > 2) {
-		shadowFactors[2] = calculateShadowFactor(shadowCubes[2], lights[2]);
+		shadowFactors[2] = useAnalyticShadows != 0 ? calculateOcclusion(lights[2], lightRadii.z) : calculateShadowFactor(shadowCubes[2], lights[2]);
 	}
 	if(numLights > 3) {
-		shadowFactors[3] = calculateShadowFactor(shadowCubes[3], lights[3]);
+		shadowFactors[3] = useAnalyticShadows != 0 ? calculateOcclusion(lights[3], lightRadii.w) : calculateShadowFactor(shadowCubes[3], lights[3]);
 	}
 
     for (int i = 0; i < numLights; i++)
@@ -205,15 +263,31 @@ void calculateLighting(in int numLights, in vec3 N, in vec3 V, in vec3 D, in flo
 
 void main()
 {	
+	bool instanced = useInstances > 0;
+	int solidColor = instanced ? inout_options.x : useColor;
+	int blending = instanced ? inout_options.y : blendMode;
+	int unlit = instanced ? inout_options.z : excludeFromLighting;
+	bool normalMapping = instanced ? inout_layers.z >= 0 : useNormalMapping > 0;
+	bool specularMapping = instanced ? inout_layers.w >= 0 : useSpecularMapping > 0;
+
 	// Color or Texture
-	if(useColor > 0)
-		frontMaterial.diffuse = modelColor;
+	if(solidColor > 0)
+		frontMaterial.diffuse = instanced ? inout_color : modelColor;
 	else
 	{
-		vec4 tex1 = texture(textureSampler0,inout_texcoord);
-		vec4 tex2 = texture(textureSampler1,inout_texcoord2) * vec4(useTexture[1]);
+		vec4 tex1, tex2;
+		if(instanced)
+		{
+			tex1 = texture(colorLayers, vec3(inout_texcoord, inout_layers.x));
+			tex2 = texture(colorLayers, vec3(inout_texcoord2, max(inout_layers.y, 0))) * float(inout_layers.y >= 0);
+		}
+		else
+		{
+			tex1 = texture(textureSampler0,inout_texcoord);
+			tex2 = texture(textureSampler1,inout_texcoord2) * vec4(useTexture[1]);
+		}
 		
-		if(blendMode == 1)	// Screen
+		if(blending == 1)	// Screen
 			frontMaterial.diffuse.xyz = 1 - (1 - tex1.xyz) * (1 - tex2.xyz);
 		else
 		{					// Normal
@@ -223,16 +297,18 @@ void main()
 		frontMaterial.diffuse.a = tex1.a;
 	}
 	
-	if(excludeFromLighting > 0)
+	if(unlit > 0)
 	{
 		out_color = frontMaterial.diffuse;
 		return;
 	}
 	
 	vec3 normal = normalize(inout_normal);
-	if(useNormalMapping > 0)
+	if(normalMapping)
 	{
-		vec3 lookup = texture(normalTexSampler, inout_texcoord).rgb * 2.0 - 1.0;
+		vec3 lookup = (instanced
+			? texture(dataLayers, vec3(inout_texcoord, inout_layers.z)).rgb
+			: texture(normalTexSampler, inout_texcoord).rgb) * 2.0 - 1.0;
 		normal =  (lookup.x * inout_tangent) 
 				+ (lookup.y * inout_bitangent)
 				+ (lookup.z * normal);
@@ -240,9 +316,11 @@ void main()
 	}
 
 	float specularAmount = 0.0;
-	if(useSpecularMapping > 0)
+	if(specularMapping)
 	{
-		specularAmount = texture(specularTexSampler, inout_texcoord).r;
+		specularAmount = instanced
+			? texture(colorLayers, vec3(inout_texcoord, inout_layers.w)).r
+			: texture(specularTexSampler, inout_texcoord).r;
 	}
 	
 	// Front light
@@ -6,8 +6,13 @@ layout(location = 0) in vec3 in_position;
 // Output
 out vec3 in_texcoord;
 
-// Transformation Matrices
-uniform mat4 model, view, proj;
+// Camera of the frame, shared by all shaders
+layout(std140) uniform CameraBlock
+{
+	mat4 view;
+	mat4 proj;
+	vec4 viewPosition;
+};
 
 void main()
 {
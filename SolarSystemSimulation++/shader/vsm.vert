@@ -2,13 +2,26 @@
 
 layout(location = 0) in vec3 in_position;
 
-out vec4 vPositionEye;
+// The geometry shader projects to the cube faces
+out vec4 vPositionWorld;
+flat out int vSides;
 
-uniform mat4 cameraToShadowView;
-uniform mat4 cameraToShadowProjector;
-uniform mat4 model;
+// Shadow casters are always drawn instanced, matches RenderPipeline::InstanceData
+struct instanceData
+{
+	mat4 model;
+	mat3 texTransform[2];
+	ivec4 layers;
+	ivec4 options;
+	vec4 color;
+};
+
+layout(std140) uniform InstanceBlock
+{
+	instanceData instances[64];
+};
 	
 void main() {
-	gl_Position = cameraToShadowProjector * model * vec4(in_position, 1.0);
-	vPositionEye  = cameraToShadowView * model * vec4(in_position, 1.0);
+	vPositionWorld = instances[gl_InstanceID].model * vec4(in_position, 1.0);
+	vSides = instances[gl_InstanceID].options.x;
 };
\ No newline at end of file